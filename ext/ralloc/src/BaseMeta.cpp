@@ -16,6 +16,8 @@
 #include <string>
 #include <chrono> 
 #include <iostream>
+#include <thread>
+#include <condition_variable>
 
 #include "BaseMeta.hpp"
 
@@ -196,6 +198,7 @@ BaseMeta::BaseMeta(Regions* r) noexcept
 : 
     _rgs(r),
     avail_sb(),
+    avail_large(),
     heaps()
     // thread_num(thd_num) {
 {
@@ -214,25 +217,32 @@ BaseMeta::BaseMeta(Regions* r) noexcept
         FLUSH(&heaps[idx]);
     }
 
+    /* default size classes unless set_size_classes is called */
+    for(int i=0;i<MAX_SZ_IDX;i++){
+        sc_sizes[i] = 0;
+        FLUSH(&sc_sizes[i]);
+    }
+
     /* persistent roots init */
     for(int i=0;i<MAX_ROOTS;i++){
         roots[i] = nullptr;
         FLUSH(&roots[i]);
     }
 
-    // warm up small sb space, expanding sb region by SB_REGION_EXPAND_SIZE
+    // warm up small sb space, expanding sb region by SB_REGION_WARMUP_SIZE
     void* tmp_sec_start = nullptr;
     int res = 0;
     while (res == 0){
-        res = _rgs->expand(SB_IDX,&tmp_sec_start,SBSIZE, SB_REGION_EXPAND_SIZE);
+        res = _rgs->expand(SB_IDX,&tmp_sec_start,SBSIZE, SB_REGION_WARMUP_SIZE);
         assert(res != -1 && "warmup sb allocation fails!");
     }
     DBG_PRINT("expand sb space for small sb allocation\n");
     _rgs->regions[SB_IDX]->__store_heap_start(tmp_sec_start);
     _rgs->regions_address[SB_IDX] = (char*)tmp_sec_start;
+    expand_descs((char*)tmp_sec_start + SB_REGION_WARMUP_SIZE);
     //we skip the first sb on purpose so that CrossPtr doesn't start from 0.
     tmp_sec_start = (char*)((uint64_t)tmp_sec_start+SBSIZE);
-    organize_sb_list(tmp_sec_start, SB_REGION_EXPAND_SIZE/SBSIZE-1);
+    organize_sb_list(tmp_sec_start, SB_REGION_WARMUP_SIZE/SBSIZE-1);
     FLUSHFENCE;
 }
 
@@ -264,9 +274,10 @@ inline void* BaseMeta::expand_get_large_sb(size_t sz){
     int res = 0;
     while(res == 0) {
         res = _rgs->expand(SB_IDX,&ret,PAGESIZE, sz);
-        assert(res != -1 && "space runs out!");
+        if(res == -1) return nullptr; // space runs out
     }
     DBG_PRINT("expand sb space for large sb allocation\n");
+    expand_descs((char*)ret + sz);
     
     Descriptor* desc = desc_lookup(ret);
     new (desc) Descriptor();
@@ -274,7 +285,7 @@ inline void* BaseMeta::expand_get_large_sb(size_t sz){
 }
 
 inline size_t BaseMeta::get_sizeclass(size_t size){
-    return sizeclass.get_sizeclass(size);
+    return size_classes->get_sizeclass(size);
 }
 
 inline const SizeClassData* BaseMeta::get_sizeclass(ProcHeap* h){
@@ -282,7 +293,7 @@ inline const SizeClassData* BaseMeta::get_sizeclass(ProcHeap* h){
 }
 
 inline const SizeClassData* BaseMeta::get_sizeclass_by_idx(size_t idx) { 
-    return sizeclass.get_sizeclass_by_idx(idx);
+    return size_classes->get_sizeclass_by_idx(idx);
 }
 
 uint32_t BaseMeta::compute_idx(char* superblock, char* block, size_t sc_idx) {
@@ -296,6 +307,10 @@ uint32_t BaseMeta::compute_idx(char* superblock, char* block, size_t sc_idx) {
     //  a jump table using size class index
     // compiler can then optimize integer div due to known divisor
     uint32_t diff = uint32_t(block - superblock);
+    if (size_classes != &sizeclass) {
+        // the jump table below is for the default classes only
+        return diff / sc_block_size;
+    }
     uint32_t idx = 0;
     switch (sc_idx) {
 #define SIZE_CLASS_bin_yes(index, block_size)		\
@@ -319,30 +334,79 @@ uint32_t BaseMeta::compute_idx(char* superblock, char* block, size_t sc_idx) {
     return idx;
 }
 
-void BaseMeta::fill_cache(size_t sc_idx, TCacheBin* cache) {
+void BaseMeta::fill_cache(size_t sc_idx, TCacheBin* cache, bool newsb) {
+    cache->fills++;
+    cache->refilled = true;
+    // take a bin another thread gave away, if any
+    TransferCache& tc = transfers[sc_idx];
+    if (tc.num.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lk(tc.lock);
+        int n = tc.num.load(std::memory_order_relaxed);
+        if (n > 0) {
+            cache->push_list(tc.heads[n-1], tc.counts[n-1]);
+            tc.num.store(n-1, std::memory_order_relaxed);
+            cache->batches_in++;
+            return;
+        }
+    }
     // at most cache will be filled with number of blocks equal to superblock
     size_t block_num = 0;
     // use a *SINGLE* partial superblock to try to fill cache
     malloc_from_partial(sc_idx, cache, block_num);
     // if we obtain no blocks from partial superblocks, create a new superblock
-    if (block_num == 0)
+    if (block_num == 0 && newsb)
         malloc_from_newsb(sc_idx, cache, block_num);
 
     const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
     (void)sc;
-    assert(block_num > 0);
+    // block_num is 0 only if the heap is out of space, or newsb is false
     assert(block_num <= sc->cache_block_num);
 }
 
+void BaseMeta::release_cache(size_t sc_idx, TCacheBin* cache) {
+    const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
+    // a thread that also allocates from this class reuses what it keeps,
+    // so let it keep more; one that only frees hands full bins on
+    if (cache->refilled)
+        cache->limit = min(cache->limit*2, sc->cache_block_num*TCACHE_SCALE);
+    else
+        cache->limit = max(cache->limit/2, sc->cache_block_num);
+    cache->refilled = false;
+    cache->flushes++;
+
+    TransferCache& tc = transfers[sc_idx];
+    if (tc.num.load(std::memory_order_relaxed) < TRANSFER_BATCH_NUM) {
+        std::lock_guard<std::mutex> lk(tc.lock);
+        int n = tc.num.load(std::memory_order_relaxed);
+        if (n < TRANSFER_BATCH_NUM) {
+            tc.heads[n] = cache->peek_block();
+            tc.counts[n] = cache->get_block_num();
+            tc.num.store(n+1, std::memory_order_relaxed);
+            cache->pop_list(nullptr, cache->get_block_num());
+            cache->batches_out++;
+            return;
+        }
+    }
+    flush_cache(sc_idx, cache);
+}
+
+void BaseMeta::flush_transfers() {
+    for (size_t sc_idx = 1; sc_idx < MAX_SZ_IDX; sc_idx++) {
+        TransferCache& tc = transfers[sc_idx];
+        std::lock_guard<std::mutex> lk(tc.lock);
+        for (int i = 0; i < tc.num.load(std::memory_order_relaxed); i++) {
+            TCacheBin bin;
+            bin.push_list(tc.heads[i], tc.counts[i]);
+            flush_cache(sc_idx, &bin);
+        }
+        tc.num.store(0, std::memory_order_relaxed);
+    }
+}
+
 void BaseMeta::flush_cache(size_t sc_idx, TCacheBin* cache) {
     ProcHeap* heap = &heaps[sc_idx];
     const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
     uint32_t const sb_size = sc->sb_size;
-    uint32_t const block_size = sc->block_size;
-    // after CAS, desc might become empty and
-    //  concurrently reused, so store maxcount
-    uint32_t const maxcount = sc->get_block_num();
-    (void)maxcount; // suppress unused warning
 
     // @todo: optimize
     // in the normal case, we should be able to return several
@@ -372,53 +436,96 @@ void BaseMeta::flush_cache(size_t sc_idx, TCacheBin* cache) {
 
         cache->pop_list(static_cast<char*>(*(pptr<char>*)tail), block_count);
 
-        // add list to desc, update anchor
-        uint32_t idx = compute_idx(superblock, head, sc_idx);
-
-        Anchor oldanchor = desc->anchor.load();
-        Anchor newanchor;
-        do {
-            // update anchor.avail
-            char* next = (char*)(superblock + oldanchor.avail * block_size);
-            *(pptr<char>*)tail = next;
-
-            newanchor = oldanchor;
-            newanchor.avail = idx;
-            // state updates
-            // don't set SB_PARTIAL if state == SB_ACTIVE
-            if (oldanchor.state == SB_FULL)
-                newanchor.state = SB_PARTIAL;
-            // this can't happen with SB_ACTIVE
-            // because of reserved blocks
-            assert(oldanchor.count < desc->maxcount);
-            if (oldanchor.count + block_count == desc->maxcount) {
-                newanchor.count = desc->maxcount - 1;
-                newanchor.state = SB_EMPTY; // can free superblock
-            }
-            else
-                newanchor.count += block_count;
+        free_list_to_sb(desc, superblock, sc_idx, head, tail, block_count);
+    }
+}
+
+void BaseMeta::free_list_to_sb(Descriptor* desc, char* superblock, size_t sc_idx,
+    char* head, char* tail, uint32_t block_count) {
+    const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
+    uint32_t const block_size = sc->block_size;
+    // after CAS, desc might become empty and
+    //  concurrently reused, so store maxcount
+    uint32_t const maxcount = sc->get_block_num();
+    (void)maxcount; // suppress unused warning
+
+    // add list to desc, update anchor
+    uint32_t idx = compute_idx(superblock, head, sc_idx);
+
+    Anchor oldanchor = desc->anchor.load();
+    Anchor newanchor;
+    do {
+        // update anchor.avail
+        char* next = (char*)(superblock + oldanchor.avail * block_size);
+        *(pptr<char>*)tail = next;
+
+        newanchor = oldanchor;
+        newanchor.avail = idx;
+        // state updates
+        // don't set SB_PARTIAL if state == SB_ACTIVE
+        if (oldanchor.state == SB_FULL)
+            newanchor.state = SB_PARTIAL;
+        // this can't happen with SB_ACTIVE
+        // because of reserved blocks
+        assert(oldanchor.count < desc->maxcount);
+        if (oldanchor.count + block_count == desc->maxcount) {
+            newanchor.count = desc->maxcount - 1;
+            newanchor.state = SB_EMPTY; // can free superblock
         }
-        while (!desc->anchor.compare_exchange_weak(oldanchor, newanchor));
-
-        // after last CAS, can't reliably read any desc fields
-        // as desc might have become empty and been concurrently reused
-        assert(oldanchor.avail < maxcount || oldanchor.state == SB_FULL);
-        assert(newanchor.avail < maxcount);
-        assert(newanchor.count < maxcount);
-
-        // CAS success
-        if (oldanchor.state == SB_FULL) {
-            if(newanchor.state == SB_EMPTY) {
-                // this sb becomes empty from full
-                small_sb_retire(superblock, SBSIZE);
-            } else {
-                // this sb becomes partial from full
-                heap_push_partial(desc);
-            }
+        else
+            newanchor.count += block_count;
+    }
+    while (!desc->anchor.compare_exchange_weak(oldanchor, newanchor));
+
+    // after last CAS, can't reliably read any desc fields
+    // as desc might have become empty and been concurrently reused
+    assert(oldanchor.avail < maxcount || oldanchor.state == SB_FULL);
+    assert(newanchor.avail < maxcount);
+    assert(newanchor.count < maxcount);
+
+    // CAS success
+    if (oldanchor.state == SB_FULL) {
+        if(newanchor.state == SB_EMPTY) {
+            // this sb becomes empty from full
+            small_sb_retire(superblock, SBSIZE);
+            freed_sbs.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            // this sb becomes partial from full
+            heap_push_partial(desc);
         }
     }
 }
 
+void BaseMeta::set_size_classes(const std::vector<uint32_t>& sizes){
+    assert(SizeClass::valid(sizes.data(), sizes.size()));
+    for(size_t i=0;i<sizes.size();i++){
+        sc_sizes[i+1] = sizes[i];
+    }
+    for(int i=0;i<MAX_SZ_IDX;i++){
+        FLUSH(&sc_sizes[i]);
+    }
+    FLUSHFENCE;
+}
+
+std::vector<uint32_t> BaseMeta::get_size_classes(){
+    std::vector<uint32_t> ret;
+    for(int i=1;i<MAX_SZ_IDX && sc_sizes[i]!=0;i++){
+        ret.push_back(sc_sizes[i]);
+    }
+    return ret;
+}
+
+void BaseMeta::expand_descs(char* sb_end){
+    char* desc_end = reinterpret_cast<char*>(desc_lookup(sb_end-1)+1);
+    RegionManager* rgn = _rgs->regions[DESC_IDX];
+    char* curr;
+    while((curr = rgn->curr_addr_ptr->load()) < desc_end){
+        void* tmp;
+        int res = rgn->__try_nvm_region_allocator(&tmp, CACHELINE_SIZE, desc_end-curr);
+        assert(res != -1 && "desc region runs out!");
+    }
+}
+
 Descriptor* BaseMeta::desc_lookup(const char* ptr){
     uint64_t sb_index = (((uint64_t)ptr)>>SB_SHIFT) - (((uint64_t)_rgs->lookup(SB_IDX))>>SB_SHIFT); // the index of sb this block in
     Descriptor* ret = reinterpret_cast<Descriptor*>(_rgs->lookup(DESC_IDX));
@@ -479,6 +586,7 @@ retry:
     do {
         if (oldanchor.state == SB_EMPTY) {
             small_sb_retire(superblock, get_sizeclass(heap)->sb_size);
+            freed_sbs.fetch_add(1, std::memory_order_relaxed);
             goto retry;
         }
 
@@ -525,7 +633,7 @@ void BaseMeta::malloc_from_newsb(size_t sc_idx, TCacheBin* cache, size_t& block_
     uint32_t const maxcount = sc->get_block_num();
 
     char* superblock = reinterpret_cast<char*>(small_sb_alloc(sc->sb_size));
-    assert(superblock);
+    if (superblock == nullptr) return; // out of space
     Descriptor* desc = desc_lookup(superblock);
 
     desc->heap.assign(_rgs,heap);
@@ -562,6 +670,38 @@ void BaseMeta::malloc_from_newsb(size_t sc_idx, TCacheBin* cache, size_t& block_
     block_num += maxcount;
 }
 
+size_t BaseMeta::malloc_newsb_to(size_t sc_idx, void** out) {
+    ProcHeap* heap = &heaps[sc_idx];
+    const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
+    uint32_t const block_size = sc->block_size;
+    uint32_t const maxcount = sc->get_block_num();
+
+    char* superblock = reinterpret_cast<char*>(small_sb_alloc(sc->sb_size));
+    if (superblock == nullptr) return 0; // out of space
+    Descriptor* desc = desc_lookup(superblock);
+
+    desc->heap.assign(_rgs,heap);
+    desc->block_size = block_size;
+    desc->maxcount = maxcount;
+    desc->superblock.assign(_rgs, superblock);
+
+    // no block list: every block is handed out, and freed blocks are
+    // linked again by the cache they are freed to
+    for (uint32_t idx = 0; idx < maxcount; ++idx) {
+        out[idx] = superblock + idx * block_size;
+    }
+
+    Anchor anchor;
+    anchor.avail = maxcount;
+    anchor.count = 0;
+    anchor.state = SB_FULL;
+    desc->anchor.store(anchor);
+
+    FLUSH(desc);
+    FLUSHFENCE;
+    return maxcount;
+}
+
 //for sb in the free list, their desc are all constructed.
 inline void BaseMeta::organize_sb_list(void* start, uint64_t count){
     // put (start)...(start+count-1) sbs to free_sb queue
@@ -604,7 +744,15 @@ void* BaseMeta::small_sb_alloc(size_t size){
             }
         }
         else{
-            // below is effectively _rgs->regions[SB_IDX](&tmp_sec_start,PAGESIZE, SB_REGION_EXPAND_SIZE);
+            // coalescing may have merged free sbs into extents; split one
+            // sb off them before growing the region
+            Descriptor* desc = large_extent_take_sb();
+            if(desc != nullptr) {
+                return reinterpret_cast<void*>(sb_lookup(desc));
+            }
+            // carve REGION_GROW_SIZE of sbs, or what's left of the
+            // reservation, so the file grows by one step at a time
+            RegionManager* rgn = _rgs->regions[SB_IDX];
             char* next;
             char* res = nullptr;
             // char * old_curr_addr = _rgs->regions[SB_IDX]->curr_addr_ptr->load();
@@ -613,12 +761,13 @@ void* BaseMeta::small_sb_alloc(size_t size){
             if(aln_adj != 0)
                 new_curr_addr += (PAGESIZE - aln_adj);
             res = new_curr_addr;
-            uint64_t sb_to_expand = SB_REGION_EXPAND_SIZE/SBSIZE;
-            sb_to_expand /= thd_num;
+            char* limit = rgn->base_addr + rgn->RESERVE;
+            uint64_t sb_to_expand = res < limit ?
+                min(REGION_GROW_SIZE, (uint64_t)(limit - res))/SBSIZE : 0;
             next = new_curr_addr + sb_to_expand*SBSIZE;
-            if (next > _rgs->regions[SB_IDX]->base_addr + _rgs->regions[SB_IDX]->FILESIZE){
-                printf("\n----Region Manager: out of space in mmaped file-----\nCurr:%p\nBase:%p\n",res,_rgs->regions[SB_IDX]->base_addr);
-                assert(0);
+            if (sb_to_expand == 0 || !rgn->__grow(next)){
+                DBG_PRINT("out of space in sb region; curr: %p, base: %p\n", res, rgn->base_addr);
+                return nullptr;
             }
             // if (old_curr_addr != _rgs->regions[SB_IDX]->curr_addr_ptr->load()){
             //     // someone expanded the region, retry
@@ -631,6 +780,7 @@ void* BaseMeta::small_sb_alloc(size_t size){
                 DBG_PRINT("expand sb space for small sb allocation\n");
                 FLUSH(_rgs->regions[SB_IDX]->curr_addr_ptr);
                 FLUSHFENCE;
+                expand_descs(next);
                 organize_sb_list((char*)((uint64_t)res+SBSIZE), sb_to_expand-1);
                 Descriptor* desc = desc_lookup(res);
                 new (desc) Descriptor();
@@ -663,18 +813,266 @@ inline void BaseMeta::small_sb_retire(void* sb, size_t size){
  */
 inline void* BaseMeta::large_sb_alloc(size_t size){
     // cout<<"WARNING: Allocating a large object.\n";
-    return expand_get_large_sb(size);
+    uint64_t len = size/SBSIZE;
+    if(len == 1) {
+        // same as a superblock of small blocks
+        return small_sb_alloc(SBSIZE);
+    }
+    Descriptor* desc = large_extent_fit(len);
+    if(desc == nullptr && coalesce_free_sbs(len)) {
+        desc = large_extent_fit(len);
+    }
+    if(desc == nullptr) {
+        return expand_get_large_sb(size);
+    }
+    // split off the rest of a longer extent
+    uint64_t got = desc->anchor.load().count;
+    if(got > len) {
+        large_extent_push(desc+len, got-len);
+    }
+    new (desc) Descriptor();
+    large_reused.fetch_add(size, std::memory_order_relaxed);
+    return reinterpret_cast<void*>(sb_lookup(desc));
 }
 
 void BaseMeta::large_sb_retire(void* sb, size_t size){
     // cout<<"WARNING: Deallocating a large object.\n";
     assert(size%SBSIZE == 0);//size must be a multiple of SBSIZE
-    Descriptor* desc = desc_lookup(sb);
+    // keep the sbs together, so the extent can serve another large block
+    large_extent_push(desc_lookup(sb), size/SBSIZE);
+    freed_sbs.fetch_add(size/SBSIZE, std::memory_order_relaxed);
+}
+
+inline size_t BaseMeta::large_bucket(uint64_t len){
+    assert(len >= 2);
+    return min(len, LARGE_BUCKET_NUM+1) - 2;
+}
+
+void BaseMeta::large_extent_push(Descriptor* desc, uint64_t len){
+    if(len == 1) {
+        small_sb_retire(sb_lookup(desc), SBSIZE);
+        return;
+    }
+    // heap stays nullptr, so recovery sees the sbs as unused. the length
+    // is kept in the transient anchor.
     new (desc) Descriptor();
-    // no need for further flush and fence since they were called in constructor
-    // FLUSH(desc); //flush reinitialized desc
-    // FLUSHFENCE;
-    organize_sb_list(sb, size/SBSIZE);
+    desc->anchor.store(Anchor(0, len, SB_EMPTY));
+    AtomicCrossPtrCnt<Descriptor, DESC_IDX>& list = avail_large[large_bucket(len)];
+    ptr_cnt<Descriptor> oldhead = list.load(_rgs);
+    ptr_cnt<Descriptor> newhead;
+    do{
+        desc->next_free.store(oldhead.get_ptr());
+        newhead.set(desc, oldhead.get_counter()+1);
+    } while (!list.compare_exchange_weak(_rgs,oldhead,newhead));
+}
+
+Descriptor* BaseMeta::large_extent_pop(AtomicCrossPtrCnt<Descriptor, DESC_IDX>& list){
+    ptr_cnt<Descriptor> oldhead = list.load(_rgs);
+    while(oldhead.get_ptr() != nullptr) {
+        ptr_cnt<Descriptor> newhead;
+        newhead.set(oldhead.get_ptr()->next_free.load(), oldhead.get_counter());
+        if(list.compare_exchange_weak(_rgs,oldhead,newhead)) {
+            return oldhead.get_ptr();
+        }
+    }
+    return nullptr;
+}
+
+Descriptor* BaseMeta::large_extent_take_sb(){
+    // the shortest extents first, keeping long ones for large blocks
+    for(int b = 0; b < LARGE_BUCKET_NUM; b++) {
+        Descriptor* desc = large_extent_pop(avail_large[b]);
+        if(desc != nullptr) {
+            large_extent_push(desc+1, desc->anchor.load().count-1);
+            new (desc) Descriptor();
+            return desc;
+        }
+    }
+    return nullptr;
+}
+
+Descriptor* BaseMeta::take_sb_list(AtomicCrossPtrCnt<Descriptor, DESC_IDX>& list){
+    ptr_cnt<Descriptor> oldhead = list.load(_rgs);
+    ptr_cnt<Descriptor> newhead;
+    do{
+        if(oldhead.get_ptr() == nullptr) return nullptr;
+        newhead.set(nullptr, oldhead.get_counter()+1);
+    } while (!list.compare_exchange_weak(_rgs,oldhead,newhead));
+    return oldhead.get_ptr();
+}
+
+Descriptor* BaseMeta::large_extent_fit(uint64_t len){
+    // exact fit first, then the shortest longer extent
+    for(size_t b = large_bucket(len); b < LARGE_BUCKET_NUM-1; b++) {
+        Descriptor* desc = large_extent_pop(avail_large[b]);
+        if(desc != nullptr) return desc;
+    }
+    // the last list mixes all long extents; look at a few of them
+    Descriptor* skipped[LARGE_SCAN_NUM];
+    int skipped_num = 0;
+    Descriptor* ret = nullptr;
+    while(skipped_num < LARGE_SCAN_NUM) {
+        Descriptor* desc = large_extent_pop(avail_large[LARGE_BUCKET_NUM-1]);
+        if(desc == nullptr) break;
+        if(desc->anchor.load().count >= len) {
+            ret = desc;
+            break;
+        }
+        skipped[skipped_num++] = desc;
+    }
+    for(int i = 0; i < skipped_num; i++) {
+        large_extent_push(skipped[i], skipped[i]->anchor.load().count);
+    }
+    return ret;
+}
+
+bool BaseMeta::coalesce_free_sbs(uint64_t len){
+    // not worth a pass unless enough was freed since the last one
+    if(freed_sbs.load(std::memory_order_relaxed) < len) return false;
+    return merge_free_sbs() >= len;
+}
+
+uint64_t BaseMeta::merge_free_sbs(){
+    bool expected = false;
+    if(!coalescing.compare_exchange_strong(expected, true)) {
+        // someone else is at it; expand the heap rather than wait
+        return 0;
+    }
+    freed_sbs.store(0, std::memory_order_relaxed);
+    // detach all free lists. concurrent allocations find them empty
+    // meanwhile and expand the heap instead.
+    std::vector<std::pair<Descriptor*, uint64_t>> exts;
+    for(Descriptor* d = take_sb_list(avail_sb); d != nullptr; d = d->next_free.load()) {
+        exts.emplace_back(d, 1);
+    }
+    for(int b = 0; b < LARGE_BUCKET_NUM; b++) {
+        for(Descriptor* d = take_sb_list(avail_large[b]); d != nullptr; d = d->next_free.load()) {
+            exts.emplace_back(d, d->anchor.load().count);
+        }
+    }
+    // descriptors are laid out in the order of their sbs
+    std::sort(exts.begin(), exts.end());
+    uint64_t longest = 0;
+    size_t i = 0;
+    while(i < exts.size()) {
+        Descriptor* start = exts[i].first;
+        uint64_t n = exts[i].second;
+        size_t j = i+1;
+        while(j < exts.size() && exts[j].first == start+n) {
+            n += exts[j].second;
+            j++;
+        }
+        if(j-i > 1) {
+            large_coalesced.fetch_add(n, std::memory_order_relaxed);
+        }
+        large_extent_push(start, n);
+        longest = max(longest, n);
+        i = j;
+    }
+    coalescing.store(false);
+    return longest;
+}
+
+uint64_t BaseMeta::large_extent_remove(Descriptor* desc){
+    // the anchor of a free extent's head tells its list; a single free
+    // sb has a reset anchor and sits in avail_sb
+    Anchor anchor = desc->anchor.load();
+    bool extent = anchor.state == SB_EMPTY && anchor.count >= 2;
+    AtomicCrossPtrCnt<Descriptor, DESC_IDX>& list =
+        extent ? avail_large[large_bucket(anchor.count)] : avail_sb;
+    // detach the list, unlink desc, and put the rest back at once.
+    // concurrent allocations find the list empty meanwhile.
+    Descriptor* head = take_sb_list(list);
+    Descriptor* prev = nullptr;
+    Descriptor* found = nullptr;
+    for(Descriptor* d = head; d != nullptr; d = d->next_free.load()) {
+        if(d == desc) {
+            found = d;
+            if(prev == nullptr) {
+                head = d->next_free.load();
+            } else {
+                prev->next_free.store(d->next_free.load());
+            }
+            continue;
+        }
+        prev = d;
+    }
+    if(head != nullptr) {
+        ptr_cnt<Descriptor> oldhead = list.load(_rgs);
+        ptr_cnt<Descriptor> newhead;
+        do{
+            prev->next_free.store(oldhead.get_ptr());
+            newhead.set(head, oldhead.get_counter()+1);
+        } while (!list.compare_exchange_weak(_rgs,oldhead,newhead));
+    }
+    if(found == nullptr) return 0;
+    return extent ? found->anchor.load().count : 1;
+}
+
+bool BaseMeta::large_sb_extend(Descriptor* desc, uint64_t len){
+    // take the free extents right after the block, one after another,
+    // until len sbs are covered
+    RegionManager* rgn = _rgs->regions[SB_IDX];
+    uint64_t got = 0;
+    while(got < len) {
+        char* start = sb_lookup(desc+got);
+        char* curr = rgn->curr_addr_ptr->load();
+        if(curr == start) {
+            // nothing after the extents yet; the region grows under them
+            char* next = start + (len-got)*SBSIZE;
+            if(!rgn->__grow(next) || !rgn->curr_addr_ptr->compare_exchange_strong(curr, next)) {
+                break;
+            }
+            FLUSH(rgn->curr_addr_ptr);
+            FLUSHFENCE;
+            expand_descs(next);
+            return true;
+        }
+        uint64_t n = start < curr ? large_extent_remove(desc+got) : 0;
+        if(n == 0) break;
+        got += n;
+    }
+    if(got < len) {
+        // the neighbour is in use; return what was taken
+        if(got > 0) {
+            large_extent_push(desc, got);
+        }
+        return false;
+    }
+    if(got > len) {
+        large_extent_push(desc+len, got-len);
+    }
+    new (desc) Descriptor();
+    return true;
+}
+
+bool BaseMeta::do_realloc_in_place(void* ptr, size_t new_size){
+    Descriptor* desc = desc_lookup(ptr);
+    size_t sc_idx = desc->heap.to_addr(_rgs)->sc_idx;
+    if(sc_idx != 0) {
+        // small block: the block size stays the same within a class
+        return new_size != 0 && new_size <= MAX_SZ && get_sizeclass(new_size) == sc_idx;
+    }
+    if(new_size <= MAX_SZ) return false;
+    uint64_t len = desc->block_size/SBSIZE;
+    uint64_t new_len = round_up(new_size, SBSIZE)/SBSIZE;
+    if(new_len < len) {
+        // shrink before freeing the tail, so recovery never finds the
+        // tail in two places
+        desc->block_size = new_len*SBSIZE;
+        FLUSH(desc);
+        FLUSHFENCE;
+        large_sb_retire((char*)ptr + new_len*SBSIZE, (len-new_len)*SBSIZE);
+    } else if(new_len > len) {
+        // the sbs taken stay unused until block_size covers them, so a
+        // crash in between only leaves them free
+        if(!large_sb_extend(desc+len, new_len-len)) return false;
+        desc->block_size = new_len*SBSIZE;
+        FLUSH(desc);
+        FLUSHFENCE;
+        large_extended.fetch_add(new_len-len, std::memory_order_relaxed);
+    }
+    return true;
 }
 
 inline void* BaseMeta::alloc_large_block(size_t sz){
@@ -686,7 +1084,7 @@ void* BaseMeta::do_malloc(size_t size, TCaches& t_caches){
         // large block allocation
         size_t sbs = round_up(size, SBSIZE);//round size up to multiple of SBSIZE
         char* ptr = (char*)alloc_large_block(sbs);
-        assert(ptr);
+        if (ptr == nullptr) return nullptr; // out of space
         Descriptor* desc = desc_lookup(ptr);
 
         desc->heap.assign(_rgs,&heaps[0]);
@@ -703,6 +1101,7 @@ void* BaseMeta::do_malloc(size_t size, TCaches& t_caches){
         FLUSH(&desc);
         FLUSHFENCE;
 
+        t_caches.t_cache[0].allocs++;
         DBG_PRINT("large, ptr: %p", ptr);
         return (void*)ptr;
     }
@@ -712,11 +1111,47 @@ void* BaseMeta::do_malloc(size_t size, TCaches& t_caches){
 
     TCacheBin* cache = &t_caches.t_cache[sc_idx];
     // fill cache if needed
-    if (UNLIKELY(cache->get_block_num() == 0))
+    if (UNLIKELY(cache->get_block_num() == 0)) {
         fill_cache(sc_idx, cache);
+        if (cache->get_block_num() == 0) return nullptr; // out of space
+    }
 
+    cache->allocs++;
     return cache->pop_block();
 }
+void BaseMeta::do_malloc_bulk(size_t size, size_t num, void** out, TCaches& t_caches){
+    if (UNLIKELY(size > MAX_SZ)) {
+        for (size_t i = 0; i < num; i++) {
+            out[i] = do_malloc(size, t_caches);
+        }
+        return;
+    }
+
+    size_t sc_idx = get_sizeclass(size);
+    const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
+    uint32_t const maxcount = sc->get_block_num();
+    TCacheBin* cache = &t_caches.t_cache[sc_idx];
+    cache->allocs += num;
+    size_t i = 0;
+    while (i < num) {
+        if (cache->get_block_num() == 0) {
+            // reuse given-away bins and partial sbs before new sbs, which
+            // are carved directly while whole ones are needed
+            fill_cache(sc_idx, cache, num - i < maxcount);
+            if (cache->get_block_num() == 0) {
+                size_t got = malloc_newsb_to(sc_idx, out + i);
+                if (got == 0) {
+                    // out of space
+                    for (; i < num; i++) out[i] = nullptr;
+                    return;
+                }
+                i += got;
+                continue;
+            }
+        }
+        out[i++] = cache->pop_block();
+    }
+}
 void BaseMeta::do_free(void* ptr, TCaches& t_caches){
     if(ptr==nullptr) return;
     assert(_rgs->in_range(SB_IDX,ptr));
@@ -732,187 +1167,403 @@ void BaseMeta::do_free(void* ptr, TCaches& t_caches){
         char* superblock = desc->superblock.to_addr(_rgs);
         // free superblock
         large_sb_retire(superblock, desc->block_size);
+        t_caches.t_cache[0].frees++;
         return;
     }
 
     TCacheBin* cache = &t_caches.t_cache[sc_idx];
     const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
+    cache->frees++;
 
-    // flush cache if need
-    if (UNLIKELY(cache->get_block_num() >= sc->cache_block_num))
-        flush_cache(sc_idx, cache);
+    // give the cache away if full
+    if (UNLIKELY(cache->get_block_num() >= cache_limit(sc, cache)))
+        release_cache(sc_idx, cache);
 
     cache->push_block((char*)ptr);
 }
 
+void BaseMeta::do_free_batch(void** ptrs, size_t num, TCaches& t_caches){
+    // blocks of a superblock become adjacent, and nullptrs come first.
+    std::sort(ptrs, ptrs + num);
+    size_t i = 0;
+    while (i < num && ptrs[i] == nullptr) i++;
+    while (i < num) {
+        char* head = (char*)ptrs[i];
+        assert(_rgs->in_range(SB_IDX,head));
+        Descriptor* desc = desc_lookup(head);
+        size_t sc_idx = desc->heap.to_addr(_rgs)->sc_idx;
+        char* superblock = desc->superblock.to_addr(_rgs);
+
+        // large allocation case
+        if (UNLIKELY(!sc_idx)) {
+            large_sb_retire(superblock, desc->block_size);
+            t_caches.t_cache[0].frees++;
+            i++;
+            continue;
+        }
+
+        const SizeClassData* sc = get_sizeclass_by_idx(sc_idx);
+        size_t j = i + 1;
+        while (j < num && (char*)ptrs[j] < superblock + sc->sb_size)
+            j++;
+        uint32_t block_count = j - i;
+
+        TCacheBin* cache = &t_caches.t_cache[sc_idx];
+        cache->frees += block_count;
+        if (cache->get_block_num() + block_count <= cache_limit(sc, cache)) {
+            // keep them local for reuse, as do_free would.
+            for (size_t k = i; k < j; k++)
+                cache->push_block((char*)ptrs[k]);
+        } else {
+            for (size_t k = i; k + 1 < j; k++)
+                *(pptr<char>*)ptrs[k] = (char*)ptrs[k+1];
+            free_list_to_sb(desc, superblock, sc_idx, head, (char*)ptrs[j-1], block_count);
+        }
+        i = j;
+    }
+}
+
+void BaseMeta::plan_recovery(InuseRecovery::ChunkQueue& q, size_t begin_idx, size_t end_idx, int thd){
+    size_t chunk = max((end_idx-begin_idx)/(thd*RECOVERY_CHUNKS_PER_THD), RECOVERY_CHUNK_MIN);
+    if(thd == 1) chunk = end_idx-begin_idx;
+    // walk descriptors to move chunk starts out of large blocks
+    size_t idx = begin_idx;
+    for(size_t target = begin_idx; target < end_idx; target += chunk){
+        while(idx < target){
+            char* sb = _rgs->translate(SB_IDX, reinterpret_cast<char*>(idx<<SB_SHIFT));
+            Descriptor* desc = desc_lookup(sb);
+            if(desc->heap != nullptr && desc->heap.to_addr(_rgs)->sc_idx == 0 &&
+                desc->superblock.to_addr(_rgs) == sb && desc->block_size > SBSIZE){
+                idx += desc->block_size/SBSIZE;
+            } else {
+                idx++;
+            }
+        }
+        if(idx >= end_idx) break;
+        q.begins.push_back(idx);
+    }
+    q.begins.push_back(end_idx);
+}
+
+void BaseMeta::collect_stats(HeapStats& st, char* sb_end){
+    char* begin = _rgs->lookup(SB_IDX);
+    for(size_t i = 1; i < MAX_SZ_IDX; i++){
+        st.classes[i].block_size = get_sizeclass_by_idx(i)->block_size;
+        TransferCache& tc = transfers[i];
+        std::lock_guard<std::mutex> lk(tc.lock);
+        for(int j = 0; j < tc.num.load(std::memory_order_relaxed); j++){
+            st.classes[i].cached_blocks += tc.counts[j];
+        }
+    }
+    // the first sb is never used; see BaseMeta::BaseMeta
+    st.sbs = (sb_end - begin)/SBSIZE - 1;
+    for(uint64_t idx = 1; idx <= st.sbs;){
+        Descriptor* desc = desc_lookup(begin + (idx<<SB_SHIFT));
+        if(desc->heap == nullptr){
+            st.free_sbs++;
+            idx++;
+            continue;
+        }
+        size_t sc_idx = desc->heap.to_addr(_rgs)->sc_idx;
+        if(sc_idx == 0){
+            uint64_t len = max(desc->block_size/SBSIZE, 1);
+            st.large_sbs += len;
+            st.large_blocks++;
+            idx += len;
+            continue;
+        }
+        SizeClassStats& c = st.classes[sc_idx];
+        Anchor anchor = desc->anchor.load();
+        c.sbs[anchor.state]++;
+        c.blocks += desc->maxcount;
+        if(anchor.state == SB_EMPTY)
+            c.free_blocks += desc->maxcount;
+        else if(anchor.state == SB_PARTIAL)
+            c.free_blocks += anchor.count;
+        idx++;
+    }
+}
+
 /*
- * function GarbageCollection::operator()
- * 
+ * struct GCState
+ *
  * Description:
- *  Sequential stop-the-world garbage collection routine for Ralloc when dirty
- *  segment exists.
+ *  State shared by the threads of one garbage collection: the mark
+ *  bitmap and the stacks given away by busy threads to idle ones.
  */
-void GarbageCollection::operator() () {
-    // Wentao: commenting this out since we don't use this routine in
-    // Montage and I don't want to fix issues brought into this
-    // routine with multi-instance support...
-#if 0
-    printf("Start garbage collection...\n");
-    auto start = high_resolution_clock::now(); 
-    // Step 0: initialize all transient data
-    printf("Initializing all transient data...");
-    base_md->avail_sb.off.store(nullptr); // initialize avail_sb
-    for(int i = 0; i< MAX_SZ_IDX; i++) {
-        // initialize partial list of each heap
-        base_md->heaps[i].partial_list.off.store(nullptr);
+struct GCState{
+    BaseMeta* base_md;
+    char* sb_begin;
+    char* sb_end;
+    int thd;
+    // word in marks of the first block of each sb
+    std::vector<uint64_t> first;
+    std::atomic<uint64_t>* marks = nullptr;
+    size_t marks_size = 0;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<std::vector<GarbageCollection::Node>> pool;
+    std::atomic<size_t> pooled;
+    std::atomic<int> idle;
+    GCState(BaseMeta* b, char* begin, char* end, int t):
+        base_md(b), sb_begin(begin), sb_end(end), thd(t), pooled(0), idle(0){}
+    ~GCState(){
+        if(marks != nullptr) munmap(marks, marks_size);
+    }
+};
+
+// run f(0..thd-1) in parallel, f(0) on the calling thread
+static void run_threads(int thd, const std::function<void(int)>& f){
+    std::vector<std::thread> workers;
+    for(int i = 1; i < thd; i++){
+        workers.emplace_back(f, i);
     }
-    printf("Initialized!\n");
+    f(0);
+    for(auto& w : workers){
+        w.join();
+    }
+}
 
-    // Step 1: mark all accessible blocks from roots
-    printf("Marking reachable nodes...");
+char* GarbageCollection::mark(char* addr){
+    // the first sb is never used; see BaseMeta::BaseMeta
+    if(addr < state->sb_begin + SBSIZE || addr >= state->sb_end) return nullptr;
+    BaseMeta* base_md = state->base_md;
+    Descriptor* desc = base_md->desc_lookup(addr);
+    char* sb = reinterpret_cast<char*>((uint64_t)addr & SB_MASK);
+    // interior sbs of large blocks have no heap, so only pointers into
+    // the first sb of a large block keep it
+    if(desc->heap == nullptr || desc->superblock.to_addr(base_md->_rgs) != sb) return nullptr;
+    uint64_t bit = 0;
+    char* blk = sb;
+    if(desc->heap.to_addr(base_md->_rgs)->sc_idx != 0){
+        bit = (addr - sb)/desc->block_size;
+        if(bit >= desc->maxcount) return nullptr; // leftover of the sb
+        blk = sb + bit*desc->block_size;
+    }
+    std::atomic<uint64_t>& word = state->marks[state->first[(sb - state->sb_begin)>>SB_SHIFT] + bit/64];
+    uint64_t mask = 1ULL << (bit%64);
+    if((word.load(std::memory_order_relaxed) & mask) != 0 ||
+        (word.fetch_or(mask) & mask) != 0){
+        return nullptr;
+    }
+    marked++;
+    return blk;
+}
 
-    // First mark all root nodes
-    for(int i = 0; i < MAX_ROOTS; i++) {
-        if(!base_md->roots[i].is_null()) {
-            ralloc::roots_filter_func[i](base_md->roots[i], *this);
+void GarbageCollection::scan_block(char* blk){
+    uint64_t* curr = reinterpret_cast<uint64_t*>(blk);
+    uint64_t* end = reinterpret_cast<uint64_t*>(blk + state->base_md->desc_lookup(blk)->block_size);
+    for(; curr < end; curr++){
+        uint64_t val = *curr;
+        char* ptr = reinterpret_cast<char*>(val);
+        if(ptr >= state->sb_begin && ptr < state->sb_end){
+            mark_func(ptr);
+        } else if(is_valid_pptr(val)){
+            mark_func(from_pptr_off(val, reinterpret_cast<pptr<char>*>(curr)));
         }
     }
-    while(!to_filter_node.empty()) {
-        // pop nodes from the stack and call filter function of each node
-        auto func = to_filter_func.top();
-        auto node = to_filter_node.top();
-        to_filter_node.pop();
-        to_filter_func.pop();
-        func(node,*this);
-    }
-    printf("Done!\nReachable blocks = %lu\n", marked_blk.size());
-
-    // Step 2: sweep phase, update variables.
-    printf("Reconstructing metadata...");
-    char* curr_sb = _rgs->translate(SB_IDX, reinterpret_cast<char*>(SBSIZE)); // starting from first sb
-    Descriptor* curr_desc = base_md->desc_lookup(curr_sb);
-    auto curr_marked_blk = marked_blk.begin();
-    char* sb_end = _rgs->regions[SB_IDX]->curr_addr_ptr->load();
-    Descriptor* avail_sb = nullptr; // head of new free sb list
-
-    // go through all sb in the region
-    while(curr_sb < sb_end) {
-        Anchor anchor(0, 0, SB_EMPTY);
-        char* free_blocks_head = nullptr;
-        char* last_possible_free_block = curr_sb;
-
-        // go through all curr_marked_blk that's in this sb
-        while (curr_marked_blk!=marked_blk.end() && 
-                ((uint64_t)curr_sb>>SB_SHIFT) == ((uint64_t)(*curr_marked_blk)>>SB_SHIFT)) 
-        { 
-            // curr_marked_blk doesn't reach the end of marked_blk and curr_marked_blk is in curr_sb
-
-            if(curr_desc->heap != nullptr &&
-                curr_desc->superblock.assign(_rgs, curr_sb)) {
-                // false positive shouldn't enter here
-                if(curr_desc->heap->sc_idx == 0) {
-                    // large sb that's in use
-                    // assert((*curr_marked_blk) == curr_sb); //allow large sb
-                    // to be pointed at in the middle
-                    assert(curr_desc->maxcount == 1);
-                    anchor.state = SB_FULL; // set it as full
-                } 
-                else {
-                    // small sb that's in use
-                    anchor.state = SB_PARTIAL;
-                    for(char* free_block = last_possible_free_block; 
-                        free_block < (*curr_marked_blk); free_block+=curr_desc->block_size){
-                        // put last_possible_free_block...(curr_marked_blk-1) to free blk list
-                        (*reinterpret_cast<pptr<char>*>(free_block)) = free_blocks_head;
-                        free_blocks_head = free_block;
-                        anchor.count++;
-                    }
-                    last_possible_free_block = (*curr_marked_blk)+curr_desc->block_size;
-                }
+}
+
+void GarbageCollection::share(){
+    // someone idles and nobody has fed it yet
+    if(state->idle.load(std::memory_order_relaxed) == 0 ||
+        state->pooled.load(std::memory_order_relaxed) != 0) return;
+    // the bottom half, which is nearer to roots and likely leads further
+    size_t half = to_filter.size()/2;
+    std::vector<Node> batch(to_filter.begin(), to_filter.begin()+half);
+    to_filter.erase(to_filter.begin(), to_filter.begin()+half);
+    {
+        std::lock_guard<std::mutex> lk(state->lock);
+        state->pool.push_back(std::move(batch));
+        state->pooled.fetch_add(1);
+    }
+    state->cv.notify_one();
+}
+
+void GarbageCollection::drain(){
+    while(true){
+        while(!to_filter.empty()){
+            Node n = to_filter.back();
+            to_filter.pop_back();
+            n.filter(n.blk, *this);
+        }
+        std::unique_lock<std::mutex> lk(state->lock);
+        if(state->pool.empty()){
+            // only busy threads fill the pool, so it stays empty once
+            // all threads idle
+            if(state->idle.fetch_add(1)+1 == state->thd){
+                state->cv.notify_all();
+                return;
             }
-            curr_marked_blk++;
+            state->cv.wait(lk, [this]{
+                return !state->pool.empty() || state->idle.load() == state->thd;
+            });
+            if(state->pool.empty()) return;
+            state->idle.fetch_sub(1);
         }
-        if(anchor.state == SB_EMPTY) {
-            // curr_sb isn't in use
-            new (curr_desc) Descriptor();
-            curr_desc->next_free.store(avail_sb);
-            avail_sb = curr_desc;
-            curr_sb+=SBSIZE;
-            curr_desc++;
-        } else {
-            if(curr_desc->heap->sc_idx == 0) {
-                // large sb that's in use
+        to_filter.swap(state->pool.back());
+        state->pool.pop_back();
+        state->pooled.fetch_sub(1);
+    }
+}
 
-                anchor.avail = 0;
-                anchor.count = 0;
-                anchor.state = SB_FULL;
+void BaseMeta::reset_free_lists(){
+    avail_sb.off.store(nullptr);
+    for(int i = 0; i < LARGE_BUCKET_NUM; i++) {
+        // free extents are recovered as single sbs in avail_sb
+        avail_large[i].off.store(nullptr);
+    }
+    for(int i = 0; i< MAX_SZ_IDX; i++) {
+        heaps[i].partial_list.off.store(nullptr);
+    }
+}
 
-                // set transient variables in curr_desc
-                curr_desc->next_free.store(nullptr);
-                curr_desc->next_partial.store(nullptr);
-                curr_desc->anchor.store(anchor);
+size_t BaseMeta::gc_words(size_t idx, char* sb_begin){
+    char* sb = sb_begin + (idx<<SB_SHIFT);
+    Descriptor* desc = desc_lookup(sb);
+    if(desc->heap == nullptr || desc->superblock.to_addr(_rgs) != sb) return 0;
+    if(desc->heap.to_addr(_rgs)->sc_idx == 0) return 1;
+    return (desc->maxcount+63)/64;
+}
 
-                // move curr_sb to the sb next to this large sb
-                curr_sb+=curr_desc->block_size;
-                curr_desc = base_md->desc_lookup(curr_sb);
+void BaseMeta::gc_sweep(GCState& st, size_t begin_idx, size_t end_idx){
+    // free sbs of the chunk are linked here and pushed with a single CAS
+    Descriptor* free_head = nullptr;
+    Descriptor* free_tail = nullptr;
+    auto retire = [&](Descriptor* desc){
+        new (desc) Descriptor();
+        desc->next_free.store(free_head);
+        if(free_head == nullptr) free_tail = desc;
+        free_head = desc;
+    };
+    for(size_t idx = begin_idx; idx < end_idx;){
+        char* sb = st.sb_begin + (idx<<SB_SHIFT);
+        Descriptor* desc = desc_lookup(sb);
+        if(gc_words(idx, st.sb_begin) == 0){
+            retire(desc);
+            idx++;
+            continue;
+        }
+        std::atomic<uint64_t>* marks = &st.marks[st.first[idx]];
+        desc->next_free.store(nullptr);
+        desc->next_partial.store(nullptr);
+        if(desc->heap.to_addr(_rgs)->sc_idx == 0){
+            uint64_t len = max(desc->block_size/SBSIZE, 1);
+            if(marks[0].load(std::memory_order_relaxed) & 1){
+                desc->anchor.store(Anchor(0, 0, SB_FULL));
             } else {
-                // small sb that's in use
-                for(char* free_block = last_possible_free_block; 
-                    free_block < curr_sb+curr_desc->maxcount*curr_desc->block_size; free_block+=curr_desc->block_size){
-                    // put last_possible_free_block...(curr_sb+SBSIZE-1) to free blk list
-                    (*reinterpret_cast<pptr<char>*>(free_block)) = free_blocks_head;
-                    free_blocks_head = free_block;
-                    anchor.count++;
-                }
-                if(anchor.count == 0) { 
-                    // this sb is fully used
-                    anchor.avail = curr_desc->maxcount;
-                    anchor.state = SB_FULL;
-
-                    // set transient variables in curr_desc
-                    curr_desc->next_free.store(nullptr);
-                    curr_desc->next_partial.store(nullptr);
-                    curr_desc->anchor.store(anchor);
-                } else {
-                    // this sb is partially used
-                    assert(free_blocks_head != nullptr);
-                    assert((uint64_t)(free_blocks_head - curr_sb)%curr_desc->block_size == 0);
-                    anchor.avail = (uint64_t)(free_blocks_head - curr_sb)/curr_desc->block_size;
-                    anchor.state = SB_PARTIAL; // it must be SB_PARTIAL already but we assign it anyway
-
-                    // set transient variables in curr_desc
-                    curr_desc->next_free.store(nullptr);
-                    base_md->heap_push_partial(curr_desc);
-                    curr_desc->anchor.store(anchor);
-                }
-                // move curr_sb and curr_desc to next sb
-                curr_sb+=SBSIZE;
-                curr_desc++;
+                for(uint64_t i = 0; i < len; i++) retire(desc+i);
             }
+            idx += len;
+            continue;
+        }
+        // link unmarked blocks in address order
+        uint32_t block_size = desc->block_size;
+        uint32_t maxcount = desc->maxcount;
+        char* head = nullptr;
+        uint32_t avail = maxcount;
+        uint32_t count = 0;
+        for(uint32_t i = maxcount; i-- > 0;){
+            if(marks[i/64].load(std::memory_order_relaxed) & (1ULL << (i%64))) continue;
+            char* blk = sb + i*block_size;
+            *reinterpret_cast<pptr<char>*>(blk) = head;
+            head = blk;
+            avail = i;
+            count++;
         }
+        if(count == maxcount){
+            retire(desc);
+        } else if(count == 0){
+            desc->anchor.store(Anchor(maxcount, 0, SB_FULL));
+        } else {
+            desc->anchor.store(Anchor(avail, count, SB_PARTIAL));
+            heap_push_partial(desc);
+        }
+        idx++;
     }
-    // store head of new free sb list into base_md
-    ptr_cnt<Descriptor> tmp_avail_sb(avail_sb, 0);
-    base_md->avail_sb.store(_rgs, tmp_avail_sb);
-    printf("Reconstructed! \n");
-    auto stop = high_resolution_clock::now(); 
-    assert(curr_marked_blk == marked_blk.end());
-    auto duration = duration_cast<milliseconds>(stop - start);
-    cout << "Time elapsed = " << duration.count() <<" ms on GC."<<endl;
-
-
-    printf("Flushing recovered data...");
-    _rgs->flush_region(DESC_IDX);
-    _rgs->flush_region(SB_IDX);
-    char* addr_to_flush = reinterpret_cast<char*>(base_md);
-    // flush values in BaseMeta, including avail_sb and partial lists
-    for(size_t i = 0; i < sizeof(BaseMeta); i += CACHELINE_SIZE) {
-        addr_to_flush += CACHELINE_SIZE;
-        FLUSH(addr_to_flush);
+    if(free_head == nullptr) return;
+    ptr_cnt<Descriptor> oldhead = avail_sb.load(_rgs);
+    ptr_cnt<Descriptor> newhead;
+    do{
+        free_tail->next_free.store(oldhead.get_ptr());
+        newhead.set(free_head, oldhead.get_counter()+1);
+    }while(!avail_sb.compare_exchange_weak(_rgs,oldhead,newhead));
+}
+
+/*
+ * function BaseMeta::garbage_collect
+ * 
+ * Description:
+ *  Parallel stop-the-world garbage collection routine for Ralloc when dirty
+ *  segment exists. Free lists must have been reset.
+ *  1. size the mark bitmap: each sb gets a word per 64 blocks, a large
+ *     block gets one word;
+ *  2. mark blocks reachable from roots, filtering them with the functions
+ *     recorded by get_root<T>, or conservatively;
+ *  3. sweep chunks of sbs as recovery does, linking unmarked blocks and
+ *     rebuilding anchors, partial lists and avail_sb.
+ */
+size_t BaseMeta::garbage_collect(int thd, char* sb_end){
+    char* sb_begin = _rgs->lookup(SB_IDX);
+    const size_t end_idx = (sb_end - sb_begin)>>SB_SHIFT;
+    GCState st(this, sb_begin, sb_end, thd);
+
+    // Step 1: bitmap offsets by a parallel prefix sum over ranges of sbs
+    st.first.resize(end_idx+1);
+    std::vector<uint64_t> range_words(thd+1, 0);
+    size_t range = (end_idx+thd-1)/thd;
+    run_threads(thd, [&](int i){
+        for(size_t idx = i*range; idx < min((i+1)*range, end_idx); idx++){
+            st.first[idx] = gc_words(idx, sb_begin);
+            range_words[i+1] += st.first[idx];
+        }
+    });
+    for(int i = 0; i < thd; i++){
+        range_words[i+1] += range_words[i];
     }
-    FLUSHFENCE;
-    printf("Garbage collection Completed!\n");
-#endif
+    run_threads(thd, [&](int i){
+        uint64_t words = range_words[i];
+        for(size_t idx = i*range; idx < min((i+1)*range, end_idx); idx++){
+            uint64_t w = st.first[idx];
+            st.first[idx] = words;
+            words += w;
+        }
+    });
+    // zeroed pages are mapped as they are marked
+    st.marks_size = max(range_words[thd], 1)*sizeof(uint64_t);
+    void* marks = mmap(nullptr, st.marks_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(marks != MAP_FAILED && "mmap of gc bitmap fails!");
+    st.marks = reinterpret_cast<std::atomic<uint64_t>*>(marks);
+
+    // Step 2: mark all accessible blocks from roots
+    std::atomic<size_t> marked(0);
+    run_threads(thd, [&](int i){
+        GarbageCollection gc(&st);
+        if(i == 0){
+            for(int r = 0; r < MAX_ROOTS; r++){
+                if(roots[r].is_null()) continue;
+                if(roots_filter_func[r]){
+                    roots_filter_func[r](roots[r], gc);
+                } else {
+                    gc.mark_func(roots[r].to_addr(_rgs));
+                }
+            }
+        }
+        gc.drain();
+        marked.fetch_add(gc.marked);
+    });
+
+    // Step 3: sweep phase, update variables.
+    InuseRecovery::ChunkQueue chunks;
+    plan_recovery(chunks, 1, end_idx, thd);
+    run_threads(thd, [&](int){
+        size_t c;
+        while((c = chunks.next.fetch_add(1))+1 < chunks.begins.size()){
+            gc_sweep(st, chunks.begins[c], chunks.begins[c+1]);
+        }
+    });
+    return marked.load();
 }
 
 int InuseRecovery::iterator::update_status_dirty(){
@@ -971,13 +1622,16 @@ void InuseRecovery::iterator::set_sb_free(){
 bool InuseRecovery::iterator::action_at_new_sb_dirty(){
     // this func is called when curr_blk points at the first block of a sb
     // curr_blk will skip not-in-use sb and properly update metadata of sb it went through
-    while(update_status() == 0){
+    // check the boundary before the status: the sb at the boundary belongs
+    // to the next chunk, and may be in use. (not is_last(), which reads the
+    // block size of a possibly stale descriptor.)
+    while(curr_blk < boundary && update_status() == 0){
         // skip all not-in-use sb
-        if(is_last()) return false;
         set_sb_free();
         curr_blk = (RallocBlock*)((uint64_t)curr_blk + SBSIZE);
         curr_desc++;
     }
+    if(is_last()) return false;
 
     Anchor anchor(0, 0, SB_EMPTY);
     if(stat == 1) {
@@ -1001,12 +1655,13 @@ bool InuseRecovery::iterator::action_at_new_sb_dirty(){
 bool InuseRecovery::iterator::action_at_new_sb_clean(){
     // this func is called when curr_blk points at the first block of a sb
     // curr_blk will skip not-in-use sb and properly update metadata of sb it went through
-    while(update_status() == 0){
+    // see action_at_new_sb_dirty
+    while(curr_blk < boundary && update_status() == 0){
         // skip all not-in-use sb
-        if(is_last()) return false;
         curr_blk = (RallocBlock*)((uint64_t)curr_blk + SBSIZE);
         curr_desc++;
     }
+    if(is_last()) return false;
 
     Anchor anchor = curr_desc->anchor.load();
     if(stat == 1) {
@@ -1036,26 +1691,47 @@ bool InuseRecovery::iterator::action_at_new_sb_clean(){
 }
 
 InuseRecovery::iterator::iterator(BaseMeta* b, bool d, size_t begin_sb_idx, size_t end_sb_idx) : dirty(d) {
-    // start recovery and construct the iterator
+    // start recovery and construct the iterator, over a single chunk
     base_md = b;
-    curr_blk = begin_sb_idx==0 ? 
-        reinterpret_cast<RallocBlock*>(
-            base_md->_rgs->translate(SB_IDX, reinterpret_cast<char*>(SBSIZE))) :
-        reinterpret_cast<RallocBlock*>(
-            base_md->_rgs->translate(SB_IDX, reinterpret_cast<char*>(begin_sb_idx<<SB_SHIFT)));
-    curr_desc = base_md->desc_lookup((void*)curr_blk);
+    chunks = std::make_shared<ChunkQueue>();
+    chunks->begins.push_back(begin_sb_idx==0 ? 1 : begin_sb_idx);
+    chunks->begins.push_back(end_sb_idx==0 ?
+        (((uint64_t)base_md->_rgs->regions[SB_IDX]->curr_addr_ptr->load())>>SB_SHIFT) -
+        (((uint64_t)base_md->_rgs->lookup(SB_IDX))>>SB_SHIFT) : end_sb_idx);
+    claim_chunk();
+}
 
-    boundary = end_sb_idx==0 ? 
-        reinterpret_cast<RallocBlock*>(
-            base_md->_rgs->regions[SB_IDX]->curr_addr_ptr->load()) :
-        reinterpret_cast<RallocBlock*>(
-            base_md->_rgs->translate(SB_IDX, reinterpret_cast<char*>(end_sb_idx<<SB_SHIFT)));
+InuseRecovery::iterator::iterator(BaseMeta* b, bool d, std::shared_ptr<ChunkQueue> q) :
+    base_md(b), dirty(d), chunks(q) {
+    claim_chunk();
+}
 
-    action_at_new_sb();
+bool InuseRecovery::iterator::claim_chunk(){
+    while(true){
+        size_t c = chunks->next.fetch_add(1);
+        if(c+1 >= chunks->begins.size()){
+            // all claimed; stay at the end of the last chunk
+            curr_blk = boundary = reinterpret_cast<RallocBlock*>(
+                base_md->_rgs->translate(SB_IDX, reinterpret_cast<char*>(chunks->begins.back()<<SB_SHIFT)));
+            at_end = true;
+            return false;
+        }
+        chunk_cnt++;
+        curr_blk = reinterpret_cast<RallocBlock*>(
+            base_md->_rgs->translate(SB_IDX, reinterpret_cast<char*>(chunks->begins[c]<<SB_SHIFT)));
+        curr_desc = base_md->desc_lookup((void*)curr_blk);
+        boundary = reinterpret_cast<RallocBlock*>(
+            base_md->_rgs->translate(SB_IDX, reinterpret_cast<char*>(chunks->begins[c+1]<<SB_SHIFT)));
+        at_end = c+2 == chunks->begins.size();
+        if(chunks->begins[c] < chunks->begins[c+1] && action_at_new_sb()) {
+            return true;
+        }
+    }
 }
 
 InuseRecovery::iterator& InuseRecovery::iterator::operator++() {
     if(is_last()) return *this;
+    blk_cnt++;
     size_t next_blk = (size_t)curr_blk + size();
     if(!dirty){
         while(free_blks.count((char*)next_blk) != 0 && next_blk>>SB_SHIFT == (size_t)curr_blk>>SB_SHIFT){
@@ -1069,20 +1745,29 @@ InuseRecovery::iterator& InuseRecovery::iterator::operator++() {
             }
         }
     }
-    if(is_last((RallocBlock*)next_blk)){
-       curr_blk = reinterpret_cast<RallocBlock*>(
-        base_md->_rgs->regions[SB_IDX]->curr_addr_ptr->load());
+    // an aligned next_blk starts a new sb, e.g., right after a large
+    // block, whose size says nothing about the blocks that follow.
+    bool new_sb = (next_blk & ~SB_MASK) == 0;
+    if(!new_sb && !is_last((RallocBlock*)next_blk) &&
+        next_blk+size() > ((next_blk+SBSIZE) & SB_MASK)){
+        // next_blk is at the leftover of the sb
+        next_blk = (next_blk+SBSIZE) & SB_MASK;
+        new_sb = true;
+    }
+    if(new_sb ? (RallocBlock*)next_blk >= boundary : is_last((RallocBlock*)next_blk)){
+        // done with this chunk
+        claim_chunk();
         return *this;
     } 
     assert(next_blk <=  (size_t)base_md->_rgs->regions[SB_IDX]->curr_addr_ptr->load());
-    if(next_blk+size() > ((next_blk+SBSIZE) & SB_MASK)){
-        next_blk = (next_blk+SBSIZE) & SB_MASK;
-    }
     if(next_blk>>SB_SHIFT != (size_t)curr_blk>>SB_SHIFT){
         // operator++ brings curr_blk to next sb
         curr_blk = (RallocBlock*) next_blk;
         curr_desc = base_md->desc_lookup((void*)curr_blk);
-        action_at_new_sb();
+        if(!action_at_new_sb()) {
+            // the rest of the chunk is free; move on to the next one
+            claim_chunk();
+        }
     } else {
         // still in the same sb
         curr_blk = (RallocBlock*) next_blk;
@@ -1091,8 +1776,10 @@ InuseRecovery::iterator& InuseRecovery::iterator::operator++() {
 }
 
 bool InuseRecovery::iterator::is_last(InuseRecovery::RallocBlock* blk) {
+    // a large block starting in a chunk belongs to it even if it runs
+    // into the next one, which then starts after it.
     return blk >= boundary ||
-        (size_t)blk+size() > ((size_t)boundary & SB_MASK);
+        (at_end && (size_t)blk+size() > ((size_t)boundary & SB_MASK));
 }
 
 bool InuseRecovery::iterator::is_last() {
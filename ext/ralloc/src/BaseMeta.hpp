@@ -17,9 +17,8 @@
 #include <atomic>
 #include <iostream>
 #include <functional>
-#include <set>
+#include <mutex>
 #include <vector>
-#include <stack>
 #include <utility>
 #include <pthread.h>
 
@@ -55,6 +54,9 @@
  *      void* get_root<T>(uint64_t i):
  *          Return persistent root i, or nullptr if there isn't.
  *          Type T is recorded as the type of root i and will be used in GC.
+ *      size_t garbage_collect(int thd, char* sb_end):
+ *          Recover a dirty heap by marking blocks reachable from roots
+ *          and sweeping the rest, both with thd threads.
  *
  * Most of functions related to malloc and free share some portion of 
  * code with the open source project https://github.com/ricleite/lrmalloc
@@ -285,52 +287,82 @@ public:
  * class GarbageCollection
  * 
  * Descrition:
- *  A function class to do garbage collection during a dirty restart.
- *  Will be instantiated when BaseMeta::restart() is called and the segment is
- *  dirty.
+ *  One marking thread of a parallel garbage collection during a dirty
+ *  restart; see BaseMeta::garbage_collect. Threads mark blocks reachable
+ *  from roots in a bitmap shared through GCState, with one bit per block,
+ *  and keep blocks yet to filter on their own stacks. A thread gives half
+ *  of its stack away when another one runs out of blocks.
+ *
+ *  filter_func<T> is called on each marked block, and calls mark_func on
+ *  every pointer in it. It may be specialized for a type T to follow only
+ *  the real pointers; the default one is conservative.
  */
+struct GCState;
 class GarbageCollection{
 public:
-    std::set<char*> marked_blk;
-    std::stack<char*> to_filter_node;
-    std::stack<std::function<void(char*,GarbageCollection& gc)>> to_filter_func;
-
-    GarbageCollection():marked_blk(){};
+    typedef void (*FilterFunc)(char*, GarbageCollection&);
+    struct Node{
+        char* blk;
+        FilterFunc filter;
+    };
+    GCState* state;
+    std::vector<Node> to_filter;
+    // blocks marked by this thread
+    size_t marked = 0;
 
-    void operator() ();
+    GarbageCollection(GCState* s):state(s){};
 
-    // return true if ptr is a valid and unmarked pointer, otherwise false
+    // mark the block ptr points into, and push it to be filtered if it
+    // wasn't marked
     template<class T>
     inline void mark_func(T* ptr){
-        #if 0
-        void* addr = reinterpret_cast<void*>(ptr);
-        // Step 1: check if it's a valid pptr
-        if(UNLIKELY(!ralloc::_rgs->in_range(SB_IDX, addr))) 
-            return; // return if not in range
-        auto res = marked_blk.find(reinterpret_cast<char*>(addr));
-        if(res == marked_blk.end()){
-            // Step 2: mark potential pptr
-            marked_blk.insert(reinterpret_cast<char*>(addr));
-            // Step 3: push ptr to stack
-            to_filter_node.push(reinterpret_cast<char*>(addr));
-            to_filter_func.push([](char* ptr,GarbageCollection& gc){
-                    gc.filter_func(reinterpret_cast<T*>(ptr));
-                });
-        }
-        return;
-        #endif
+        char* addr = reinterpret_cast<char*>(ptr);
+        char* blk = mark(addr);
+        if(blk == nullptr) return;
+        // the type only says what's at ptr, not at an interior pointer's block
+        to_filter.push_back({blk, blk == addr ? &filter_node<T> : &filter_node<char>});
+        if(to_filter.size() > 1) share();
     }
 
     template<class T>
     inline void filter_func(T* ptr);
+
+    // filter blocks until no thread has any left
+    void drain();
+    // conservatively mark every word of blk that looks like a pointer or
+    // pptr into the heap
+    void scan_block(char* blk);
+private:
+    template<class T>
+    static void filter_node(char* blk, GarbageCollection& gc){
+        gc.filter_func(reinterpret_cast<T*>(blk));
+    }
+    // set the bit of the block addr points into. returns the start of
+    // the block, or nullptr if addr isn't in a block or it was marked.
+    char* mark(char* addr);
+    // give half of to_filter to an idle thread, if there is one
+    void share();
 };
 
 #include <iterator>
+#include <memory>
 #include <unordered_set>
 class BaseMeta;
 class InuseRecovery{
 public:
     class RallocBlock{ };
+    /*
+     * Superblock ranges of one recovery, shared by its iterators. Each
+     * iterator claims the next chunk when done with its own, so threads
+     * in sparse parts of the heap help with the dense ones.
+     */
+    struct ChunkQueue{
+        // first sb index of each chunk, followed by the end index.
+        // no chunk starts inside a large block.
+        std::vector<size_t> begins;
+        std::atomic<size_t> next;
+        ChunkQueue(): next(0){}
+    };
     class iterator : public std::iterator<
                         std::forward_iterator_tag,  // iterator_category
                         RallocBlock*,               // value_type
@@ -348,6 +380,12 @@ public:
         RallocBlock* boundary = nullptr;
         int stat = 0;
         const bool dirty; 
+        std::shared_ptr<ChunkQueue> chunks;
+        // boundary is the end of the sb region rather than of a chunk
+        bool at_end = false;
+        // blocks visited and chunks claimed by this iterator
+        size_t blk_cnt = 0;
+        size_t chunk_cnt = 0;
         // in-use blks in the curr sb, valid only when dirty is false
         std::unordered_set<char*> free_blks; 
         // 0: unused, 1: small, 2: large
@@ -365,8 +403,12 @@ public:
         }
         bool action_at_new_sb_dirty();
         bool action_at_new_sb_clean();
+        // move to the first in-use block of the next unclaimed chunk.
+        // returns false, leaving the iterator last, if there's none.
+        bool claim_chunk();
     public:
         explicit iterator(BaseMeta* b, bool d, size_t begin_sb_idx=0, size_t end_sb_idx=0);
+        iterator(BaseMeta* b, bool d, std::shared_ptr<ChunkQueue> q);
         iterator& operator++();
         inline bool operator==(iterator other) const { return curr_blk == other.curr_blk; }
         inline bool operator!=(iterator other) const { return !(*this == other); }
@@ -379,6 +421,12 @@ public:
         inline bool is_dirty() const{
             return dirty;
         }
+        inline size_t visited() const{
+            return blk_cnt;
+        }
+        inline size_t claimed() const{
+            return chunk_cnt;
+        }
     };
     // inline iterator& operator() (bool dirty){
     //     return iterator(dirty);
@@ -386,6 +434,74 @@ public:
 };
 
 
+/*
+ * struct HeapStats
+ *
+ * Description:
+ *  Occupancy of a heap, filled by BaseMeta::collect_stats and
+ *  Ralloc::stats. Block counts come from anchors of superblocks, which
+ *  are transient: they are approximate while threads allocate, and
+ *  meaningless in a heap left dirty until it is recovered.
+ */
+struct SizeClassStats{
+    uint32_t block_size = 0;
+    // sbs of this class by SuperblockState
+    uint64_t sbs[4] = {0, 0, 0, 0};
+    // blocks in those sbs, free ones in them, and free ones held by
+    // thread and transfer caches
+    uint64_t blocks = 0;
+    uint64_t free_blocks = 0;
+    uint64_t cached_blocks = 0;
+    // blocks allocated and freed since the heap was opened
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+};
+struct HeapStats{
+    // sbs carved from the region, out of at most max_sbs descriptors
+    uint64_t sbs = 0;
+    uint64_t max_sbs = MAX_DESC_AMOUNT;
+    // sbs not used by any class or large block
+    uint64_t free_sbs = 0;
+    // sbs held by large blocks, and the number of those blocks
+    uint64_t large_sbs = 0;
+    uint64_t large_blocks = 0;
+    // bytes of the sb region mapped, and reserved to grow into
+    uint64_t mapped_bytes = 0;
+    uint64_t reserved_bytes = 0;
+    // classes[0] counts allocations of large blocks
+    SizeClassStats classes[MAX_SZ_IDX];
+
+    inline uint64_t small_sbs() const{
+        return sbs - free_sbs - large_sbs;
+    }
+    // fraction of bytes in sbs of small classes that no block handed out
+    // occupies, cached blocks included
+    inline double fragmentation() const{
+        double total = 0, unused = 0;
+        for(int i = 1; i < MAX_SZ_IDX; i++){
+            const SizeClassStats& c = classes[i];
+            total += (double)c.blocks * c.block_size;
+            unused += (double)(c.free_blocks + c.cached_blocks) * c.block_size;
+        }
+        return total == 0 ? 0 : unused / total;
+    }
+    HeapStats& operator+=(const HeapStats& o){
+        sbs += o.sbs; max_sbs += o.max_sbs; free_sbs += o.free_sbs;
+        large_sbs += o.large_sbs; large_blocks += o.large_blocks;
+        mapped_bytes += o.mapped_bytes; reserved_bytes += o.reserved_bytes;
+        for(int i = 0; i < MAX_SZ_IDX; i++){
+            SizeClassStats& c = classes[i];
+            const SizeClassStats& oc = o.classes[i];
+            c.block_size = oc.block_size;
+            for(int s = 0; s < 4; s++) c.sbs[s] += oc.sbs[s];
+            c.blocks += oc.blocks; c.free_blocks += oc.free_blocks;
+            c.cached_blocks += oc.cached_blocks;
+            c.allocs += oc.allocs; c.frees += oc.frees;
+        }
+        return *this;
+    }
+};
+
 /*
  * class BaseMeta
  * 
@@ -407,20 +523,62 @@ public:
     RP_TRANSIENT int thd_num;
     // unused small sb
     RP_TRANSIENT AtomicCrossPtrCnt<Descriptor, DESC_IDX> avail_sb;
+    // unused extents of 2 or more sbs, left by large blocks and
+    // coalescing; see large_bucket()
+    RP_TRANSIENT AtomicCrossPtrCnt<Descriptor, DESC_IDX> avail_large[LARGE_BUCKET_NUM];
+    // set while a thread coalesces free sbs; others don't wait for it
+    RP_TRANSIENT std::atomic<bool> coalescing;
+    // sbs freed since the last coalescing pass
+    RP_TRANSIENT std::atomic<uint64_t> freed_sbs;
+    // bytes of large blocks served from free extents, and free sbs merged
+    // into longer extents, since the heap was opened
+    RP_TRANSIENT std::atomic<uint64_t> large_reused;
+    RP_TRANSIENT std::atomic<uint64_t> large_coalesced;
+    // sbs large blocks grew by in place
+    RP_TRANSIENT std::atomic<uint64_t> large_extended;
+    // full thread caches handed from threads that free blocks of a class
+    // to threads that allocate them; see release_cache
+    struct TransferCache{
+        std::mutex lock;
+        std::atomic<int> num{0};
+        char* heads[TRANSFER_BATCH_NUM];
+        uint32_t counts[TRANSFER_BATCH_NUM];
+    };
+    RP_TRANSIENT TransferCache transfers[MAX_SZ_IDX];
     RP_PERSIST pthread_mutexattr_t dirty_attr;
     RP_PERSIST pthread_mutex_t dirty_mtx;
     // fake_dirty is set only in RP_simulate_crash and is transient. Don't call RP_simulate_crash if there may be real crash
     RP_PERSIST bool fake_dirty = false;
 
     RP_PERSIST ProcHeap heaps[MAX_SZ_IDX];
+    // block sizes of classes 1.. chosen at heap creation; all 0 if the
+    // default table is used
+    RP_PERSIST uint32_t sc_sizes[MAX_SZ_IDX];
+    // the size class table built from sc_sizes, owned by Ralloc
+    RP_TRANSIENT const SizeClass* size_classes;
     RP_PERSIST CrossPtr<char, SB_IDX> roots[MAX_ROOTS];
     RP_TRANSIENT std::function<void(const CrossPtr<char, SB_IDX>&, 
         GarbageCollection&)> roots_filter_func[MAX_ROOTS];
     friend class GarbageCollection;
     friend class InuseRecovery;
-    inline void transient_reset(Regions* rgs_, int thd_num_){
+    inline void transient_reset(Regions* rgs_, int thd_num_, const SizeClass* sc){
         _rgs = rgs_;
         thd_num = thd_num_;
+        size_classes = sc;
+        coalescing.store(false);
+        freed_sbs.store(0);
+        large_reused.store(0);
+        large_coalesced.store(0);
+        large_extended.store(0);
+        for(int i = 0; i < MAX_SZ_IDX; i++){
+            new (&transfers[i]) TransferCache();
+        }
+        // filter functions left in the mapped file by a previous run point
+        // into that run's code, so drop them without destruction.
+        for(int i = 0; i < MAX_ROOTS; i++){
+            new (&roots_filter_func[i]) std::function<void(
+                const CrossPtr<char, SB_IDX>&, GarbageCollection&)>();
+        }
     }
     BaseMeta(Regions* r) noexcept;
     ~BaseMeta(){
@@ -430,7 +588,18 @@ public:
         std::cout<<"Warning: BaseMeta is being destructed!\n";
     }
     void* do_malloc(size_t size, TCaches& t_caches);
+    // allocate num blocks of size into out. whole sbs are carved directly
+    // into out, bypassing the thread cache and its block list.
+    void do_malloc_bulk(size_t size, size_t num, void** out, TCaches& t_caches);
     void do_free(void* ptr, TCaches& t_caches);
+    // free num blocks at once, sorting ptrs by address. blocks of a
+    // superblock go to the thread cache if they fit, otherwise back to
+    // the superblock with a single CAS.
+    void do_free_batch(void** ptrs, size_t num, TCaches& t_caches);
+    // resize the block at ptr without moving it, if its size class still
+    // fits new_size or, for a large block, the sbs after it are free.
+    // returns false if the block must move.
+    bool do_realloc_in_place(void* ptr, size_t new_size);
     // this func can be called only once during restart
     bool is_dirty();
     // set_dirty must be called AFTER is_dirty
@@ -450,7 +619,10 @@ public:
         assert(i<MAX_ROOTS);
         if(!roots[i].is_null()) 
             res = roots[i].to_addr(_rgs);
-        roots[i].assign(_rgs, ptr);
+        if(ptr == nullptr)
+            roots[i] = nullptr;
+        else
+            roots[i].assign(_rgs, ptr);
 
         FLUSH(&roots[i]);
         FLUSHFENCE;
@@ -517,10 +689,43 @@ private:
     uint32_t compute_idx(char* superblock, char* block, size_t sc_idx);
 
     // func on cache
-    void fill_cache(size_t sc_idx, TCacheBin* cache);
+    // newsb: whether to allocate a new sb if no free blocks are found
+    void fill_cache(size_t sc_idx, TCacheBin* cache, bool newsb = true);
 public:
     // we need to call this function to flush TLS cache during exit
     void flush_cache(size_t sc_idx, TCacheBin* cache);
+    // give away a full cache: to the transfer cache of its class if there's
+    // room, otherwise back to sbs. adapts cache->limit.
+    void release_cache(size_t sc_idx, TCacheBin* cache);
+    // flush bins parked in transfer caches back to sbs
+    void flush_transfers();
+    inline uint32_t cache_limit(const SizeClassData* sc, TCacheBin* cache){
+        if(UNLIKELY(cache->limit == 0)) cache->limit = sc->cache_block_num;
+        return cache->limit;
+    }
+    // record the size class table of a new heap
+    void set_size_classes(const std::vector<uint32_t>& sizes);
+    // the persisted table, or empty if it's the default one
+    std::vector<uint32_t> get_size_classes();
+    // expand the desc region to cover sbs up to sb_end
+    void expand_descs(char* sb_end);
+    // add occupancy of sbs up to sb_end and of transfer caches to st,
+    // without stopping other threads; see HeapStats
+    void collect_stats(HeapStats& st, char* sb_end);
+    // whether the heap was closed cleanly, so its anchors are valid.
+    // unlike is_dirty, doesn't mark the heap dirty; for inspecting a
+    // privately mapped copy of the heap.
+    inline bool left_clean(){
+        return pthread_mutex_trylock(&dirty_mtx) == 0;
+    }
+    // split sbs [begin_idx, end_idx) into chunks for thd recovery threads
+    void plan_recovery(InuseRecovery::ChunkQueue& q, size_t begin_idx, size_t end_idx, int thd);
+    // empty the sb free lists and partial lists before recovering a
+    // dirty heap, whose transient lists are stale
+    void reset_free_lists();
+    // rebuild a dirty heap with thd threads, keeping blocks reachable
+    // from roots and freeing the rest. returns the number of blocks kept.
+    size_t garbage_collect(int thd, char* sb_end);
     // find desc of the block
     // we need to call them in GC
     Descriptor* desc_lookup(const char* ptr);
@@ -529,12 +734,22 @@ public:
 
 private:
     // helper func
+    // return a linked list of block_count blocks, head to tail, to the
+    // superblock of desc.
+    void free_list_to_sb(Descriptor* desc, char* superblock, size_t sc_idx,
+        char* head, char* tail, uint32_t block_count);
     void heap_push_partial(Descriptor* desc);
     Descriptor* heap_pop_partial(ProcHeap* heap);
+    // words of the gc bitmap for sb idx: one per 64 blocks, 0 if unused
+    size_t gc_words(size_t idx, char* sb_begin);
+    // rebuild anchors and lists of sbs [begin_idx, end_idx) from marks
+    void gc_sweep(GCState& st, size_t begin_idx, size_t end_idx);
     // fill cache from a partially used sb in heap[sc_idx]
     void malloc_from_partial(size_t sc_idx, TCacheBin* cache, size_t& block_num);
     // fill cache by allocating a new sb in heap[sc_idx]
     void malloc_from_newsb(size_t sc_idx, TCacheBin* cache, size_t& block_num);
+    // allocate a new sb in heap[sc_idx] and write all its blocks to out
+    size_t malloc_newsb_to(size_t sc_idx, void** out);
     // alloc function to call for large block
     void* alloc_large_block(size_t sz);
 
@@ -550,6 +765,32 @@ private:
     // retire a large sb
     void large_sb_retire(void* sb, size_t size);
 
+    // index in avail_large of extents of len sbs
+    size_t large_bucket(uint64_t len);
+    // put the free extent of len sbs starting at desc to avail_large, or
+    // to avail_sb if it's a single sb
+    void large_extent_push(Descriptor* desc, uint64_t len);
+    Descriptor* large_extent_pop(AtomicCrossPtrCnt<Descriptor, DESC_IDX>& list);
+    // split the first sb off the shortest free extent, or nullptr
+    Descriptor* large_extent_take_sb();
+    // detach and return the whole list
+    Descriptor* take_sb_list(AtomicCrossPtrCnt<Descriptor, DESC_IDX>& list);
+    // pop a free extent of at least len sbs, or nullptr
+    Descriptor* large_extent_fit(uint64_t len);
+    // merge adjacent free sbs and extents. returns true if an extent of
+    // at least len sbs may now exist.
+    bool coalesce_free_sbs(uint64_t len);
+    // detach all free sbs and extents, merge adjacent ones and put them
+    // back. returns the longest extent put back, or 0 if another thread
+    // is merging.
+    uint64_t merge_free_sbs();
+    // take the free sb or extent starting at desc off its list. returns
+    // its length, or 0 if it isn't free.
+    uint64_t large_extent_remove(Descriptor* desc);
+    // acquire len free sbs starting at desc, from the free extents after
+    // it or by growing the region if they are at its end
+    bool large_sb_extend(Descriptor* desc, uint64_t len);
+
     // get unused desc from avail_desc or allocate a new space for desc
     Descriptor* desc_alloc();
     // put desc to avail_desc and flush it as unused
@@ -560,17 +801,7 @@ private:
 // in the block
 template<class T>
 inline void GarbageCollection::filter_func(T* ptr){
-    #if 0
-    char* curr = reinterpret_cast<char*>(ptr);
-    Descriptor* desc = ralloc::base_md->desc_lookup((char*)ptr);
-    size_t sz = desc->block_size;
-    for(size_t i=0;i<sz;i++){
-        char* curr_content = static_cast<char*>(*(reinterpret_cast<pptr<char>*>(curr)));
-        if(curr_content!=nullptr)
-            mark_func(curr_content);
-        curr++;
-    }
-    #endif
+    scan_block(reinterpret_cast<char*>(ptr));
 }
 
 
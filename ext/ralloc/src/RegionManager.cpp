@@ -31,7 +31,9 @@
 #include <unistd.h>
 #include <sys/select.h>
 
+#include <chrono>
 #include <iostream>
+#include <thread>
 // //mmap anynomous
 // void RegionManager::__map_transient_region(){
 // 	char* ret = (char*) mmap((void*) 0, FILESIZE,
@@ -49,6 +51,60 @@
 // 	printf("Current_addr: %p\n", curr_addr);
 // }
 
+//reserve address space for the whole region and map the file into it
+void RegionManager::__map_file(uint64_t len, int flags){
+    auto begin = std::chrono::steady_clock::now();
+    // one more sb (or huge page) so that base_addr, and hence sbs, have
+    // the same alignment in every run
+    uint64_t align = std::max(SBSIZE, opts.page_size);
+    reserve_len = RESERVE + align;
+    void * res =
+        mmap(0, reserve_len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(res != MAP_FAILED);
+    reserve_addr = (char*) res;
+
+    char* aligned = ALIGN_ADDR(reserve_addr, align);
+    void * addr =
+        mmap(aligned, len, PROT_READ | PROT_WRITE, flags | MAP_FIXED, FD, 0);
+    assert(addr == aligned);
+
+    base_addr = (char*) addr;
+    map_flags = flags;
+    mapped_size.store(len);
+    __prepare(base_addr, len);
+    map_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+}
+
+void RegionManager::__prepare(char* start, uint64_t len){
+#ifdef MADV_HUGEPAGE
+    // required for tmpfs, harmless for DAX
+    if(opts.page_size > (uint64_t)PAGESIZE) madvise(start, len, MADV_HUGEPAGE);
+#endif
+    if(opts.advice >= 0) madvise(start, len, opts.advice);
+    if(opts.prefault > 0) __prefault(start, len);
+}
+
+void RegionManager::__prefault(char* start, uint64_t len){
+    uint64_t unit = std::max(opts.page_size, (uint64_t)PAGESIZE);
+    uint64_t pages = (len + unit - 1) / unit;
+    int thd = (int)std::min((uint64_t)opts.prefault, pages);
+    auto work = [=](int i){
+        char* b = start + pages*i/thd*unit;
+        char* e = std::min(start + pages*(i+1)/thd*unit, start + len);
+#ifdef MADV_POPULATE_WRITE
+        if(madvise(b, e - b, MADV_POPULATE_WRITE) == 0) return;
+#endif
+        // write each page back as is; faults it in writable without
+        // changing the heap
+        for(volatile char* p = b; p < e; p += PAGESIZE) *p = *p;
+    };
+    std::vector<std::thread> workers;
+    for(int i = 1; i < thd; i++) workers.emplace_back(work, i);
+    work(0);
+    for(auto& w : workers) w.join();
+}
+
 //mmap file
 void RegionManager::__map_persistent_region(){
     DBG_PRINT("Creating a new persistent region...\n");
@@ -57,28 +113,19 @@ void RegionManager::__map_persistent_region(){
                 S_IRUSR | S_IWUSR);
 
     FD = fd;
-    off_t offt = lseek(fd, FILESIZE-1, SEEK_SET);
-    assert(offt != -1);
-
-    int result = write(fd, "", 1);
+    int result = ftruncate(fd, FILESIZE);
     assert(result != -1);
 
-    void * addr =
-        mmap(0, FILESIZE, PROT_READ | PROT_WRITE, MMAP_FLAG, fd, 0);
-    assert(addr != MAP_FAILED);
-
-    base_addr = (char*) addr;
+    __map_file(FILESIZE, MMAP_FLAG);
     // | curr_addr  |
     // | heap_start |
     // |     size   |
-    new (((atomic_pptr<char>*) base_addr)) atomic_pptr<char>((char*) ((size_t)addr + PAGESIZE));
+    new (((atomic_pptr<char>*) base_addr)) atomic_pptr<char>((char*) ((size_t)base_addr + PAGESIZE));
     curr_addr_ptr = (atomic_pptr<char>*)base_addr;
-    *(uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)) = FILESIZE;
+    __store_size(FILESIZE);
 
     FLUSH(curr_addr_ptr);
-    FLUSH((uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)));
     FLUSHFENCE;
-    DBG_PRINT("Addr: %p\n", addr);
     DBG_PRINT("Base_addr: %p\n", base_addr);
     DBG_PRINT("Current_addr: %p\n", curr_addr_ptr->load());
 }
@@ -89,23 +136,20 @@ void RegionManager::__remap_persistent_region(){
                 S_IRUSR | S_IWUSR);
 
     FD = fd;
-    off_t offt = lseek(fd, FILESIZE-1, SEEK_SET);
-    assert(offt != -1);
-
-    int result = write(fd, "", 1);
+    // the file may have grown in previous runs
+    struct stat st;
+    int result = fstat(fd, &st);
+    assert(result != -1);
+    uint64_t len = std::max((uint64_t)st.st_size, FILESIZE);
+    assert(len <= RESERVE && "region file larger than the reservation!");
+    result = ftruncate(fd, len);
     assert(result != -1);
 
-    offt = lseek(fd, 0, SEEK_SET);
-    assert (offt == 0);
-
-    void * addr =
-        mmap(0, FILESIZE, PROT_READ | PROT_WRITE, MMAP_FLAG, fd, 0);
-    assert(addr != MAP_FAILED);
-
-    base_addr = (char*) addr;
+    __map_file(len, MMAP_FLAG);
     curr_addr_ptr = (atomic_pptr<char>*)base_addr;
-    assert(*(uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)) == FILESIZE);
-    DBG_PRINT("Addr: %p\n", addr);
+    // a crash during __grow may leave the recorded size behind
+    assert(*(uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)) <= len);
+    __store_size(len);
     DBG_PRINT("Base_addr: %p\n", base_addr);
     DBG_PRINT("Curr_addr: %p\n", curr_addr_ptr->load());
 }
@@ -117,29 +161,19 @@ void RegionManager::__map_transient_region(){
                 S_IRUSR | S_IWUSR);
 
     FD = fd;
-    off_t offt = lseek(fd, FILESIZE-1, SEEK_SET);
-    assert(offt != -1);
-
-    int result = write(fd, "", 1);
+    int result = ftruncate(fd, FILESIZE);
     assert(result != -1);
 
-    void * addr =
-        mmap(0, FILESIZE, PROT_READ | PROT_WRITE, 
-            MAP_SHARED | MAP_NORESERVE, fd, 0);
-    assert(addr != MAP_FAILED);
-
-    base_addr = (char*) addr;
+    __map_file(FILESIZE, MAP_SHARED | MAP_NORESERVE);
     // | curr_addr  |
     // | heap_start |
     // |     size   |
-    new (((atomic_pptr<char>*) base_addr)) atomic_pptr<char>((char*) ((size_t)addr + PAGESIZE));
+    new (((atomic_pptr<char>*) base_addr)) atomic_pptr<char>((char*) ((size_t)base_addr + PAGESIZE));
     curr_addr_ptr = (atomic_pptr<char>*)base_addr;
-    *(uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)) = FILESIZE;
+    __store_size(FILESIZE);
 
     FLUSH(curr_addr_ptr);
-    FLUSH((uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)));
     FLUSHFENCE;
-    DBG_PRINT("Addr: %p\n", addr);
     DBG_PRINT("Base_addr: %p\n", base_addr);
     DBG_PRINT("Current_addr: %p\n", curr_addr_ptr->load());
 }
@@ -150,28 +184,57 @@ void RegionManager::__remap_transient_region(){
                 S_IRUSR | S_IWUSR);
 
     FD = fd;
-    off_t offt = lseek(fd, FILESIZE-1, SEEK_SET);
-    assert(offt != -1);
-
-    int result = write(fd, "", 1);
+    struct stat st;
+    int result = fstat(fd, &st);
+    assert(result != -1);
+    uint64_t len = std::max((uint64_t)st.st_size, FILESIZE);
+    assert(len <= RESERVE && "region file larger than the reservation!");
+    result = ftruncate(fd, len);
     assert(result != -1);
 
-    offt = lseek(fd, 0, SEEK_SET);
-    assert (offt == 0);
-
-    void * addr =
-        mmap(0, FILESIZE, PROT_READ | PROT_WRITE, 
-            MAP_SHARED | MAP_NORESERVE, fd, 0);
-    assert(addr != MAP_FAILED);
-
-    base_addr = (char*) addr;
+    __map_file(len, MAP_SHARED | MAP_NORESERVE);
     curr_addr_ptr = (atomic_pptr<char>*)base_addr;
-    assert(*(uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)) == FILESIZE);
-    DBG_PRINT("Addr: %p\n", addr);
+    __store_size(len);
     DBG_PRINT("Base_addr: %p\n", base_addr);
     DBG_PRINT("Curr_addr: %p\n", curr_addr_ptr->load());
 }
 
+void RegionManager::__store_size(uint64_t len){
+    *(uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)) = len;
+    FLUSH((uint64_t*)((size_t)base_addr + 2*sizeof(atomic_pptr<char>)));
+    FLUSHFENCE;
+}
+
+bool RegionManager::__grow(char* end){
+    if (end <= base_addr + mapped_size.load()) return true;
+    std::lock_guard<std::mutex> lk(grow_lock);
+    uint64_t curr = mapped_size.load();
+    if (end <= base_addr + curr) return true;
+    auto begin = std::chrono::steady_clock::now();
+    // small regions (e.g., descs) grow by a fraction of their reservation
+    uint64_t step = std::min(REGION_GROW_SIZE, ALIGN_VAL(RESERVE/16, (uint64_t)PAGESIZE));
+    step = std::max(step, opts.page_size);
+    uint64_t len = std::min(((uint64_t)(end - base_addr) + step - 1)/step*step, RESERVE);
+    if (end > base_addr + len) return false;
+
+    // extend the file first, so that the new range is never mapped past
+    // its end. the new blocks of the file are only allocated on touch.
+    int result = ftruncate(FD, len);
+    if (result == -1) return false;
+    void * addr =
+        mmap(base_addr + curr, len - curr, PROT_READ | PROT_WRITE, map_flags | MAP_FIXED, FD, curr);
+    if (addr == MAP_FAILED) return false;
+    assert(addr == base_addr + curr);
+    // prefault before publishing the new size, so no one uses the range yet
+    __prepare(base_addr + curr, len - curr);
+    __store_size(len);
+    mapped_size.store(len);
+    map_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+    DBG_PRINT("Region grown to %lu bytes\n", len);
+    return true;
+}
+
 //persist the curr and base address
 void RegionManager::__close_persistent_region(){
     FLUSHFENCE;
@@ -182,10 +245,10 @@ void RegionManager::__close_persistent_region(){
     unsigned long space_used = ((unsigned long) curr_addr_ptr->load() 
          - (unsigned long) base_addr);
     unsigned long remaining_space = 
-         ((unsigned long) FILESIZE - space_used) / (1024 * 1024);
+         ((unsigned long) mapped_size.load() - space_used) / (1024 * 1024);
     DBG_PRINT("Space Used(rounded down to MiB): %ld, Remaining(MiB): %ld\n", 
             space_used / (1024 * 1024), remaining_space);
-    munmap((void*)base_addr, FILESIZE);
+    munmap((void*)reserve_addr, reserve_len);
     close(FD);
 }
 
@@ -201,10 +264,10 @@ void RegionManager::__close_transient_region(){
     unsigned long space_used = ((unsigned long) curr_addr 
          - (unsigned long) base_addr);
     unsigned long remaining_space = 
-         ((unsigned long) FILESIZE - space_used) / (1024 * 1024);
+         ((unsigned long) mapped_size.load() - space_used) / (1024 * 1024);
     DBG_PRINT("Space Used(rounded down to MiB): %ld, Remaining(MiB): %ld\n", 
             space_used / (1024 * 1024), remaining_space);
-    munmap((void*)base_addr, FILESIZE);
+    munmap((void*)reserve_addr, reserve_len);
     close(FD);
 }
 
@@ -237,8 +300,9 @@ int RegionManager::__nvm_region_allocator(void** memptr, size_t alignment, size_
 
     res = new_curr_addr;
     next = new_curr_addr + size;
-    if (next > base_addr + FILESIZE){
-        printf("\n----Region Manager: out of space in mmaped file-----\nCurr:%p\nBase:%p\n",res,base_addr);
+    if (!__grow(next)){
+        // callers report the failure; a full heap isn't fatal
+        DBG_PRINT("out of space in mmaped file; curr: %p, base: %p\n",res,base_addr);
         return -1;
     }
     new_curr_addr = next;
@@ -271,8 +335,8 @@ int RegionManager::__try_nvm_region_allocator(void** memptr, size_t alignment, s
 
     res = new_curr_addr;
     next = new_curr_addr + size;
-    if (next > base_addr + FILESIZE){
-        printf("\n----Region Manager: out of space in mmaped file-----\n");
+    if (!__grow(next)){
+        DBG_PRINT("out of space in mmaped file\n");
         return -1;
     }
     new_curr_addr = next;
@@ -34,9 +34,11 @@
 #ifndef _REGION_MANAGER_HPP_
 #define _REGION_MANAGER_HPP_
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <atomic>
+#include <mutex>
 #include <vector>
 
 #include "pm_config.hpp"
@@ -48,26 +50,55 @@
  *	(The first page (4K) is reserved)
  *	atomic_pptr<char> curr_addr  0~63 (base_addr points to)
  *	heap_start = root - base_start 64~127
- *	uint64_t size 128~191
+ *	uint64_t size 128~191 (current length of the file)
  *	...
  *	(the first page ends and heap starts here to which heap_start points)
  *	....
  *	(heap ends here to which curr_addr points)
+ *
+ * Address space of RESERVE bytes is reserved for a region up front, but the
+ * file starts at FILESIZE and is only extended, and mapped further into the
+ * reservation, as the heap grows past it.
+ */
+
+/* optional hints on how to map a region:
+ *  page_size: 0, HUGEPAGE_2M or HUGEPAGE_1G. The region is aligned to it and
+ *   grows in multiples of it, so DAX or tmpfs may back it with huge pages.
+ *  prefault: number of threads faulting in the file when it is mapped or
+ *   grown, 0 to leave faults to first touch.
+ *  advice: madvise advice for the mapped file, or -1 for none.
  */
+struct RegionOptions{
+    uint64_t page_size = 0;
+    int prefault = 0;
+    int advice = -1;
+};
+
 class RegionManager{
 public:
     const uint64_t FILESIZE;
+    const uint64_t RESERVE;
     const std::string HEAPFILE;
     int FD = 0;
     char *base_addr = nullptr;
     atomic_pptr<char>* curr_addr_ptr;//this always points to the place of base_addr
     bool persist;
+    // length of the file mapped from base_addr
+    std::atomic<uint64_t> mapped_size;
+    const RegionOptions opts;
+    // ns spent in mapping, advising and prefaulting, growth included
+    std::atomic<uint64_t> map_ns;
 
-    RegionManager(const std::string& file_path, uint64_t size, bool p = true, bool imm_expand = true):
+    RegionManager(const std::string& file_path, uint64_t size, bool p = true, bool imm_expand = true, uint64_t reserve = 0,
+        const RegionOptions& o = RegionOptions()):
         FILESIZE(((size/PAGESIZE)+2)*PAGESIZE), // size should align to page
+        RESERVE(std::max(FILESIZE, ((reserve/PAGESIZE)+2)*PAGESIZE)),
         HEAPFILE(file_path),
         curr_addr_ptr(nullptr),
-        persist(p){
+        persist(p),
+        mapped_size(0),
+        opts(o),
+        map_ns(0){
         assert(size%CACHELINE_SIZE == 0); // size should be multiple of cache line size
         if(persist){
             if(exists_test(HEAPFILE)){
@@ -115,6 +146,7 @@ public:
     //mmap file
     //the only difference between persist and trans version is
     //persist always map to the same addr while trans doesn't
+    void __map_file(uint64_t len, int flags);
     void __map_persistent_region();
     void __remap_persistent_region();
     void __map_transient_region();
@@ -144,11 +176,27 @@ public:
      */
     int __try_nvm_region_allocator(void** /*ret */, size_t /* alignment */, size_t /*size */);
 
+    /* make sure the file is mapped up to $end$, extending it if needed.
+     * false if $end$ is beyond the reservation
+     */
+    bool __grow(char* end);
+
     //true if ptr is in persistent region, otherwise false
     bool __within_range(void* ptr);
 
     //destroy the region and delete the file
     void __destroy();
+private:
+    // the reserved address range, in which base_addr is aligned to SBSIZE
+    // and opts.page_size
+    char* reserve_addr = nullptr;
+    uint64_t reserve_len = 0;
+    int map_flags = 0;
+    std::mutex grow_lock;
+    void __store_size(uint64_t len);
+    // apply opts to a newly mapped range
+    void __prepare(char* start, uint64_t len);
+    void __prefault(char* start, uint64_t len);
 };
 
 /*
@@ -195,10 +243,11 @@ public:
         cur_idx = 0;
     }
 
-    /* to create desc or sb region */
-    void create(const std::string& file_path, uint64_t size, bool p = true, bool imm_expand = true){
+    /* to create desc or sb region, which may grow to $reserve$ */
+    void create(const std::string& file_path, uint64_t size, bool p = true, bool imm_expand = true, uint64_t reserve = 0,
+        const RegionOptions& opts = RegionOptions()){
         bool restart = exists_test(file_path);
-        RegionManager* new_mgr = new RegionManager(file_path,size,p,imm_expand);
+        RegionManager* new_mgr = new RegionManager(file_path,size,p,imm_expand,reserve,opts);
         regions[cur_idx] = new_mgr;
         if(imm_expand || restart)
             regions_address[cur_idx] = (char*)new_mgr->__fetch_heap_start();
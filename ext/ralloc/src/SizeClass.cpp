@@ -11,6 +11,9 @@
  * is retained. See LICENSE for details about MIT License.
  */
 
+#include <cassert>
+#include <limits>
+
 #include "pm_config.hpp"
 #include "SizeClass.hpp"
 
@@ -34,9 +37,26 @@ SizeClass::SizeClass():
 		SIZE_CLASSES
 	},
 	sizeclass_lookup{0} {
+	fill_lookup();
+}
+
+SizeClass::SizeClass(const uint32_t* sizes, size_t num):
+	sizeclasses{
+		{ 0, 0, 0, 0}
+	},
+	sizeclass_lookup{0} {
+	assert(valid(sizes, num));
+	for (size_t i = 0; i < num; ++i)
+	{
+		sizeclasses[i+1] = { sizes[i], SBSIZE, (uint32_t)(SBSIZE/sizes[i]), (uint32_t)(SBSIZE/sizes[i]) };
+	}
+	fill_lookup();
+}
+
+void SizeClass::fill_lookup(){
 	// first size class reserved for large allocations
 	size_t lookupIdx = 0;
-	for (size_t sc_idx = 1; sc_idx < MAX_SZ_IDX; ++sc_idx)
+	for (size_t sc_idx = 1; sc_idx < MAX_SZ_IDX && lookupIdx <= MAX_SZ; ++sc_idx)
 	{
 		SizeClassData const& sc = sizeclasses[sc_idx];
 		size_t block_size = sc.block_size;
@@ -48,4 +68,83 @@ SizeClass::SizeClass():
 	}
 }
 
+bool SizeClass::valid(const uint32_t* sizes, size_t num){
+	if (num == 0 || num > MAX_SZ_IDX-1 || sizes[num-1] != MAX_SZ)
+		return false;
+	for (size_t i = 0; i < num; ++i)
+	{
+		if (sizes[i] == 0 || sizes[i] % 8 != 0 || (i > 0 && sizes[i] <= sizes[i-1]))
+			return false;
+	}
+	return true;
+}
+
+std::vector<uint32_t> SizeClass::cache_line_sizes(){
+	std::vector<uint32_t> ret = {8, 16, 32, 48};
+	uint32_t sz = CACHELINE_SIZE;
+	for (; sz <= 1024; sz += CACHELINE_SIZE)
+		ret.push_back(sz);
+	for (uint32_t grp = 1024; sz < MAX_SZ; grp *= 2)
+	{
+		for (sz = grp + grp/4; sz <= 2*grp && sz < MAX_SZ; sz += grp/4)
+			ret.push_back(sz);
+	}
+	ret.push_back(MAX_SZ);
+	return ret;
+}
 
+std::vector<uint32_t> SizeClass::suggest(const std::vector<uint64_t>& hist, size_t num){
+	// candidate class sizes: requested sizes rounded up to 8, and MAX_SZ
+	std::vector<uint32_t> cand;
+	std::vector<uint64_t> cnt, bytes; // prefix sums over candidates
+	cnt.push_back(0);
+	bytes.push_back(0);
+	for (size_t sz = 8; sz <= MAX_SZ; sz += 8)
+	{
+		uint64_t c = 0, b = 0;
+		for (size_t i = sz-7; i <= sz && i < hist.size(); ++i)
+		{
+			c += hist[i];
+			b += hist[i]*i;
+		}
+		if (c == 0 && sz != MAX_SZ)
+			continue;
+		cand.push_back(sz);
+		cnt.push_back(cnt.back()+c);
+		bytes.push_back(bytes.back()+b);
+	}
+	size_t n = cand.size();
+	if (num > MAX_SZ_IDX-1)
+		num = MAX_SZ_IDX-1;
+	if (num >= n)
+		return cand;
+	// waste[k][j]: least bytes wasted by k classes covering the first j
+	// candidates, the last class being candidate j-1
+	const uint64_t inf = std::numeric_limits<uint64_t>::max();
+	std::vector<std::vector<uint64_t>> waste(num+1, std::vector<uint64_t>(n+1, inf));
+	std::vector<std::vector<size_t>> from(num+1, std::vector<size_t>(n+1, 0));
+	waste[0][0] = 0;
+	for (size_t k = 1; k <= num; ++k)
+	{
+		for (size_t j = k; j <= n; ++j)
+		{
+			for (size_t i = k-1; i < j; ++i)
+			{
+				if (waste[k-1][i] == inf)
+					continue;
+				// candidates i..j-1 all served by a class of cand[j-1]
+				uint64_t w = waste[k-1][i] +
+					(cnt[j]-cnt[i])*cand[j-1] - (bytes[j]-bytes[i]);
+				if (w < waste[k][j])
+				{
+					waste[k][j] = w;
+					from[k][j] = i;
+				}
+			}
+		}
+	}
+	std::vector<uint32_t> ret(num);
+	for (size_t k = num, j = n; k > 0; j = from[k][j], --k)
+		ret[k-1] = cand[j-1];
+	return ret;
+}
@@ -15,6 +15,8 @@
 #define __SIZE_CLASSES_H
 
 #include <cstddef>
+#include <cstdint>
+#include <vector>
 
 #include "pm_config.hpp"
 
@@ -30,6 +32,9 @@
  * and get_sizeclass. To use, just instantiate SizeClass and call 
  * get_sizeclass(size). SizeClass is safe to have multiple instances.
  *
+ * A heap may instead be created with its own table of block sizes, which
+ * is then persisted in BaseMeta; see Ralloc::Ralloc.
+ *
  * Wentao Cai (wcai6@cs.rochester.edu)
  */
 
@@ -55,10 +60,25 @@ class SizeClass{
 private:
 	SizeClassData sizeclasses[MAX_SZ_IDX];
 	size_t sizeclass_lookup[MAX_SZ + 1];
+	void fill_lookup();
 public:
 	SizeClass();
+	// classes 1..num of the given block sizes; see valid()
+	SizeClass(const uint32_t* sizes, size_t num);
 	inline size_t get_sizeclass(size_t size) const { return sizeclass_lookup[size]; }
 	inline const SizeClassData* get_sizeclass_by_idx(size_t idx) const { return &sizeclasses[idx]; }
+
+	// true if sizes are ascending multiples of 8 ending with MAX_SZ, and
+	// there are at most MAX_SZ_IDX-1 of them
+	static bool valid(const uint32_t* sizes, size_t num);
+	// multiples of a cache line up to 1K, and 4 classes per doubling up to
+	// MAX_SZ. Cache-line-aligned payloads then fit a class exactly, and all
+	// blocks of 64B or more start on a cache line.
+	static std::vector<uint32_t> cache_line_sizes();
+	// num classes with the least internal fragmentation for requests
+	// counted in hist, where hist[i] is the number of requests of i bytes
+	static std::vector<uint32_t> suggest(const std::vector<uint64_t>& hist,
+		size_t num = MAX_SZ_IDX-1);
 };
 namespace ralloc{
 	extern SizeClass sizeclass;
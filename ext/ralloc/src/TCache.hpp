@@ -59,6 +59,31 @@ public:
 	uint32_t get_block_num() const { return _block_num; }
 	TCacheBin() noexcept:_block(nullptr), _block_num(0) {};
 	// slow operations like fill/flush handled in cache user
+
+	// most blocks kept before the bin is given away, adapted by
+	// BaseMeta::release_cache; 0 until first used
+	uint32_t limit = 0;
+	// whether the bin was filled since it was last given away
+	bool refilled = false;
+	// fills and releases of the bin, and how many of them took or
+	// handed over a whole bin of another thread
+	uint64_t fills = 0;
+	uint64_t flushes = 0;
+	uint64_t batches_in = 0;
+	uint64_t batches_out = 0;
+	// blocks allocated and freed through the bin; bin 0 counts large
+	// blocks. see BaseMeta::collect_stats
+	uint64_t allocs = 0;
+	uint64_t frees = 0;
+};
+
+// sums of the TCacheBin counters over bins
+struct TCacheStats
+{
+	uint64_t fills = 0;
+	uint64_t flushes = 0;
+	uint64_t batches_in = 0;
+	uint64_t batches_out = 0;
 };
 
 struct TCaches
@@ -65,9 +65,31 @@ enum RegionIndex : int {
 
 /* Customizable Values */
 const uint64_t MAX_DESC_AMOUNT_BITS = 24;
-const uint64_t MIN_SB_REGION_SIZE = 1*1024*1024*1024ULL; // min sb region size
-const uint64_t SB_REGION_EXPAND_SIZE = MIN_SB_REGION_SIZE;
+// the size passed to Ralloc only reserves address space for the sb region;
+// its file starts with SB_REGION_WARMUP_SIZE of sbs and grows on demand.
+const uint64_t MIN_SB_REGION_SIZE = 128*1024*1024ULL; // min sb region size
+const uint64_t SB_REGION_WARMUP_SIZE = 64*1024*1024ULL;
+// region files are extended in multiples of this, or of 1/16 of their
+// reservation if smaller
+const uint64_t REGION_GROW_SIZE = 64*1024*1024ULL;
+// page sizes a region can be aligned to, to be backed by huge pages
+const uint64_t HUGEPAGE_2M = 2*1024*1024ULL;
+const uint64_t HUGEPAGE_1G = 1024*1024*1024ULL;
 const int MAX_ROOTS = 1024;
+// free lists of large extents: one per length of 2..LARGE_BUCKET_NUM sbs,
+// and the last one for all longer extents
+const int LARGE_BUCKET_NUM = 32;
+// extents to look at in the last list before giving up on a fit
+const int LARGE_SCAN_NUM = 8;
+// a thread cache holds up to TCACHE_SCALE times the default number of
+// blocks of a size class, if the thread both allocates and frees them
+const uint32_t TCACHE_SCALE = 4;
+// full thread caches parked per size class for other threads to take
+const int TRANSFER_BATCH_NUM = 16;
+// recovery splits the heap into about this many chunks per thread, each
+// at least RECOVERY_CHUNK_MIN sbs
+const int RECOVERY_CHUNKS_PER_THD = 16;
+const uint64_t RECOVERY_CHUNK_MIN = 16;
 
 /* System Macros */
 const int TYPE_SIZE = 4;
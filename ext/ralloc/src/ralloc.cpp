@@ -23,7 +23,8 @@ using namespace std;
 
 thread_local int Ralloc::tid = -1;
 
-Ralloc::Ralloc(int thd_num_, const char* id_, uint64_t size_){
+Ralloc::Ralloc(int thd_num_, const char* id_, uint64_t size_, const std::vector<uint32_t>& sc_sizes,
+    const RegionOptions& region_opts){
     string filepath;
     string id(id_);
     thd_num = thd_num_;
@@ -36,19 +37,33 @@ Ralloc::Ralloc(int thd_num_, const char* id_, uint64_t size_){
     assert(sizeof(Descriptor) == DESCSIZE); // check desc size
     assert(size_ < MAX_SB_REGION_SIZE && size_ >= MIN_SB_REGION_SIZE); // ensure user input is >=MAX_SB_REGION_SIZE
     uint64_t num_sb = size_/SBSIZE;
+    uint64_t warmup_sb = SB_REGION_WARMUP_SIZE/SBSIZE+1;
     restart = Regions::exists_test(filepath+"_basemd");
     _rgs = new Regions();
     for(int i=0; i<LAST_IDX;i++){
     switch(i){
     case DESC_IDX:
-        _rgs->create(filepath+"_desc", num_sb*DESCSIZE, true, true);
+        // descs of new sbs are added by BaseMeta::expand_descs
+        _rgs->create(filepath+"_desc", warmup_sb*DESCSIZE, true, true, num_sb*DESCSIZE);
         break;
     case SB_IDX:
-        _rgs->create(filepath+"_sb", num_sb*SBSIZE, true, false);
+        _rgs->create(filepath+"_sb", SB_REGION_WARMUP_SIZE, true, false, num_sb*SBSIZE, region_opts);
         break;
     case META_IDX:
         base_md = _rgs->create_for<BaseMeta>(filepath+"_basemd", sizeof(BaseMeta), true);
-        base_md->transient_reset(_rgs, thd_num);
+        if(!restart && !sc_sizes.empty()) {
+            base_md->set_size_classes(sc_sizes);
+        }
+        {
+            std::vector<uint32_t> sizes = base_md->get_size_classes();
+            if(!sizes.empty()) {
+                size_classes = new SizeClass(sizes.data(), sizes.size());
+            }
+        }
+        base_md->transient_reset(_rgs, thd_num,
+            size_classes ? size_classes : &ralloc::sizeclass);
+        // in case of a crash between expanding sb and desc regions
+        base_md->expand_descs(_rgs->regions[SB_IDX]->curr_addr_ptr->load());
         break;
     } // switch
     }
@@ -63,54 +78,137 @@ Ralloc::~Ralloc(){
         // thus is disabled for benchmark testing. To enable, simply comment out
         // -DMEM_CONSUME_TEST flag in Makefile.
         flush_caches();
-        delete t_caches;
+        delete[] t_caches;
         _rgs->flush_region(DESC_IDX);
         _rgs->flush_region(SB_IDX);
         // #endif
         base_md->writeback();
         initialized = false;
         delete _rgs;
+        delete size_classes;
+        delete[] size_hist;
     }
 }
 
-std::vector<InuseRecovery::iterator> Ralloc::recover(int thd){
-    bool dirty = base_md->is_dirty();
+TCacheStats Ralloc::cache_stats(){
+    TCacheStats ret;
+    for(int thd = 0; thd < thd_num; thd++) {
+        for(int i = 1; i < MAX_SZ_IDX; i++) {
+            const TCacheBin& bin = t_caches[thd].t_cache[i];
+            ret.fills += bin.fills;
+            ret.flushes += bin.flushes;
+            ret.batches_in += bin.batches_in;
+            ret.batches_out += bin.batches_out;
+        }
+    }
+    return ret;
+}
+
+HeapStats Ralloc::stats(){
+    HeapStats st;
+    base_md->collect_stats(st, _rgs->regions[SB_IDX]->curr_addr_ptr->load());
+    for(int thd = 0; thd < thd_num; thd++) {
+        for(int i = 0; i < MAX_SZ_IDX; i++) {
+            const TCacheBin& bin = t_caches[thd].t_cache[i];
+            st.classes[i].allocs += bin.allocs;
+            st.classes[i].frees += bin.frees;
+            if(i != 0) st.classes[i].cached_blocks += bin.get_block_num();
+        }
+    }
+    st.mapped_bytes = _rgs->regions[SB_IDX]->mapped_size.load();
+    st.reserved_bytes = _rgs->regions[SB_IDX]->RESERVE;
+    return st;
+}
+
+std::vector<uint32_t> Ralloc::size_classes_in_use(){
+    std::vector<uint32_t> ret;
+    const SizeClass* sc = size_classes ? size_classes : &ralloc::sizeclass;
+    for(int i = 1; i < MAX_SZ_IDX && sc->get_sizeclass_by_idx(i)->block_size != 0; i++) {
+        ret.push_back(sc->get_sizeclass_by_idx(i)->block_size);
+    }
+    return ret;
+}
+
+void Ralloc::record_sizes(){
+    if(size_hist == nullptr) {
+        size_hist = new std::atomic<uint64_t>[MAX_SZ+2]();
+    }
+}
+
+std::vector<uint64_t> Ralloc::size_histogram(){
+    std::vector<uint64_t> ret(MAX_SZ+2, 0);
+    if(size_hist != nullptr) {
+        for(int i = 0; i < MAX_SZ+2; i++) {
+            ret[i] = size_hist[i].load(std::memory_order_relaxed);
+        }
+    }
+    return ret;
+}
+
+bool Ralloc::is_dirty(){
+    if(checked_dirty < 0) {
+        checked_dirty = base_md->is_dirty() ? 1 : 0;
+    }
+    return checked_dirty == 1;
+}
+
+bool Ralloc::begin_recovery(){
+    bool dirty;
+    if(checked_dirty >= 0) {
+        dirty = checked_dirty == 1;
+        checked_dirty = -1;
+    } else {
+        dirty = base_md->is_dirty();
+    }
     if(dirty) {
         // initialize transient sb free and partial lists
-        base_md->avail_sb.off.store(nullptr); // initialize avail_sb
-        for(int i = 0; i< MAX_SZ_IDX; i++) {
-            // initialize partial list of each heap
-            base_md->heaps[i].partial_list.off.store(nullptr);
-        }
+        base_md->reset_free_lists();
     }
+    return dirty;
+}
+
+std::vector<InuseRecovery::iterator> Ralloc::recover(int thd){
+    bool dirty = begin_recovery();
     std::vector<InuseRecovery::iterator> ret;
     ret.reserve(thd);
     size_t begin_idx = 1;
     auto last_ptr = _rgs->regions[SB_IDX]->curr_addr_ptr->load();
     const size_t last_idx = (((uint64_t)last_ptr)>>SB_SHIFT) - 
         (((uint64_t)_rgs->lookup(SB_IDX))>>SB_SHIFT); // last sb+1
-    size_t total_sb = last_idx-begin_idx;
-    size_t sb_stride = total_sb/thd;
-    size_t end_idx = begin_idx+sb_stride;
+    // iterators pull chunks from a shared queue rather than taking fixed
+    // strides, as in-use sbs may cluster in parts of the heap.
+    auto chunks = std::make_shared<InuseRecovery::ChunkQueue>();
+    base_md->plan_recovery(*chunks, begin_idx, last_idx, thd);
     for(int i=0;i<thd;i++){
-        ret.emplace_back(base_md, dirty,begin_idx,end_idx);
-        begin_idx+=sb_stride;
-        end_idx = i==thd-2 ? last_idx : (end_idx+sb_stride);
+        ret.emplace_back(base_md, dirty, chunks);
     }
     return ret;
 }
 
+bool Ralloc::collect_garbage(int thd){
+    if(!begin_recovery()) return false;
+    base_md->garbage_collect(thd, _rgs->regions[SB_IDX]->curr_addr_ptr->load());
+    return true;
+}
+
 void* Ralloc::reallocate(void* ptr, size_t new_size, int tid_){
     if(ptr == nullptr) return allocate(new_size);
     if(!_rgs->in_range(SB_IDX, ptr)) return nullptr;
     size_t old_size = malloc_size(ptr);
-    if(old_size == new_size) {
+    if(old_size == new_size || base_md->do_realloc_in_place(ptr, new_size)) {
+        // nothing moved, so nothing to flush
         return ptr;
     }
     void* new_ptr = allocate(new_size,tid_);
     if(UNLIKELY(new_ptr == nullptr)) return nullptr;
-    memcpy(new_ptr, ptr, old_size);
-    FLUSH(new_ptr);
+    // flush only the bytes copied, not the whole new block
+    size_t copy_size = std::min(old_size, new_size);
+    memcpy(new_ptr, ptr, copy_size);
+    // from the line new_ptr starts in, which may be unaligned
+    char* end = (char*)new_ptr + copy_size;
+    for(char* line = (char*)((uint64_t)new_ptr & ~CACHELINE_MASK); line < end; line += CACHELINE_SIZE) {
+        FLUSH(line);
+    }
     FLUSHFENCE;
     deallocate(ptr,tid_);
     return new_ptr;
@@ -137,6 +235,10 @@ std::vector<InuseRecovery::iterator> RP_recover(int n){
     return _holder.ralloc_instance->recover(n);
 }
 
+bool RP_collect_garbage(int n){
+    return _holder.ralloc_instance->collect_garbage(n);
+}
+
 // we assume RP_close is called by the last exiting thread.
 void RP_close(){
     // Wentao: this is a noop as the real function body is now in ~RallocHolder
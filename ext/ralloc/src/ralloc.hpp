@@ -27,26 +27,54 @@ private:
     TCaches* t_caches;
     bool restart;
     int thd_num;
+    // result of is_dirty() not yet consumed by recover(); -1 if none
+    int checked_dirty = -1;
+    // size class table of this heap if not the default one
+    SizeClass* size_classes = nullptr;
+    // requests counted by size, last slot for large ones; see record_sizes()
+    std::atomic<uint64_t>* size_hist = nullptr;
 
 
     // static SizeClass sizeclass;
     static thread_local int tid;
+    // consume the dirty check and, if dirty, reset transient lists
+    bool begin_recovery();
     inline void flush_caches(){
         for(int thd=0;thd<thd_num;thd++){
             for(int i=1;i<MAX_SZ_IDX;i++){// sc 0 is reserved.
                 base_md->flush_cache(i, &t_caches[thd].t_cache[i]);
             }
         }
+        base_md->flush_transfers();
     }
 public:
-    Ralloc(int thd_num_, const char* id_, uint64_t size_ = 5*1024*1024*1024ULL);
+    // sc_sizes: block sizes of the size classes of a new heap (see
+    // SizeClass::valid), or empty for the default table. An existing
+    // heap keeps the table it was created with.
+    // region_opts: how to map the superblock region; see RegionOptions.
+    Ralloc(int thd_num_, const char* id_, uint64_t size_ = 5*1024*1024*1024ULL,
+        const std::vector<uint32_t>& sc_sizes = {},
+        const RegionOptions& region_opts = RegionOptions());
     ~Ralloc();
 
     inline void* allocate(size_t sz, int tid_=tid){
         assert(initialized&&"Ralloc isn't initialized!");
         assert(tid_!=-1 && tid_<thd_num && "tid out of range!");
+        if(UNLIKELY(size_hist != nullptr)) {
+            size_hist[sz > MAX_SZ ? MAX_SZ+1 : sz].fetch_add(1, std::memory_order_relaxed);
+        }
         return base_md->do_malloc(sz,t_caches[tid_]);
     }
+    /* allocate num blocks of sz bytes into out, taking whole superblocks
+     * at once where possible. For bulk loads of same-sized objects. */
+    inline void allocate_bulk(size_t sz, size_t num, void** out, int tid_=tid){
+        assert(initialized&&"Ralloc isn't initialized!");
+        assert(tid_!=-1 && tid_<thd_num && "tid out of range!");
+        if(UNLIKELY(size_hist != nullptr)) {
+            size_hist[sz > MAX_SZ ? MAX_SZ+1 : sz].fetch_add(num, std::memory_order_relaxed);
+        }
+        base_md->do_malloc_bulk(sz,num,out,t_caches[tid_]);
+    }
     inline void* allocate(size_t num, size_t size, int tid_=tid){
         void* ptr = allocate(num*size,tid_);
         if(UNLIKELY(ptr == nullptr)) return nullptr;
@@ -61,6 +89,16 @@ public:
         assert(tid_!=-1 && tid_<thd_num && "tid out of range!");
         base_md->do_free(ptr,t_caches[tid_]);
     }
+    /* free num blocks, grouped by superblock. reorders ptrs. */
+    inline void deallocate_batch(void** ptrs, size_t num, int tid_=tid){
+        assert(initialized&&"Ralloc isn't initialized!");
+        assert(tid_!=-1 && tid_<thd_num && "tid out of range!");
+        base_md->do_free_batch(ptrs,num,t_caches[tid_]);
+    }
+    /* resize the block at ptr, in place if its size class still fits
+     * new_size or, for a large block, the superblocks after it are free
+     * or not yet carved from the region. Otherwise the block moves and
+     * only the bytes copied are flushed. */
     void* reallocate(void* ptr, size_t new_size, int tid_=tid);
 
     inline void* set_root(void* ptr, uint64_t i){
@@ -76,6 +114,17 @@ public:
         return restart;
     }
     std::vector<InuseRecovery::iterator> recover(int thd = 1);
+    /* check if the heap was left dirty, and mark it dirty from now on.
+     * The next recover() reuses the result, so recover() may be skipped
+     * entirely after a clean exit. */
+    bool is_dirty();
+    /* instead of recover(), rebuild a dirty heap from the blocks
+     * reachable from roots, with thd threads marking and sweeping, and
+     * free all others. Blocks are scanned conservatively for pointers and
+     * pptrs, unless get_root<T> was called for a root whose T has a
+     * specialized GarbageCollection::filter_func. Returns true if the
+     * heap was dirty; a clean heap needs no collection. */
+    bool collect_garbage(int thd = 1);
 
     inline void simulate_crash(){
         // Wentao: directly call destructors from main thread to mimic
@@ -96,6 +145,43 @@ public:
         return (size_t)desc->block_size;
     }
 
+    /* bytes of multi-superblock blocks served from freed space, and free
+     * superblocks merged into longer extents, since the heap was opened. */
+    inline uint64_t large_reused_bytes(){
+        return base_md->large_reused.load(std::memory_order_relaxed);
+    }
+    inline uint64_t large_coalesced_sbs(){
+        return base_md->large_coalesced.load(std::memory_order_relaxed);
+    }
+    /* superblocks large blocks grew by in reallocate() without moving. */
+    inline uint64_t large_extended_sbs(){
+        return base_md->large_extended.load(std::memory_order_relaxed);
+    }
+
+    /* ns spent in mapping and prefaulting the superblock region since the
+     * heap was opened, growth included. */
+    inline uint64_t region_map_ns(){
+        return _rgs->regions[SB_IDX]->map_ns.load(std::memory_order_relaxed);
+    }
+
+    /* thread cache counters summed over threads and size classes. Only
+     * exact when no thread is allocating or freeing. */
+    TCacheStats cache_stats();
+
+    /* occupancy of the heap by size class, merged with the per-thread
+     * counters; see HeapStats. Walks all descriptors, so meant for
+     * occasional sampling rather than every operation. */
+    HeapStats stats();
+
+    /* block sizes of this heap's size classes (see Ralloc::Ralloc). */
+    std::vector<uint32_t> size_classes_in_use();
+
+    /* start counting allocation requests by size, to tune size classes
+     * with SizeClass::suggest. Not thread-safe against allocate(). */
+    void record_sizes();
+    /* requests of each size so far, the last slot for ones > MAX_SZ. */
+    std::vector<uint64_t> size_histogram();
+
     /* return 1 if ptr is in range of Ralloc heap, otherwise 0. */
     inline int in_range(void* ptr){
         if(_rgs->in_range(SB_IDX,ptr)) return 1;
@@ -107,7 +193,17 @@ public:
             return 1;
         }
         *start_addr = (void*)_rgs->regions_address[idx];
-        *end_addr = (void*) ((uint64_t)_rgs->regions_address[idx] + _rgs->regions[idx]->FILESIZE);
+        *end_addr = (void*) ((uint64_t)_rgs->regions[idx]->base_addr + _rgs->regions[idx]->mapped_size.load());
+        return 0;
+    }
+    /* same as region_range, but end is that of the address space reserved
+     * for the region, which the mapped part grows into. */
+    inline int region_reserve(int idx, void** start_addr, void** end_addr){
+        if(start_addr == nullptr || end_addr == nullptr || idx>=_rgs->cur_idx){
+            return 1;
+        }
+        *start_addr = (void*)_rgs->regions_address[idx];
+        *end_addr = (void*) ((uint64_t)_rgs->regions[idx]->base_addr + _rgs->regions[idx]->RESERVE);
         return 0;
     }
 
@@ -134,7 +230,9 @@ struct RallocHolder{
 
 extern RallocHolder _holder;
 
-/* return 1 if it's a restart, otherwise 0. */
+/* return 1 if it's a restart, otherwise 0.
+ * size is the most the sb region may grow to. Only address space is
+ * reserved for it; the heap files grow as the heap does. */
 extern "C" int RP_init(const char* _id, uint64_t size = 5*1024*1024*1024ULL, int thd_num = 100);
 
 template<class T>
@@ -143,6 +241,8 @@ T* RP_get_root(uint64_t i){
 }
 
 std::vector<InuseRecovery::iterator> RP_recover(int n = 1);
+/* see Ralloc::collect_garbage. */
+bool RP_collect_garbage(int n = 1);
 extern "C"{
 #else /* __cplusplus ends */
 // This is a version for pure c only
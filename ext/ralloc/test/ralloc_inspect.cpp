@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 University of Rochester. All rights reserved.
+ * Licenced under the MIT licence. See LICENSE file in the project root for
+ * details.
+ */
+
+/*
+ * ralloc_inspect: print occupancy and fragmentation of a Ralloc heap.
+ *
+ * The heap files are opened read-only and mapped privately, so the heap is
+ * neither recovered nor marked dirty, and may even be in use. Block counts
+ * come from anchors, which are only valid if the heap was closed cleanly.
+ *
+ * usage: ralloc_inspect <heap file prefix>, e.g., /mnt/pmem/<id>
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ralloc.hpp"
+
+using namespace std;
+
+// map a region file privately at the alignment RegionManager uses.
+// writes, e.g., to transient fields, never reach the file.
+static char* map_region(const string& path, uint64_t& len){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        perror(path.c_str());
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        perror(path.c_str());
+        exit(1);
+    }
+    len = st.st_size;
+    char* res = (char*)mmap(0, len + SBSIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* addr = mmap(ALIGN_ADDR(res, SBSIZE), len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);
+    if(res == MAP_FAILED || addr == MAP_FAILED){
+        perror("mmap");
+        exit(1);
+    }
+    return (char*)addr;
+}
+
+// see the region layout in RegionManager.hpp
+static char* heap_start(char* base){
+    return base + *((intptr_t*)base + 1);
+}
+static char* heap_end(char* base){
+    return ((atomic_pptr<char>*)base)->load();
+}
+
+int main(int argc, char** argv){
+    if(argc != 2){
+        fprintf(stderr, "usage: %s <heap file prefix>\n", argv[0]);
+        return 1;
+    }
+    string prefix(argv[1]);
+    uint64_t meta_len, desc_len, sb_len;
+    char* meta = map_region(prefix + "_basemd", meta_len);
+    char* desc = map_region(prefix + "_desc", desc_len);
+    char* sb = map_region(prefix + "_sb", sb_len);
+
+    // only addresses are needed to translate CrossPtrs; no managers
+    Regions rgs;
+    rgs.regions_address[DESC_IDX] = heap_start(desc);
+    rgs.regions_address[SB_IDX] = heap_start(sb);
+    rgs.regions_address[META_IDX] = heap_start(meta);
+    BaseMeta* base_md = (BaseMeta*)heap_start(meta);
+    bool clean = base_md->left_clean();
+    vector<uint32_t> sizes = base_md->get_size_classes();
+    SizeClass* sc = sizes.empty() ? &ralloc::sizeclass : new SizeClass(sizes.data(), sizes.size());
+    base_md->transient_reset(&rgs, 1, sc);
+
+    HeapStats st;
+    base_md->collect_stats(st, heap_end(sb));
+
+    printf("heap %s: %s\n", prefix.c_str(), clean ? "closed cleanly" :
+        "dirty or in use (anchors are stale: block counts are unreliable)");
+    printf("sb region: %lu MB in file, %lu superblocks of %lu\n",
+        sb_len >> 20, st.sbs, st.max_sbs);
+    printf("  free: %lu sbs, large blocks: %lu in %lu sbs, small classes: %lu sbs\n",
+        st.free_sbs, st.large_blocks, st.large_sbs, st.small_sbs());
+    printf("%5s %8s %8s %8s %8s %8s %10s %10s %7s\n", "class", "size", "sbs",
+        "full", "partial", "empty", "blocks", "free", "used%");
+    for(int i = 1; i < MAX_SZ_IDX; i++){
+        const SizeClassStats& c = st.classes[i];
+        uint64_t sbs = c.sbs[SB_FULL] + c.sbs[SB_PARTIAL] + c.sbs[SB_EMPTY] + c.sbs[SB_ERROR];
+        if(sbs == 0) continue;
+        printf("%5d %8u %8lu %8lu %8lu %8lu %10lu %10lu %6.1f%%\n", i, c.block_size, sbs,
+            c.sbs[SB_FULL], c.sbs[SB_PARTIAL], c.sbs[SB_EMPTY], c.blocks, c.free_blocks,
+            100.0 * (c.blocks - c.free_blocks) / c.blocks);
+    }
+    printf("fragmentation of small classes: %.1f%%\n", 100.0 * st.fragmentation());
+    return 0;
+}
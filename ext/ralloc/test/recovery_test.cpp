@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ralloc.hpp"
+
+/*
+ * Recovery with several threads over a heap in which every other
+ * superblock is free, after a dirty and after a clean restart. Each
+ * iterator has to claim chunks past stretches of free superblocks, so
+ * all in-use blocks should be visited exactly once.
+ */
+
+using namespace std;
+
+const int THREAD_NUM = 4;
+const uint64_t HEAP_SIZE = 1024*1024*1024ULL;
+const size_t BLK_SIZE = 64;
+const size_t BLK_NUM = 102400;
+const uint64_t MAGIC = 0xabcdef;
+const char* ID = "recovery_test";
+
+static void remove_heap(){
+    string path = string(HEAPFILE_PREFIX) + ID;
+    for(const char* suffix : {"_basemd", "_desc", "_sb"}){
+        unlink((path+suffix).c_str());
+    }
+}
+
+// fill the heap in a child, then close it dirty or clean.
+// returns the number of blocks left allocated.
+static size_t fill(bool dirty){
+    int fds[2];
+    if(pipe(fds) != 0) return 0;
+    pid_t pid = fork();
+    if(pid == 0){
+        Ralloc* r = new Ralloc(THREAD_NUM, ID, HEAP_SIZE);
+        Ralloc::set_tid(0);
+        vector<uint64_t*> blks;
+        for(size_t i = 0; i < BLK_NUM; i++){
+            uint64_t* p = (uint64_t*)r->allocate(BLK_SIZE);
+            *p = MAGIC;
+            blks.push_back(p);
+        }
+        size_t kept = 0;
+        for(uint64_t* p : blks){
+            if(((uint64_t)p >> SB_SHIFT) & 1){
+                r->deallocate(p);
+            } else {
+                kept++;
+            }
+        }
+        if(write(fds[1], &kept, sizeof(kept)) != sizeof(kept)) _exit(1);
+        if(dirty){
+            // return cached blocks so that their sbs are free, but
+            // have the next start see a dirty heap
+            r->simulate_crash();
+        }
+        delete r;
+        _exit(0);
+    }
+    size_t kept = 0;
+    if(read(fds[0], &kept, sizeof(kept)) != sizeof(kept)) kept = 0;
+    waitpid(pid, nullptr, 0);
+    close(fds[0]);
+    close(fds[1]);
+    return kept;
+}
+
+static bool test(bool dirty){
+    remove_heap();
+    size_t kept = fill(dirty);
+    Ralloc* r = new Ralloc(THREAD_NUM, ID, HEAP_SIZE);
+    Ralloc::set_tid(0);
+    if(!r->is_restart() || r->is_dirty() != dirty){
+        cout<<"unexpected heap state"<<endl;
+        return false;
+    }
+    auto iters = r->recover(THREAD_NUM);
+    atomic<size_t> visited{0}, marked{0};
+    vector<thread> workers;
+    for(int t = 0; t < THREAD_NUM; t++){
+        workers.emplace_back([&, t]{
+            Ralloc::set_tid(t);
+            for(; !iters[t].is_last(); ++iters[t]){
+                visited++;
+                if(*(uint64_t*)*iters[t] == MAGIC) marked++;
+            }
+        });
+    }
+    for(auto& w : workers) w.join();
+    delete r;
+    remove_heap();
+    cout<<(dirty ? "Dirty" : "Clean")<<" restart: kept "<<kept
+        <<", visited "<<visited<<", marked "<<marked<<endl;
+    // a dirty restart also visits free blocks of in-use sbs
+    return kept > 0 && marked == kept && (dirty ? visited >= kept : visited == kept);
+}
+
+int main(){
+    bool ok = test(true);
+    ok = test(false) && ok;
+    cout<<(ok ? "passed" : "FAILED")<<endl;
+    return ok ? 0 : 1;
+}
@@ -3,6 +3,11 @@
 #include <atomic>
 #include <chrono>
 #include <hwloc.h>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #ifdef PRONTO
 #include "savitar.hpp"
 #endif
@@ -55,6 +60,24 @@ void setAffinity(GlobalTestConfig* gtc, LocalTestConfig* ltc){
 	ltc->cpu=gtc->affinities[tid]->os_index;
 }
 
+// PERF COUNTERS ----------------------------------------
+
+// open a (disabled) counter of user-level dTLB load misses of the calling
+// thread. -1 if the kernel or hardware doesn't allow it.
+int openTlbCounter(){
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HW_CACHE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
 // TEST EXECUTION ------------------------------
 // Initializes any locks or barriers we need for the tests
 void initTest(GlobalTestConfig* gtc){
@@ -129,11 +152,37 @@ static void * thread_main (void *lp)
 
 
 
+	// count dTLB misses of the measured interval only
+	int tlb_fd = -1;
+	if(gtc->checkEnv("TlbMisses")){
+		tlb_fd = openTlbCounter();
+		if(tlb_fd<0 && task_id==0){
+			fprintf(stderr,"dTLB miss counter unavailable.\n");
+		}
+	}
+
 	barrier(); // barrier all threads before starting
 
+	if(tlb_fd>=0){
+		ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
 	/* ------- WE WILL DO ALL OF THE WORK!!! ---------*/
 	int ops = executeTest(gtc,ltc);
 
+	if(gtc->checkEnv("TlbMisses")){
+		uint64_t misses = 0;
+		if(tlb_fd>=0){
+			ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if(read(tlb_fd, &misses, sizeof(misses))!=sizeof(misses)){
+				misses = 0;
+			}
+			close(tlb_fd);
+		}
+		gtc->recorder->reportThreadInfo("dtlb_misses",misses,ltc->tid);
+	}
+
 	// record standard statistics
 	__sync_fetch_and_add (&gtc->total_operations, ops);
 	gtc->recorder->reportThreadInfo("ops",ops,ltc->tid);
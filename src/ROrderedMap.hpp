@@ -0,0 +1,24 @@
+#ifndef RORDEREDMAP_HPP
+#define RORDEREDMAP_HPP
+
+#include <functional>
+#include "RMap.hpp"
+
+// Maps that keep their keys ordered and can visit a range of them.
+template <class K, class V> class ROrderedMap : public RMap<K,V>{
+public:
+	// called for each key/value pair visited, in increasing key order
+	typedef std::function<void(const K&, const V&)> Visitor;
+
+	// Visits all pairs with lo <= key <= hi, as of a single point
+	// during the call
+	// returns : the number of pairs visited
+	virtual int range(K lo, K hi, const Visitor& visitor, int tid)=0;
+
+	// Visits the first count pairs with key >= start, as of a single
+	// point during the call
+	// returns : the number of pairs visited
+	virtual int scan(K start, int count, const Visitor& visitor, int tid)=0;
+};
+
+#endif
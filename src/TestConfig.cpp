@@ -166,6 +166,9 @@ void GlobalTestConfig::parseCommandLine(int argc, char** argv){
 	recorder->addThreadField("ops",&Recorder::sumInts);
 	recorder->addThreadField("ops_stddev",&Recorder::stdDevInts);
 	recorder->addThreadField("ops_each",&Recorder::concat);
+	if(checkEnv("TlbMisses")){
+		recorder->addThreadField("dtlb_misses",&Recorder::sumInt64s);
+	}
 
 
 	string env ="";
@@ -30,6 +30,7 @@
 // #include "HOHHashTable.hpp"
 #include "HashTable.hpp"
 #include "MontageHashTable.hpp"
+#include "MontageOAHashTable.hpp"
 #include "UnbalancedTree.hpp"
 #include "SOFTHashTable.hpp"
 #include "NVMSOFTHashTable.hpp"
@@ -89,6 +90,7 @@
 #include "vEBChurnTest.hpp"
 #include "MapTest.hpp"
 #include "MapChurnTest.hpp"
+#include "MapScanChurnTest.hpp"
 #include "SyncTest.hpp"
 #ifndef MNEMOSYNE
 #include "RecoverVerifyTest.hpp"
@@ -164,6 +166,10 @@ int main(int argc, char *argv[])
 	gtc.addRideableOption(new LockfreeHashTableFactory<uint64_t>(), "LfHashTable<uint64_t>");
 	gtc.addRideableOption(new NVMLockfreeHashTableFactory<uint64_t>(), "NVMLockfreeHashTable<uint64_t>");
 
+	/* open-addressing hash tables; listed last to keep the indices above */
+	gtc.addRideableOption(new MontageOAHashTableFactory<string>(), "MontageOAHashTable");
+	gtc.addRideableOption(new MontageOAHashTableFactory<uint64_t>(), "MontageOAHashTable<uint64_t>");
+
 #endif /* !defined(MNEMOSYNE) and !defined(PRONTO) */
 #ifdef MNEMOSYNE
 	gtc.addRideableOption(new MneQueueFactory<string>(), "MneQueue");
@@ -202,6 +208,10 @@ int main(int argc, char *argv[])
 	gtc.addTestOption(new AllocTest(1024 * 1024, DO_RALLOC_ALLOC), "AllocTest-Ralloc");
 	gtc.addTestOption(new AllocTest(1024 * 1024, DO_MONTAGE_ALLOC), "AllocTest-Montage");
 
+	/* scans on ordered maps; listed last to keep the indices above */
+	gtc.addTestOption(new MapScanChurnTest<string,string>(95, 5, 0, 1000000, 500000, 100), "MapScanChurnTest<string>:s95i5:range=1000000:prefill=500000:len=100");
+	gtc.addTestOption(new MapScanChurnTest<string,string>(50, 25, 25, 1000000, 500000, 100), "MapScanChurnTest<string>:s50i25rm25:range=1000000:prefill=500000:len=100");
+
 	gtc.parseCommandLine(argc, argv);
         omp_set_num_threads(gtc.task_num);
 	gtc.runTest();
@@ -11,18 +11,37 @@ DedicatedEpochAdvancer::DedicatedEpochAdvancer(GlobalTestConfig* gtc, EpochSys*
     } else {
         epoch_length = 100*1000;
     }
+    uint64_t unit = 1;
     if (gtc->checkEnv("EpochLengthUnit")){
         std::string env_unit = gtc->getEnv("EpochLengthUnit");
         if (env_unit == "Second"){
-            epoch_length *= 1000000;
+            unit = 1000000;
         } else if (env_unit == "Millisecond"){
-            epoch_length *= 1000;
+            unit = 1000;
         } else if (env_unit == "Microsecond"){
             // do nothing.
         } else {
             errexit("time unit not supported.");
         }
     }
+    epoch_length *= unit;
+    if (gtc->checkEnv("AdaptiveEpoch")){
+        adaptive = true;
+        min_epoch_length = gtc->checkEnv("EpochLengthMin")?
+            stoull(gtc->getEnv("EpochLengthMin"))*unit : std::max(epoch_length/10, (uint64_t)1);
+        max_epoch_length = gtc->checkEnv("EpochLengthMax")?
+            stoull(gtc->getEnv("EpochLengthMax"))*unit : epoch_length*4;
+        target_lag = gtc->checkEnv("TargetPersistLag")?
+            stoull(gtc->getEnv("TargetPersistLag"))*unit : epoch_length*3;
+        free_backlog_limit = gtc->checkEnv("FreeBacklogLimit")?
+            stoull(gtc->getEnv("FreeBacklogLimit")) : 65536ULL*gtc->task_num;
+        if (min_epoch_length == 0 || min_epoch_length > max_epoch_length){
+            errexit("invalid EpochLengthMin/EpochLengthMax for adaptive epoch.");
+        }
+        epoch_length = std::min(std::max(epoch_length, min_epoch_length), max_epoch_length);
+    }
+    sync_requests.ui.store(0);
+    targeted_sync = gtc->checkEnv("TargetedSync");
     if (!gtc->checkEnv("NoAdvancerPinning")){
         find_first_socket();
     }
@@ -78,22 +97,58 @@ void DedicatedEpochAdvancer::advancer(int task_num){
         // measure the time used for write-back and reclamation, and deduct it from epoch_length.
         int64_t wb_length = chrono::duration_cast<chrono::microseconds>(
             chrono::high_resolution_clock::now()-wb_start).count();
+        if (adaptive){
+            adapt_epoch_length(wb_length);
+        }
         next_sleep = epoch_length - wb_length;
     }
     // std::cout<<"advancer_thread terminating..."<<std::endl;
 }
 
+void DedicatedEpochAdvancer::adapt_epoch_length(int64_t wb_length){
+    double buffer_load = esys->persist_buffer_load();
+    uint64_t syncs = sync_requests.ui.exchange(0);
+    uint64_t backlog = esys->free_backlog();
+    // a write at the beginning of epoch c is persisted by the end of
+    // epoch c+1, so the worst-case lag is about two epochs plus write-back.
+    uint64_t lag = 2*epoch_length + std::max(wb_length, (int64_t)0);
+    uint64_t next_length = epoch_length;
+    if (lag > target_lag || buffer_load > 1 || syncs > 0 || backlog > free_backlog_limit){
+        // buffers are overflowing onto workers, someone is waiting in
+        // sync(), or memory isn't reclaimed fast enough: shrink quickly.
+        next_length = epoch_length/2;
+    } else if (buffer_load < 0.5){
+        // light load: stretch slowly to write back less often,
+        // as long as we stay within the lag target.
+        uint64_t stretched = epoch_length + std::max(epoch_length/8, (uint64_t)1);
+        if (2*stretched + std::max(wb_length, (int64_t)0) <= target_lag){
+            next_length = stretched;
+        }
+    }
+    next_length = std::min(std::max(next_length, min_epoch_length), max_epoch_length);
+    if (gtc->verbose && next_length != epoch_length){
+        std::cout<<"epoch length: "<<epoch_length<<"us -> "<<next_length<<"us (load "<<
+            buffer_load<<", wb "<<wb_length<<"us, syncs "<<syncs<<", backlog "<<backlog<<")"<<std::endl;
+    }
+    epoch_length = next_length;
+}
+
 uint64_t DedicatedEpochAdvancer::ongoing_target() {
     return target_epoch.ui.load();
 }
 
 void DedicatedEpochAdvancer::sync(uint64_t c){
+    sync_requests.ui.fetch_add(1, std::memory_order_relaxed);
     uint64_t curr_target = target_epoch.ui.load();
     while(curr_target < c+2){
         if (target_epoch.ui.compare_exchange_strong(curr_target, c+2)){
             break;
         }
     }
+    if (targeted_sync){
+        targeted_sync_wait(c);
+        return;
+    }
     for (auto curr_epoch=esys->get_epoch(); curr_epoch < c+2; curr_epoch++){
         esys->on_epoch_end(curr_epoch);
         // Advance epoch number
@@ -103,6 +158,35 @@ void DedicatedEpochAdvancer::sync(uint64_t c){
     }
 }
 
+void DedicatedEpochAdvancer::targeted_sync_wait(uint64_t c){
+    if (esys->get_persisted_frontier() >= c){
+        // covered by the advancer or another sync.
+        return;
+    }
+    // our own buffers are the likeliest to be hot; write them back now.
+    // other threads behind the raised target write back theirs on their
+    // next begin_transaction, and on_epoch_end picks up the rest.
+    esys->persist_local(c);
+    while (esys->get_persisted_frontier() < c){
+        std::unique_lock<std::mutex> lck(sync_lock, std::try_to_lock);
+        if (!lck.owns_lock()){
+            // another syncer is advancing epochs, likely far enough for us.
+            std::this_thread::yield();
+            continue;
+        }
+        // advance on behalf of every waiting syncer at once, rather than
+        // each of them walking all buffers of the same epochs.
+        uint64_t target = std::max(target_epoch.ui.load(), c+2);
+        for (auto curr_epoch=esys->get_epoch(); curr_epoch < target;
+            curr_epoch=esys->get_epoch()){
+            esys->on_epoch_end(curr_epoch);
+            if (esys->epoch_CAS(curr_epoch, curr_epoch+1)){
+                esys->on_epoch_begin(curr_epoch+1);
+            }
+        }
+    }
+}
+
 DedicatedEpochAdvancer::~DedicatedEpochAdvancer(){
     // std::cout<<"terminating advancer_thread"<<std::endl;
     advancer_state.store(ENDED);
@@ -2,6 +2,7 @@
 #define EPOCHADVANCERS_HPP
 
 #include <atomic>
+#include <mutex>
 #include <thread>
 #include "TestConfig.hpp"
 #include "ConcurrentPrimitives.hpp"
@@ -38,8 +39,21 @@ class DedicatedEpochAdvancer : public EpochAdvancer{
     uint64_t epoch_length;
     hwloc_obj_t advancer_affinity = nullptr;
     paddedAtomic<uint64_t> target_epoch; // for helping from worker threads.
+    // adaptive epoch length. lengths and lag are in microseconds.
+    bool adaptive = false;
+    uint64_t min_epoch_length = 0;
+    uint64_t max_epoch_length = 0;
+    uint64_t target_lag = 0;
+    uint64_t free_backlog_limit = 0;
+    paddedAtomic<uint64_t> sync_requests; // sync() calls since last adaptation
+    // targeted sync: return early once the caller's epoch is persisted,
+    // and let one syncer at a time advance epochs for all of them.
+    bool targeted_sync = false;
+    std::mutex sync_lock;
     void find_first_socket();
     void advancer(int task_num);
+    void adapt_epoch_length(int64_t wb_length);
+    void targeted_sync_wait(uint64_t c);
 public:
     DedicatedEpochAdvancer(GlobalTestConfig* gtc, EpochSys* es);
     ~DedicatedEpochAdvancer();
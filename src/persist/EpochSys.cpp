@@ -3,9 +3,18 @@
 
 #include <omp.h>
 #include <atomic>
+#include <fstream>
+#include <sys/mman.h>
 
 namespace pds{
 
+    // after a dirty restart, a superblock that changed size class shows
+    // stale bytes where its new class never allocated a block. they
+    // rarely pass for a block type, but their epochs are arbitrary.
+    static inline bool stale_blk(PBlk* blk){
+        return (unsigned)blk->get_blktype() > (unsigned)INDEX;
+    }
+
     void sc_desc_t::try_complete(Recoverable* ds, uint64_t addr){
         lin_var _d = var.load();
         // int ret = 0;
@@ -34,6 +43,208 @@ namespace pds{
 
     thread_local int EpochSys::tid = -1;
     std::atomic<int> EpochSys::esys_num(0);
+
+    void EpochSys::init_socket_heaps(const std::string& heap_name){
+        int socket_num = hwloc_get_nbobjs_by_type(gtc->topology, HWLOC_OBJ_SOCKET);
+        if (socket_num <= 1){
+            return;
+        }
+        socket_rals.push_back(_ral);
+        for (int i = 1; i < socket_num; i++){
+            std::string name = heap_name + "_s" + std::to_string(i);
+            socket_rals.push_back(new Ralloc(task_num+1, name.c_str(), REGION_SIZE, sc_sizes, region_opts));
+        }
+        // workers follow their affinity. the epoch advancer (tid task_num)
+        // and threads without affinity stay on socket 0.
+        thread_sockets.assign(task_num+1, 0);
+        for (int tid = 0; tid < task_num && !gtc->affinities.empty(); tid++){
+            hwloc_obj_t socket = hwloc_get_ancestor_obj_by_type(gtc->topology,
+                HWLOC_OBJ_SOCKET, gtc->affinities[tid % gtc->affinities.size()]);
+            if (socket){
+                thread_sockets[tid] = socket->logical_index % socket_num;
+            }
+        }
+    }
+
+    std::vector<uint32_t> EpochSys::get_size_classes(){
+        if (!gtc->checkEnv("SizeClasses") || gtc->getEnv("SizeClasses") == "Default"){
+            return {};
+        }
+        std::string val = gtc->getEnv("SizeClasses");
+        if (val == "CacheLine"){
+            return SizeClass::cache_line_sizes();
+        }
+        // a file of block sizes, e.g., written by SizeHistogram.
+        std::ifstream f(val);
+        if (!f.good()){
+            errexit("unrecognized 'size classes' environment");
+        }
+        std::vector<uint32_t> ret;
+        std::string line;
+        while (std::getline(f, line)){
+            if (line.empty() || line[0] == '#'){
+                continue;
+            }
+            ret.push_back(std::stoul(line));
+        }
+        if (!SizeClass::valid(ret.data(), ret.size())){
+            errexit("invalid size classes: need ascending multiples of 8 ending with MAX_SZ.");
+        }
+        return ret;
+    }
+
+    RegionOptions EpochSys::get_region_options(){
+        RegionOptions ret;
+        if (gtc->checkEnv("HeapPageSize")){
+            std::string val = gtc->getEnv("HeapPageSize");
+            if (val == "2M"){
+                ret.page_size = HUGEPAGE_2M;
+            } else if (val == "1G"){
+                ret.page_size = HUGEPAGE_1G;
+            } else if (val != "4K"){
+                errexit("unrecognized 'heap page size' environment");
+            }
+        }
+        if (gtc->checkEnv("HeapPrefault")){
+            ret.prefault = stoi(gtc->getEnv("HeapPrefault"));
+        }
+        if (gtc->checkEnv("HeapAdvise")){
+            std::string val = gtc->getEnv("HeapAdvise");
+            if (val == "Normal"){
+                ret.advice = MADV_NORMAL;
+            } else if (val == "Random"){
+                ret.advice = MADV_RANDOM;
+            } else if (val == "Sequential"){
+                ret.advice = MADV_SEQUENTIAL;
+            } else if (val == "WillNeed"){
+                ret.advice = MADV_WILLNEED;
+            } else {
+                errexit("unrecognized 'heap advise' environment");
+            }
+        }
+        return ret;
+    }
+
+    void EpochSys::report_heap_mapping(){
+        if (!gtc->checkEnv("HeapPageSize") && !gtc->checkEnv("HeapPrefault") &&
+            !gtc->checkEnv("HeapAdvise")){
+            return;
+        }
+        uint64_t ns = 0;
+        for (Ralloc* r : all_heaps()){
+            ns += r->region_map_ns();
+        }
+        if (gtc->recorder){
+            gtc->recorder->reportGlobalInfo("heap_map(ms)", ns/1000000.0);
+        }
+        if (gtc->verbose){
+            std::cout<<"heaps mapped in "<<ns/1000000.0<<"ms"<<std::endl;
+        }
+    }
+
+    HeapStats EpochSys::heap_stats(){
+        HeapStats st;
+        st.max_sbs = 0;
+        for (Ralloc* r : all_heaps()){
+            st += r->stats();
+        }
+        return st;
+    }
+
+    void EpochSys::report_heap_stats(){
+        HeapStats st = heap_stats();
+        // negative if blocks recovered from a previous run are freed
+        int64_t net_allocs = 0;
+        for (int i = 0; i < MAX_SZ_IDX; i++){
+            net_allocs += (int64_t)st.classes[i].allocs - (int64_t)st.classes[i].frees;
+        }
+        if (gtc->recorder){
+            gtc->recorder->reportGlobalInfo("heap_sbs", (long)st.sbs);
+            gtc->recorder->reportGlobalInfo("heap_free_sbs", (long)st.free_sbs);
+            gtc->recorder->reportGlobalInfo("heap_large_sbs", (long)st.large_sbs);
+            gtc->recorder->reportGlobalInfo("heap_net_allocs", (long)net_allocs);
+            gtc->recorder->reportGlobalInfo("heap_frag(%)", 100*st.fragmentation());
+        }
+        if (gtc->verbose){
+            std::cout<<"heap: "<<st.sbs<<" of "<<st.max_sbs<<" superblocks, "<<st.free_sbs<<" free, "
+                     <<st.large_sbs<<" in "<<st.large_blocks<<" large blocks, "
+                     <<100*st.fragmentation()<<"% of small class space unused"<<std::endl;
+            for (int i = 1; i < MAX_SZ_IDX; i++){
+                const SizeClassStats& c = st.classes[i];
+                if (c.blocks == 0 && c.allocs == 0){
+                    continue;
+                }
+                std::cout<<"  "<<c.block_size<<"B: "<<c.sbs[SB_FULL]<<" full, "<<c.sbs[SB_PARTIAL]<<" partial, "
+                         <<c.sbs[SB_EMPTY]<<" empty sbs; "<<c.free_blocks<<" free and "<<c.cached_blocks
+                         <<" cached of "<<c.blocks<<" blocks; "<<c.allocs<<" allocs, "<<c.frees<<" frees"<<std::endl;
+            }
+        }
+    }
+
+    void EpochSys::dump_size_histogram(const std::string& path){
+        std::vector<uint64_t> hist(MAX_SZ+2, 0);
+        for (Ralloc* r : all_heaps()){
+            std::vector<uint64_t> h = r->size_histogram();
+            for (size_t i = 0; i < hist.size(); i++){
+                hist[i] += h[i];
+            }
+        }
+        std::ofstream f(path);
+        if (!f.good()){
+            errexit("unable to write SizeHistogram file.");
+        }
+        f << "# allocation sizes: <size> <count>" << std::endl;
+        for (size_t i = 0; i <= MAX_SZ; i++){
+            if (hist[i] != 0){
+                f << "# " << i << " " << hist[i] << std::endl;
+            }
+        }
+        f << "# larger than " << MAX_SZ << ": " << hist[MAX_SZ+1] << std::endl;
+        f << "# suggested size classes (use with -dSizeClasses=<this file>):" << std::endl;
+        for (uint32_t sz : SizeClass::suggest(hist)){
+            f << sz << std::endl;
+        }
+        if (gtc->verbose){
+            std::cout << "size histogram written to " << path << std::endl;
+        }
+    }
+
+    bool EpochSys::heaps_dirty(){
+        bool dirty = _ral->is_dirty();
+        for (size_t i = 1; i < socket_rals.size(); i++){
+            // no short circuit: every heap has to be marked dirty.
+            dirty = socket_rals[i]->is_dirty() || dirty;
+        }
+        return dirty;
+    }
+
+    void EpochSys::report_first_pass(int rec_tid, int rec_thd, std::chrono::high_resolution_clock::time_point begin,
+        size_t blks, const std::vector<InuseRecovery::iterator>& itr_raw){
+        if (!gtc->verbose){
+            return;
+        }
+        auto dur = std::chrono::high_resolution_clock::now() - begin;
+        // chunks this thread pulled from the heaps' work queues
+        size_t chunks = 0;
+        for (size_t i = rec_tid; i < itr_raw.size(); i += rec_thd){
+            chunks += itr_raw[i].claimed();
+        }
+        std::cout << "Recovery thread " << rec_tid << ": " << blks << " blocks, "
+                  << chunks << " chunks in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count()
+                  << "ms" << std::endl;
+    }
+
+    std::vector<InuseRecovery::iterator> EpochSys::recover_heaps(int rec_thd){
+        std::vector<InuseRecovery::iterator> ret = _ral->recover(rec_thd);
+        for (size_t i = 1; i < socket_rals.size(); i++){
+            for (auto& itr : socket_rals[i]->recover(rec_thd)){
+                ret.push_back(itr);
+            }
+        }
+        return ret;
+    }
+
     void EpochSys::parse_env(){
         if (epoch_advancer){
             delete epoch_advancer;
@@ -47,6 +258,10 @@ namespace pds{
         if (to_be_freed) {
             delete to_be_freed;
         }
+        if (persisters) {
+            delete persisters;
+            persisters = nullptr;
+        }
 
         if (!gtc->checkEnv("EpochLengthUnit")){
             gtc->setEnv("EpochLengthUnit", "Millisecond");
@@ -77,6 +292,10 @@ namespace pds{
                 to_be_persisted = new DirWB(_ral, gtc->task_num);
             } else if (env_persist == "BufferedWB"){
                 to_be_persisted = new BufferedWB(gtc, _ral);
+            } else if (env_persist == "NtWB"){
+                to_be_persisted = new NtWB(gtc, _ral);
+            } else if (env_persist == "LineWB"){
+                to_be_persisted = new LineWB(gtc, _ral);
             } else {
                 errexit("unrecognized 'persist' environment");
             }
@@ -85,6 +304,8 @@ namespace pds{
             to_be_persisted = new BufferedWB(gtc, _ral);
         }
 
+        to_be_persisted->socket_rals = socket_rals;
+
         if (gtc->checkEnv("Free")){
             string env_free = gtc->getEnv("Free");
             if (env_free == "PerEpoch"){
@@ -128,6 +349,19 @@ namespace pds{
             persisted_epochs = new IncreasingMindicator(task_num);
         }
 
+        // by default, a persister for each socket with NumaHeaps, writing
+        // back local buffers, and none otherwise.
+        int persister_num = socket_rals.size();
+        if (gtc->checkEnv("PersisterThread")){
+            persister_num = stoi(gtc->getEnv("PersisterThread"));
+        }
+        if (persister_num < 0){
+            errexit("invalid PersisterThread number");
+        } else if (persister_num > 0){
+            persisters = new PersisterPool(gtc, persister_num, persisted_epochs,
+                [this](uint64_t c, int curr_thread){persist_thread_epoch(c, curr_thread);});
+        }
+
         epoch_advancer = new DedicatedEpochAdvancer(gtc, this);
 
         // if (gtc->checkEnv("EpochAdvance")){
@@ -155,6 +389,33 @@ namespace pds{
         // }
     }
 
+    void EpochSys::init_recovery_index(){
+        if (!gtc->checkEnv("RecoveryIndex") || recovery_index){
+            return;
+        }
+        if (!socket_rals.empty()){
+            errexit("RecoveryIndex does not support NumaHeaps.");
+        }
+        // snapshot whatever survived recovery.
+        std::vector<PBlk*> live_blks;
+        if (recovered){
+            recovered->for_each([&](PBlk* blk){
+                live_blks.push_back(blk);
+            });
+        }
+        if (epoch_container){
+            live_blks.push_back(epoch_container);
+        }
+        for (int i = 0; i < task_num; i++){
+            // reused descs of nbEpochSys
+            if (local_descs[i]){
+                live_blks.push_back((PBlk*)local_descs[i]);
+            }
+        }
+        // one more log for the dedicated epoch advancer
+        recovery_index = new RecoveryIndex(_ral, task_num+1, live_blks);
+    }
+
     bool EpochSys::check_epoch(uint64_t c){
         return c == global_epoch->load(std::memory_order_seq_cst);
     }
@@ -386,6 +647,46 @@ namespace pds{
     void EpochSys::on_epoch_begin(uint64_t c){
         // does reclamation for c-2
         to_be_freed->help_free(c-2);
+        if (recovery_index){
+            recovery_index->checkpoint();
+        }
+        fire_durable(c-2);
+    }
+
+    void EpochSys::on_durable(uint64_t c, std::function<void()> cb){
+        if (get_persisted_frontier() >= c){
+            cb();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lck(durable_lock);
+            durable_cbs[c].push_back(std::move(cb));
+            durable_cb_num.fetch_add(1, std::memory_order_release);
+        }
+        // the epoch may have moved past c+1 before we were queued.
+        fire_durable(get_persisted_frontier());
+    }
+
+    void EpochSys::fire_durable(uint64_t frontier){
+        if (durable_cb_num.load(std::memory_order_acquire) == 0){
+            return;
+        }
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lck(durable_lock);
+            auto end = durable_cbs.upper_bound(frontier);
+            for (auto it = durable_cbs.begin(); it != end; it++){
+                for (auto& cb : it->second){
+                    ready.push_back(std::move(cb));
+                }
+            }
+            durable_cbs.erase(durable_cbs.begin(), end);
+            durable_cb_num.fetch_sub(ready.size(), std::memory_order_relaxed);
+        }
+        // run outside the lock, so callbacks may queue new ones.
+        for (auto& cb : ready){
+            cb();
+        }
     }
 
     void EpochSys::on_epoch_end(uint64_t c){
@@ -393,28 +694,40 @@ namespace pds{
         // TODO: optimization: persist inactive threads first.
         while(!trans_tracker->no_active(c-1)){}
 
+        if (persisters){
+            // drain buffers in parallel; the walk below picks up anything left,
+            // or does all the work if another round is ongoing.
+            persisters->persist_epoch(c-1);
+        }
+
         // take modular, in case of dedicated epoch advancer calling this function.
         int curr_thread = EpochSys::tid % gtc->task_num;
         curr_thread = persisted_epochs->next_thread_to_persist(c-1, curr_thread);
         // check the top of mindicator to get the last persisted epoch globally
         while(curr_thread >= 0){
             // traverse mindicator to persist each leaf lagging behind, until the top meets requirement
-            to_be_persisted->persist_epoch_local(c-1, curr_thread);
-            persisted_epochs->after_persist_epoch(c-1, curr_thread);
+            persist_thread_epoch(c-1, curr_thread);
             curr_thread = persisted_epochs->next_thread_to_persist(c-1, curr_thread);
         }
     }
 
-    std::unordered_map<uint64_t, PBlk*>* EpochSys::recover(const int rec_thd){
-        std::unordered_map<uint64_t, PBlk*>* in_use = new std::unordered_map<uint64_t, PBlk*>();
+    void EpochSys::persist_thread_epoch(uint64_t c, int curr_thread){
+        to_be_persisted->persist_epoch_local(c, curr_thread);
+        persisted_epochs->after_persist_epoch(c, curr_thread);
+    }
+
+    RecoveredPBlks* EpochSys::recover(const int rec_thd){
+        RecoveredPBlks* in_use = new RecoveredPBlks(rec_thd);
+        // in-use blocks found by each recovery thread, partitioned by the
+        // shard they belong to.
+        std::vector<std::unordered_map<uint64_t, PBlk*>> in_use_parts(rec_thd * rec_thd);
         uint64_t max_epoch = 0;
 #ifndef MNEMOSYNE
         bool clean_start;
-        auto itr_raw = _ral->recover(rec_thd);
         sys_mode=RECOVER;
         // set system mode to RECOVER -- all PDELETE_DATA and PDELETE becomes no-ops.
         epoch_container = nullptr;
-        if(itr_raw[0].is_dirty()) {
+        if(heaps_dirty()) {
             clean_start = false;
             std::cout<<"dirty restart"<<std::endl;
             // dirty restart, epoch system and app need to handle
@@ -424,6 +737,35 @@ namespace pds{
             // clean restart, epoch system and app may still need iter to do something
         }
 
+        // after a clean exit with RecoveryIndex, walk the logged blocks
+        // instead of the whole heap.
+        std::vector<std::vector<PBlk*>> shards(rec_thd);
+        bool use_index = clean_start && RecoveryIndex::load(_ral, shards);
+        std::vector<InuseRecovery::iterator> itr_raw;
+        if (!use_index) {
+            itr_raw = recover_heaps(rec_thd);
+        }
+        if (use_index) {
+            std::cout << "recovering from index" << std::endl;
+            // the index only replaces the heap walk. blocks retired right
+            // before exit may still be around, so classify as after a crash.
+            clean_start = false;
+        }
+        auto for_each_blk = [&](int rec_tid, auto&& f) {
+            if (use_index) {
+                for (PBlk* curr_blk : shards[rec_tid]) {
+                    f(curr_blk);
+                }
+            } else {
+                // rec_thd iterators for each heap.
+                for (size_t i = rec_tid; i < itr_raw.size(); i += rec_thd) {
+                    for (; !itr_raw[i].is_last(); ++itr_raw[i]) {
+                        f((PBlk*)*itr_raw[i]);
+                    }
+                }
+            }
+        };
+
         std::atomic<int> curr_reporting;
         curr_reporting = 0;
         pthread_barrier_t sync_point;
@@ -441,8 +783,10 @@ namespace pds{
                 thread_local std::unordered_set<uint64_t> deleted_ids_local;
                 // make the first whole pass thorugh all blocks, find the epoch block
                 // and help Ralloc fully recover by completing the pass.
-                for (; !itr_raw[rec_tid].is_last(); ++itr_raw[rec_tid]){
-                    PBlk* curr_blk = (PBlk*) *itr_raw[rec_tid];
+                auto pass_begin = chrono::high_resolution_clock::now();
+                size_t pass_blks = 0;
+                for_each_blk(rec_tid, [&](PBlk* curr_blk){
+                    pass_blks++;
                     if (curr_blk->blktype == EPOCH){
                         epoch_container = (Epoch*) curr_blk;
                         global_epoch = &epoch_container->global_epoch;
@@ -456,8 +800,10 @@ namespace pds{
                             deleted_ids_local.insert(curr_blk->get_id());
                         }
                     }
-                    max_epoch_local = std::max(max_epoch_local, curr_blk->get_epoch());
-                }
+                    if (!stale_blk(curr_blk)){
+                        max_epoch_local = std::max(max_epoch_local, curr_blk->get_epoch());
+                    }
+                });
                 // report after the first pass:
                 // calculate the maximum epoch number as the current epoch.
                 pthread_barrier_wait(&sync_point);
@@ -465,6 +811,7 @@ namespace pds{
                     errexit("epoch container not found during recovery");
                 }
                 while(curr_reporting.load() != rec_tid);
+                report_first_pass(rec_tid, rec_thd, pass_begin, pass_blks, itr_raw);
                 if (rec_tid == 0) {
                     end = chrono::high_resolution_clock::now();
                     auto dur = end - begin;
@@ -475,6 +822,9 @@ namespace pds{
                               << "ms in first pass" << std::endl;
                     begin = chrono::high_resolution_clock::now();
                 }
+                // no block can be ahead of the epoch container by more
+                // than the epoch in progress.
+                max_epoch_local = std::min(max_epoch_local, global_epoch->load()+1);
                 max_epoch = std::max(max_epoch, max_epoch_local);
                 if (rec_tid == rec_thd-1){
                     end = chrono::high_resolution_clock::now();
@@ -502,17 +852,18 @@ namespace pds{
 
                 // make a second pass through all pblks
                 pthread_barrier_wait(&sync_point);
-                if (rec_tid == 0){
-                    itr_raw = _ral->recover(rec_thd);
+                if (rec_tid == 0 && !use_index){
+                    itr_raw = recover_heaps(rec_thd);
                 }
                 pthread_barrier_wait(&sync_point);
                 uint64_t epoch_cap = max_epoch - 2;
                 thread_local std::vector<PBlk*> not_in_use_local;
-                thread_local std::unordered_map<uint64_t, PBlk*> in_use_local;
+                auto in_use_local = [&](uint64_t id) -> std::unordered_map<uint64_t, PBlk*>& {
+                    return in_use_parts[rec_tid * rec_thd + RecoveredPBlks::shard_of(id, rec_thd)];
+                };
                 thread_local int second_pass_blks = 0;
-                for (; !itr_raw[rec_tid].is_last(); ++itr_raw[rec_tid]) {
+                for_each_blk(rec_tid, [&](PBlk* curr_blk){
                     second_pass_blks++;
-                    PBlk* curr_blk = (PBlk*)*itr_raw[rec_tid];
                     // put all premature pblks and those marked by
                     // deleted_ids in not_in_use
                     if (// skip epoch container
@@ -540,7 +891,7 @@ namespace pds{
                                 break;
                             case ALLOC: {
                                 auto insert_res =
-                                    in_use_local.insert({curr_blk->id, curr_blk});
+                                    in_use_local(curr_blk->id).insert({curr_blk->id, curr_blk});
                                 if (insert_res.second == false) {
                                     if (clean_start) {
                                         errexit(
@@ -551,8 +902,8 @@ namespace pds{
                                 }
                             } break;
                             case UPDATE: {
-                                auto search = in_use_local.find(curr_blk->id);
-                                if (search != in_use_local.end()) {
+                                auto search = in_use_local(curr_blk->id).find(curr_blk->id);
+                                if (search != in_use_local(curr_blk->id).end()) {
                                     if (clean_start) {
                                         errexit(
                                             "more than one record with the "
@@ -568,7 +919,7 @@ namespace pds{
                                         not_in_use_local.push_back(curr_blk);
                                     }
                                 } else {
-                                    in_use_local.insert({curr_blk->id, curr_blk});
+                                    in_use_local(curr_blk->id).insert({curr_blk->id, curr_blk});
                                 }
                             } break;
                             case DELETE:
@@ -578,14 +929,14 @@ namespace pds{
                                 not_in_use_local.push_back(curr_blk);
                                 break;
                             default:
-                                errexit("wrong type of pblk discovered");
+                                // stale bytes; see stale_blk().
+                                not_in_use_local.push_back(curr_blk);
                                 break;
                         }
                     }
-                }
+                });
                 // merge the results of in_use, resolve conflict
                 pthread_barrier_wait(&sync_point);
-                while (curr_reporting.load() != rec_tid);
                 if (rec_tid == 0) {
                     end = chrono::high_resolution_clock::now();
                     auto dur = end - begin;
@@ -597,19 +948,35 @@ namespace pds{
                     begin = chrono::high_resolution_clock::now();
                 }
                 std::cout<<"second pass blk count:"<<second_pass_blks<<std::endl;
-                for (auto itr : in_use_local) {
-                    auto found = in_use->find(itr.first);
-                    if (found == in_use->end()) {
-                        in_use->insert({itr.first, itr.second});
-                    } else if (found->second->get_epoch() <
-                               itr.second->get_epoch()) {
-                        not_in_use_local.push_back(found->second);
-                        found->second = itr.second;
-                    } else {
-                        not_in_use_local.push_back(itr.second);
+                // merge what all threads found for shard rec_tid.
+                auto& merged = in_use_parts[rec_tid * rec_thd + rec_tid];
+                for (int t = 0; t < rec_thd; t++) {
+                    if (t == rec_tid) {
+                        continue;
+                    }
+                    auto& part = in_use_parts[t * rec_thd + rec_tid];
+                    for (auto itr : part) {
+                        auto found = merged.find(itr.first);
+                        if (found == merged.end()) {
+                            merged.insert({itr.first, itr.second});
+                        } else if (found->second->get_epoch() <
+                                   itr.second->get_epoch()) {
+                            not_in_use_local.push_back(found->second);
+                            found->second = itr.second;
+                        } else {
+                            not_in_use_local.push_back(itr.second);
+                        }
                     }
+                    std::unordered_map<uint64_t, PBlk*>().swap(part);
                 }
-                if (rec_tid == rec_thd - 1) {
+                auto& shard = in_use->shard(rec_tid);
+                shard.reserve(merged.size());
+                for (auto itr : merged) {
+                    shard.push_back(itr.second);
+                }
+                std::unordered_map<uint64_t, PBlk*>().swap(merged);
+                pthread_barrier_wait(&sync_point);
+                if (rec_tid == 0) {
                     end = chrono::high_resolution_clock::now();
                     auto dur = end - begin;
                     std::cout << "Spent "
@@ -619,15 +986,14 @@ namespace pds{
                               << "ms in second merge" << std::endl;
                     begin = chrono::high_resolution_clock::now();
                 }
-                curr_reporting.store((rec_tid + 1) % rec_thd);
                 // clean up not_in_use and anti-nodes
                 for (auto itr : not_in_use_local) {
                     itr->set_epoch(NULL_EPOCH);
-                    _ral->deallocate(itr, rec_tid);
+                    ral_of(itr)->deallocate(itr, rec_tid);
                 }
                 for (auto itr : anti_nodes_local) {
                     itr.second->set_epoch(NULL_EPOCH);
-                    _ral->deallocate(itr.second, rec_tid);
+                    ral_of(itr.second)->deallocate(itr.second, rec_tid);
                 }
                 pthread_barrier_wait(&sync_point);
                 if (rec_tid == rec_thd - 1) {
@@ -647,6 +1013,11 @@ namespace pds{
                 worker.join();
             }
         }
+        // blocks of an index from before a crash have been freed by the scan.
+        // the slot is left alone if no index has ever been written.
+        if (_ral->get_root<IndexRoot>(RECOVERY_INDEX_ROOT) != nullptr) {
+            _ral->set_root(nullptr, RECOVERY_INDEX_ROOT);
+        }
         global_epoch->store(max_epoch);
         // set system mode back to online
         sys_mode = ONLINE;
@@ -837,19 +1208,24 @@ namespace pds{
         epoch_advancer->on_end_transaction(this, c);
     }
     void nbEpochSys::on_epoch_begin(uint64_t c){
-        // do nothing -- memory reclamation is done thread-locally in nbEpochSys
+        // memory reclamation is done thread-locally in nbEpochSys
+        if (recovery_index){
+            recovery_index->checkpoint();
+        }
+        fire_durable(c-2);
     }
 
     void nbEpochSys::on_epoch_end(uint64_t c){
+        if (persisters){
+            persisters->persist_epoch(c-1);
+        }
         // take modular, in case of dedicated epoch advancer calling this function.
         int curr_thread = EpochSys::tid % gtc->task_num;
         curr_thread = persisted_epochs->next_thread_to_persist(c-1, curr_thread);
         // check the top of mindicator to get the last persisted epoch globally
         while(curr_thread >= 0){
             // traverse mindicator to persist each leaf lagging behind, until the top meets requirement
-            local_descs[curr_thread]->try_abort(c-1); // lazily abort ongoing transactions
-            to_be_persisted->persist_epoch_local(c-1, curr_thread);
-            persisted_epochs->after_persist_epoch(c-1, curr_thread);
+            persist_thread_epoch(c-1, curr_thread);
             curr_thread = persisted_epochs->next_thread_to_persist(c-1, curr_thread);
         }
         // a lock-prefixed instruction (CAS) must have taken place inside Mindicator,
@@ -866,18 +1242,26 @@ namespace pds{
         // persist_func::sfence();
     }
 
-    std::unordered_map<uint64_t, PBlk*>* nbEpochSys::recover(const int rec_thd) {
-        std::unordered_map<uint64_t, PBlk*>* in_use = new std::unordered_map<uint64_t, PBlk*>();
+    void nbEpochSys::persist_thread_epoch(uint64_t c, int curr_thread){
+        local_descs[curr_thread]->try_abort(c); // lazily abort ongoing transactions
+        to_be_persisted->persist_epoch_local(c, curr_thread);
+        persisted_epochs->after_persist_epoch(c, curr_thread);
+    }
+
+    RecoveredPBlks* nbEpochSys::recover(const int rec_thd) {
+        RecoveredPBlks* in_use = new RecoveredPBlks(rec_thd);
+        // in-use blocks found by each recovery thread, partitioned by the
+        // shard they belong to.
+        std::vector<std::unordered_map<uint64_t, PBlk*>> in_use_parts(rec_thd * rec_thd);
         std::unordered_map<uint64_t, sc_desc_t*> descs;  //tid->desc
         uint64_t max_tid = 0;
         uint64_t max_epoch = 0;
 #ifndef MNEMOSYNE
         bool clean_start;
-        auto itr_raw = _ral->recover(rec_thd);
         sys_mode = RECOVER;
         // set system mode to RECOVER -- all PDELETE_DATA and PDELETE becomes no-ops.
         epoch_container = nullptr;
-        if (itr_raw[0].is_dirty()) {
+        if (heaps_dirty()) {
             clean_start = false;
             std::cout << "dirty restart" << std::endl;
             // dirty restart, epoch system and app need to handle
@@ -887,6 +1271,35 @@ namespace pds{
             // clean restart, epoch system and app may still need iter to do something
         }
 
+        // after a clean exit with RecoveryIndex, walk the logged blocks
+        // instead of the whole heap.
+        std::vector<std::vector<PBlk*>> shards(rec_thd);
+        bool use_index = clean_start && RecoveryIndex::load(_ral, shards);
+        std::vector<InuseRecovery::iterator> itr_raw;
+        if (!use_index) {
+            itr_raw = recover_heaps(rec_thd);
+        }
+        if (use_index) {
+            std::cout << "recovering from index" << std::endl;
+            // the index only replaces the heap walk. blocks retired right
+            // before exit may still be around, so classify as after a crash.
+            clean_start = false;
+        }
+        auto for_each_blk = [&](int rec_tid, auto&& f) {
+            if (use_index) {
+                for (PBlk* curr_blk : shards[rec_tid]) {
+                    f(curr_blk);
+                }
+            } else {
+                // rec_thd iterators for each heap.
+                for (size_t i = rec_tid; i < itr_raw.size(); i += rec_thd) {
+                    for (; !itr_raw[i].is_last(); ++itr_raw[i]) {
+                        f((PBlk*)*itr_raw[i]);
+                    }
+                }
+            }
+        };
+
         std::atomic<int> curr_reporting;
         curr_reporting = 0;
         pthread_barrier_t sync_point;
@@ -907,8 +1320,10 @@ namespace pds{
                 thread_local std::unordered_map<uint64_t, sc_desc_t*> descs_local;
                 // make the first whole pass thorugh all blocks, find the epoch block
                 // and help Ralloc fully recover by completing the pass.
-                for (; !itr_raw[rec_tid].is_last(); ++itr_raw[rec_tid]) {
-                    PBlk* curr_blk = (PBlk*)*itr_raw[rec_tid];
+                auto pass_begin = chrono::high_resolution_clock::now();
+                size_t pass_blks = 0;
+                for_each_blk(rec_tid, [&](PBlk* curr_blk){
+                    pass_blks++;
                     if (curr_blk->blktype == EPOCH) {
                         epoch_container = (Epoch*)curr_blk;
                         global_epoch = &epoch_container->global_epoch;
@@ -932,8 +1347,10 @@ namespace pds{
                             deleted_ids_local.insert(curr_blk->get_id());
                         }
                     }
-                    max_epoch_local = std::max(max_epoch_local, curr_blk->get_epoch());
-                }
+                    if (!stale_blk(curr_blk)){
+                        max_epoch_local = std::max(max_epoch_local, curr_blk->get_epoch());
+                    }
+                });
                 // report after the first pass:
                 // calculate the maximum epoch number as the current epoch.
                 // calculate the maximum tid
@@ -944,6 +1361,10 @@ namespace pds{
                 }
                 while (curr_reporting.load() != rec_tid)
                     ;
+                report_first_pass(rec_tid, rec_thd, pass_begin, pass_blks, itr_raw);
+                // no block can be ahead of the epoch container by more
+                // than the epoch in progress.
+                max_epoch_local = std::min(max_epoch_local, global_epoch->load()+1);
                 max_epoch = std::max(max_epoch, max_epoch_local);
                 max_tid = std::max(max_tid, max_tid_local);
                 descs.merge(descs_local);
@@ -982,15 +1403,16 @@ namespace pds{
 
                 // make a second pass through all pblks
                 pthread_barrier_wait(&sync_point);
-                if (rec_tid == 0) {
-                    itr_raw = _ral->recover(rec_thd);
+                if (rec_tid == 0 && !use_index) {
+                    itr_raw = recover_heaps(rec_thd);
                 }
                 pthread_barrier_wait(&sync_point);
                 
                 thread_local std::vector<PBlk*> not_in_use_local;
-                thread_local std::unordered_map<uint64_t, PBlk*> in_use_local;
-                for (; !itr_raw[rec_tid].is_last(); ++itr_raw[rec_tid]) {
-                    PBlk* curr_blk = (PBlk*)*itr_raw[rec_tid];
+                auto in_use_local = [&](uint64_t id) -> std::unordered_map<uint64_t, PBlk*>& {
+                    return in_use_parts[rec_tid * rec_thd + RecoveredPBlks::shard_of(id, rec_thd)];
+                };
+                for_each_blk(rec_tid, [&](PBlk* curr_blk){
                     auto curr_tid = curr_blk->get_tid();
                     auto curr_sn = curr_blk->get_sn();
                     // put all premature pblks and those marked by
@@ -1022,7 +1444,7 @@ namespace pds{
                                 break;
                             case ALLOC: {
                                 auto insert_res =
-                                    in_use_local.insert({curr_blk->id, curr_blk});
+                                    in_use_local(curr_blk->id).insert({curr_blk->id, curr_blk});
                                 if (insert_res.second == false) {
                                     if (clean_start) {
                                         errexit(
@@ -1033,8 +1455,8 @@ namespace pds{
                                 }
                             } break;
                             case UPDATE: {
-                                auto search = in_use_local.find(curr_blk->id);
-                                if (search != in_use_local.end()) {
+                                auto search = in_use_local(curr_blk->id).find(curr_blk->id);
+                                if (search != in_use_local(curr_blk->id).end()) {
                                     if (clean_start) {
                                         errexit(
                                             "more than one record with the "
@@ -1050,7 +1472,7 @@ namespace pds{
                                         not_in_use_local.push_back(curr_blk);
                                     }
                                 } else {
-                                    in_use_local.insert({curr_blk->id, curr_blk});
+                                    in_use_local(curr_blk->id).insert({curr_blk->id, curr_blk});
                                 }
                             } break;
                             case DELETE:
@@ -1058,36 +1480,49 @@ namespace pds{
                             case DESC:
                                 break;
                             default:
-                                errexit("wrong type of pblk discovered");
+                                // stale bytes; see stale_blk().
+                                not_in_use_local.push_back(curr_blk);
                                 break;
                         }
                     }
-                }
+                });
                 // merge the results of in_use, resolve conflict
                 pthread_barrier_wait(&sync_point);
-                while (curr_reporting.load() != rec_tid)
-                    ;
-                for (auto itr : in_use_local) {
-                    auto found = in_use->find(itr.first);
-                    if (found == in_use->end()) {
-                        in_use->insert({itr.first, itr.second});
-                    } else if (found->second->get_epoch() <
-                               itr.second->get_epoch()) {
-                        not_in_use_local.push_back(found->second);
-                        found->second = itr.second;
-                    } else {
-                        not_in_use_local.push_back(itr.second);
+                // merge what all threads found for shard rec_tid.
+                auto& merged = in_use_parts[rec_tid * rec_thd + rec_tid];
+                for (int t = 0; t < rec_thd; t++) {
+                    if (t == rec_tid) {
+                        continue;
                     }
+                    auto& part = in_use_parts[t * rec_thd + rec_tid];
+                    for (auto itr : part) {
+                        auto found = merged.find(itr.first);
+                        if (found == merged.end()) {
+                            merged.insert({itr.first, itr.second});
+                        } else if (found->second->get_epoch() <
+                                   itr.second->get_epoch()) {
+                            not_in_use_local.push_back(found->second);
+                            found->second = itr.second;
+                        } else {
+                            not_in_use_local.push_back(itr.second);
+                        }
+                    }
+                    std::unordered_map<uint64_t, PBlk*>().swap(part);
                 }
-                curr_reporting.store((rec_tid + 1) % rec_thd);
+                auto& shard = in_use->shard(rec_tid);
+                shard.reserve(merged.size());
+                for (auto itr : merged) {
+                    shard.push_back(itr.second);
+                }
+                std::unordered_map<uint64_t, PBlk*>().swap(merged);
                 // clean up not_in_use and anti-nodes
                 for (auto itr : not_in_use_local) {
                     itr->set_epoch(NULL_EPOCH);
-                    _ral->deallocate(itr, rec_tid);
+                    ral_of(itr)->deallocate(itr, rec_tid);
                 }
                 for (auto itr : anti_nodes_local) {
                     itr->set_epoch(NULL_EPOCH);
-                    _ral->deallocate(itr, rec_tid);
+                    ral_of(itr)->deallocate(itr, rec_tid);
                 }
             }));  // workers.emplace_back()
         }  // for (rec_thd)
@@ -1096,6 +1531,11 @@ namespace pds{
                 worker.join();
             }
         }
+        // blocks of an index from before a crash have been freed by the scan.
+        // the slot is left alone if no index has ever been written.
+        if (_ral->get_root<IndexRoot>(RECOVERY_INDEX_ROOT) != nullptr) {
+            _ral->set_root(nullptr, RECOVERY_INDEX_ROOT);
+        }
 
         // set system mode back to online
         sys_mode = ONLINE;
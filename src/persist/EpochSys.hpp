@@ -1,10 +1,14 @@
 #ifndef EPOCH_HPP
 #define EPOCH_HPP
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <unordered_map>
 #include <set>
 #include <map>
+#include <functional>
+#include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <string>
@@ -22,6 +26,8 @@
 #include "ToBeFreedContainers.hpp"
 #include "EpochAdvancers.hpp"
 #include "PersistTrackers.hpp"
+#include "Persisters.hpp"
+#include "RecoveryIndex.hpp"
 
 class Recoverable;
 
@@ -34,7 +40,7 @@ struct OldSeeNewException : public std::exception {
     }
 };
 
-enum PBlkType {INIT, ALLOC, UPDATE, DELETE, RECLAIMED, EPOCH, OWNED, DESC};
+enum PBlkType {INIT, ALLOC, UPDATE, DELETE, RECLAIMED, EPOCH, OWNED, DESC, INDEX};
 
 class EpochSys;
 
@@ -123,6 +129,17 @@ public:
     }
 };
 
+// bytes to allocate for a T constructed from args: T::pblk_size(args...)
+// for variable-length PBlks that define it, and sizeof(T) otherwise.
+template<typename T, typename... Types>
+inline auto pblk_size_of(int, const Types&... args) -> decltype(T::pblk_size(args...)){
+    return T::pblk_size(args...);
+}
+template<typename T, typename... Types>
+inline size_t pblk_size_of(long, const Types&... args){
+    return sizeof(T);
+}
+
 template<typename T>
 class PBlkArray : public PBlk{
     friend class EpochSys;
@@ -147,6 +164,79 @@ struct Epoch : public PBlk{
     }
 };
 
+// blocks of RecoveryIndex. they keep NULL_EPOCH so that a full scan
+// always discards them.
+struct IndexRoot : public PBlk{
+    uint64_t head = 0; // offset of the first chunk, 0 if none
+    uint64_t valid = 0; // set only on a clean exit
+    IndexRoot(){
+        blktype = INDEX;
+    }
+};
+
+struct IndexChunk : public PBlk{
+    static const int CAP = 1000;
+    uint64_t next = 0; // offset of the next chunk, 0 if none
+    uint64_t count = 0;
+    // offset of a block in the sb region << 1, last bit set for deallocation
+    uint64_t entries[CAP];
+    IndexChunk(){
+        blktype = INDEX;
+    }
+};
+
+// PBlks in use after recovery, one shard per recovery thread.
+// A block with a given id always lands in shard shard_of(id), so
+// shards are disjoint and can be consumed in parallel.
+class RecoveredPBlks{
+    std::vector<std::vector<PBlk*>> shards;
+public:
+    RecoveredPBlks(int shard_num) : shards(shard_num){}
+    // ids of a thread are consecutive and share their high bits, so
+    // mix them before picking a shard.
+    static int shard_of(uint64_t id, int shard_num){
+        return ((id * 0x9E3779B97F4A7C15ULL) >> 32) % shard_num;
+    }
+    int shard_num() const{
+        return shards.size();
+    }
+    std::vector<PBlk*>& shard(int i){
+        return shards[i];
+    }
+    size_t size() const{
+        size_t ret = 0;
+        for (auto& s : shards){
+            ret += s.size();
+        }
+        return ret;
+    }
+    // visit the part of the blocks that belongs to thread rec_tid of
+    // rec_thd consumers. Every block is visited by exactly one thread.
+    template<typename F>
+    void for_each(int rec_tid, int rec_thd, F f){
+        int sn = shard_num();
+        if (rec_thd <= sn){
+            for (int s = rec_tid; s < sn; s += rec_thd){
+                for (PBlk* blk : shards[s]){
+                    f(blk);
+                }
+            }
+        } else if (rec_tid < sn * (rec_thd / sn)){
+            // more consumers than shards; split each shard by stride.
+            int per_shard = rec_thd / sn;
+            auto& s = shards[rec_tid % sn];
+            for (size_t i = rec_tid / sn; i < s.size(); i += per_shard){
+                f(s[i]);
+            }
+        }
+    }
+    // visit all blocks from a single thread.
+    template<typename F>
+    void for_each(F f){
+        for_each(0, 1, f);
+    }
+};
+
 //////////////////
 // Epoch System //
 //////////////////
@@ -197,6 +287,9 @@ public:
     std::atomic<lin_var> var;
     T load(Recoverable* ds);
     T load_verify(Recoverable* ds);
+    // value along with its counter, which changes with every update, so
+    // that two equal results mean no update in between.
+    lin_var load_versioned(Recoverable* ds);
     bool CAS_verify(Recoverable* ds, T expected, const T& desired);
     // CAS doesn't check epoch nor cnt
     bool CAS(Recoverable* ds, T expected, const T& desired);
@@ -372,13 +465,31 @@ protected:
     ToBeFreedContainer* to_be_freed = nullptr;
     EpochAdvancer* epoch_advancer = nullptr;
     PersistTracker* persisted_epochs = nullptr;
+    PersisterPool* persisters = nullptr;
+    RecoveryIndex* recovery_index = nullptr;
 
     GlobalTestConfig* gtc = nullptr;
     Ralloc* _ral = nullptr;
+    // with NumaHeaps, one heap per socket (_ral is that of socket 0) and
+    // the socket of each thread; empty otherwise.
+    std::vector<Ralloc*> socket_rals;
+    std::vector<int> thread_sockets;
+    // size classes of new heaps; empty for Ralloc's default
+    std::vector<uint32_t> sc_sizes;
+    // how heaps map their superblock regions
+    RegionOptions region_opts;
     int task_num;
     static std::atomic<int> esys_num;
     padded<uint64_t>* last_epochs = nullptr;
-    std::unordered_map<uint64_t, PBlk*>* recovered = nullptr;
+    RecoveredPBlks* recovered = nullptr;
+
+    // durability callbacks waiting for their epoch to persist, by epoch.
+    std::mutex durable_lock;
+    std::map<uint64_t, std::vector<std::function<void()>>> durable_cbs;
+    // number of callbacks in durable_cbs, so epoch begins skip the lock.
+    std::atomic<size_t> durable_cb_num{0};
+    // run and remove callbacks of epochs up to frontier.
+    void fire_durable(uint64_t frontier);
 
 public:
 
@@ -391,7 +502,18 @@ public:
     EpochSys(GlobalTestConfig* _gtc) : uid_generator(_gtc->task_num), gtc(_gtc), task_num(_gtc->task_num) {
         std::string heap_name = get_ralloc_heap_name();
         // task_num+1 to construct Ralloc for dedicated epoch advancer
-        _ral = new Ralloc(_gtc->task_num+1,heap_name.c_str(),REGION_SIZE);
+        sc_sizes = get_size_classes();
+        region_opts = get_region_options();
+        _ral = new Ralloc(_gtc->task_num+1,heap_name.c_str(),REGION_SIZE,sc_sizes,region_opts);
+        if (gtc->checkEnv("NumaHeaps")){
+            init_socket_heaps(heap_name);
+        }
+        report_heap_mapping();
+        if (gtc->checkEnv("SizeHistogram")){
+            for (Ralloc* r : all_heaps()){
+                r->record_sizes();
+            }
+        }
         local_descs = new sc_desc_t* [gtc->task_num] {nullptr};
         last_epochs = new padded<uint64_t>[_gtc->task_num];
         // desc allocation and potential recovery are all in init()
@@ -411,11 +533,22 @@ public:
         if (epoch_advancer){
             delete epoch_advancer;
         }
+        if (persisters){
+            delete persisters;
+        }
         if(local_descs){
             delete local_descs;
         }
+        if (gtc->checkEnv("HeapStats")){
+            report_heap_stats();
+        }
         if (gtc->verbose){
             std::cout<<"final epoch:"<<global_epoch->load()<<std::endl;
+            for (Ralloc* r : all_heaps()){
+                TCacheStats cs = r->cache_stats();
+                std::cout<<"thread caches: "<<cs.fills<<" fills ("<<cs.batches_in<<" from other threads), "
+                         <<cs.flushes<<" flushes ("<<cs.batches_out<<" to other threads)"<<std::endl;
+            }
         }
         
         delete trans_tracker;
@@ -428,7 +561,21 @@ public:
         // Remove the following `set_fake_dirty()` routine if we
         // eventually support snapshot and fast recovery from clean
         // exit. 
-        _ral->set_fake_dirty();
+        // With RecoveryIndex, the index is a snapshot of all blocks,
+        // so a clean exit stays clean.
+        if (recovery_index){
+            recovery_index->close();
+            delete recovery_index;
+        } else {
+            _ral->set_fake_dirty();
+        }
+        if (gtc->checkEnv("SizeHistogram")){
+            dump_size_histogram(gtc->getEnv("SizeHistogram"));
+        }
+        for (size_t i = 1; i < socket_rals.size(); i++){
+            socket_rals[i]->set_fake_dirty();
+            delete socket_rals[i];
+        }
         delete _ral;
         delete last_epochs;
         if(recovered)
@@ -438,6 +585,60 @@ public:
 
     void parse_env();
 
+    // open a heap on each socket beyond the first, named after `heap_name'.
+    void init_socket_heaps(const std::string& heap_name);
+
+    // all heaps: _ral, plus those of other sockets with NumaHeaps.
+    inline std::vector<Ralloc*> all_heaps(){
+        return socket_rals.empty() ? std::vector<Ralloc*>{_ral} : socket_rals;
+    }
+
+    // size classes of new heaps, per the SizeClasses environment.
+    std::vector<uint32_t> get_size_classes();
+
+    // how to map heaps, per the HeapPageSize, HeapPrefault and HeapAdvise
+    // environments.
+    RegionOptions get_region_options();
+
+    // occupancy of all heaps; see Ralloc::stats().
+    HeapStats heap_stats();
+
+    // report heap_stats() through the recorder, and per size class with -v.
+    void report_heap_stats();
+
+    // report the time spent mapping and prefaulting heaps so far.
+    void report_heap_mapping();
+
+    // write the allocation sizes recorded in all heaps, and the size
+    // classes SizeClass::suggest picks for them, to `path'.
+    void dump_size_histogram(const std::string& path);
+
+    // the heap of the calling thread's socket.
+    inline Ralloc* local_ral(){
+        if (socket_rals.empty()){
+            return _ral;
+        }
+        int t = EpochSys::tid;
+        return (t >= 0 && t < (int)thread_sockets.size()) ?
+            socket_rals[thread_sockets[t]] : _ral;
+    }
+
+    // the heap holding blk.
+    inline Ralloc* ral_of(void* blk){
+        return heap_of(_ral, socket_rals, blk);
+    }
+
+    // check and mark all heaps dirty; see Ralloc::is_dirty().
+    bool heaps_dirty();
+
+    // Ralloc recovery iterators of all heaps, rec_thd for each heap.
+    std::vector<InuseRecovery::iterator> recover_heaps(int rec_thd);
+
+    // with gtc->verbose, print time, blocks and heap chunks of a recovery
+    // thread's first pass.
+    void report_first_pass(int rec_tid, int rec_thd, std::chrono::high_resolution_clock::time_point begin,
+        size_t blks, const std::vector<InuseRecovery::iterator>& itr_raw);
+
     std::string get_ralloc_heap_name(){
         if (!gtc->checkEnv("HeapName")){
             int esys_id = esys_num.fetch_add(1);
@@ -476,16 +677,34 @@ public:
         Ralloc::set_tid(_tid);
     }
 
+    // allocate sz bytes on Ralloc, and record it in the recovery index.
+    inline void* allocate_raw(size_t sz){
+        void* ret = local_ral()->allocate(sz);
+        if (recovery_index){
+            recovery_index->log_alloc(ret, EpochSys::tid);
+        }
+        return ret;
+    }
+
     void* malloc_pblk(size_t sz){
-        return _ral->allocate(sz);
+        return allocate_raw(sz);
+    }
+
+    // allocate num blocks of sz bytes into out with a single Ralloc call.
+    void malloc_pblk_bulk(size_t sz, size_t num, void** out){
+        local_ral()->allocate_bulk(sz, num, out);
+        if (recovery_index){
+            recovery_index->log_alloc_bulk(out, num, EpochSys::tid);
+        }
     }
 
     // allocate a T-typed block on Ralloc and
-    // construct using placement new
+    // construct using placement new. args are passed by reference so
+    // that copies of variable-length blocks keep their tail.
     template <class T, typename... Types>
-    T* new_pblk(Types... args){
-        T* ret = (T*)_ral->allocate(sizeof(T));
-        new (ret) T (args...);
+    T* new_pblk(Types&&... args){
+        T* ret = (T*)allocate_raw(pblk_size_of<T>(0, args...));
+        new (ret) T (std::forward<Types>(args)...);
         return ret;
     }
 
@@ -493,7 +712,14 @@ public:
     template <class T>
     void delete_pblk(T* pblk, uint64_t c){
         pblk->~T();
-        _ral->deallocate(pblk);
+        // the compiler may drop the store to epoch in ~PBlk as dead
+        // (-flifetime-dse), so clear it again after the destructor.
+        // otherwise freed blocks that are not reused come back on recovery.
+        ((PBlk*)pblk)->epoch = NULL_EPOCH;
+        if (recovery_index){
+            recovery_index->log_dealloc(pblk, EpochSys::tid);
+        }
+        ral_of(pblk)->deallocate(pblk);
         if (sys_mode == ONLINE && c != NULL_EPOCH){
             if (EpochSys::tid >= gtc->task_num){
                 // if this thread does not have to-be-presisted buffer
@@ -504,6 +730,47 @@ public:
         }
     }
 
+    // delete_pblk for a batch of blocks, which go back to Ralloc grouped
+    // by superblock. reorders and clears blks.
+    void delete_pblks(std::vector<PBlk*>& blks, uint64_t c){
+        if (blks.empty()){
+            return;
+        }
+        for (PBlk* pblk : blks){
+            pblk->~PBlk();
+            pblk->epoch = NULL_EPOCH;
+            if (recovery_index){
+                recovery_index->log_dealloc(pblk, EpochSys::tid);
+            }
+        }
+        if (socket_rals.empty()){
+            _ral->deallocate_batch((void**)blks.data(), blks.size());
+        } else {
+            // heaps are disjoint, so blocks of a heap become a run.
+            std::sort(blks.begin(), blks.end());
+            size_t i = 0;
+            while (i < blks.size()){
+                Ralloc* r = ral_of(blks[i]);
+                size_t j = i+1;
+                while (j < blks.size() && ral_of(blks[j]) == r){
+                    j++;
+                }
+                r->deallocate_batch((void**)blks.data()+i, j-i);
+                i = j;
+            }
+        }
+        if (sys_mode == ONLINE && c != NULL_EPOCH){
+            for (PBlk* pblk : blks){
+                if (EpochSys::tid >= gtc->task_num){
+                    persist_func::clwb(pblk);
+                } else {
+                    to_be_persisted->register_persist_raw(pblk, c);
+                }
+            }
+        }
+        blks.clear();
+    }
+
     // check if global is the same as c.
     bool check_epoch(uint64_t c);
 
@@ -585,11 +852,49 @@ public:
     template<typename T>
     T* openwrite_pblk(T* b, uint64_t c);
 
+    // replace b by a new version constructed from args, e.g., to resize
+    // a variable-length PBlk. b must not be used afterwards.
+    template<typename T, typename... Types>
+    T* reopen_pblk(T* b, uint64_t c, const Types&... args);
+
     // block, call for persistence of epoch c, and wait until finish.
     void sync(){
         epoch_advancer->sync(last_epochs[tid].ui);
     }
 
+    // block until epoch c is persisted.
+    void sync(uint64_t c){
+        epoch_advancer->sync(c);
+    }
+
+    // run cb once epoch c is persisted: right away if it already is,
+    // otherwise on the thread that advances the epoch past c+1. callbacks
+    // hold up the epoch advance, so they should be short and not sync().
+    void on_durable(uint64_t c, std::function<void()> cb);
+
+    // the last epoch the calling thread worked in. its updates are
+    // durable once get_persisted_frontier() reaches it.
+    uint64_t get_last_epoch(){
+        return last_epochs[tid].ui;
+    }
+
+    // blocks of epochs up to the frontier are persisted and survive a
+    // crash. the epoch only advances from c to c+1 after on_epoch_end(c)
+    // has written back epoch c-1, so it's always two epochs behind.
+    uint64_t get_persisted_frontier(){
+        return get_epoch()-2;
+    }
+
+    // write back the calling thread's buffers of epochs c-1 and c. the
+    // tracker isn't updated, so on_epoch_end still visits the thread, but
+    // finds its buffers drained.
+    void persist_local(uint64_t c){
+        for (uint64_t e = c-1; e <= c; e++){
+            to_be_persisted->persist_epoch_local(e, tid);
+        }
+        persist_func::sfence();
+    }
+
     /////////////////
     // Bookkeeping //
     /////////////////
@@ -601,6 +906,14 @@ public:
         return global_epoch->compare_exchange_strong(expected, desired);
     }
 
+    // load signals for adaptive epoch length. for the epoch advancer only.
+    double persist_buffer_load(){
+        return to_be_persisted->buffer_load();
+    }
+    uint64_t free_backlog(){
+        return to_be_freed->backlog();
+    }
+
     // // try to advance global epoch, helping others along the way.
     // void advance_epoch(uint64_t c);
 
@@ -618,6 +931,10 @@ public:
     // stuff to do at the end of epoch c
     virtual void on_epoch_end(uint64_t c);
 
+    // write back epoch c of thread curr_thread and report it to persisted_epochs.
+    // called by the epoch advancer and persister threads.
+    virtual void persist_thread_epoch(uint64_t c, int curr_thread);
+
     /////////////
     // Recover //
     /////////////
@@ -635,6 +952,7 @@ public:
             auto dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
             std::cout << "Spent " << dur_ms << "ms getting PBlk(" << recovered->size() << ")" << std::endl;
         }
+        init_recovery_index();
         for(int i=0;i<gtc->task_num;i++){
             assert(local_descs[i]==nullptr);
             local_descs[i] = new_pblk<sc_desc_t>(i);
@@ -645,12 +963,16 @@ public:
         reset();
     }
 
-    std::unordered_map<uint64_t, PBlk*>* get_recovered() {
+    // start logging allocations if RecoveryIndex is set. must be called
+    // after recover() and before any new block is allocated.
+    void init_recovery_index();
+
+    RecoveredPBlks* get_recovered() {
         return (recovered);
     }
 
     // recover all PBlk decendants. return an iterator.
-    virtual std::unordered_map<uint64_t, PBlk*>* recover(const int rec_thd = 2);
+    virtual RecoveredPBlks* recover(const int rec_thd = 2);
 };
 
 class nbEpochSys : public EpochSys {
@@ -674,6 +996,7 @@ class nbEpochSys : public EpochSys {
             auto dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
             std::cout << "Spent " << dur_ms << "ms getting PBlk(" << recovered->size() << ")" << std::endl;
         }
+        init_recovery_index();
         bool reached_all_reused_descs = false; // for debugging
         for(int i=0;i<gtc->task_num;i++){
             assert(!reached_all_reused_descs || local_descs[i]==nullptr);
@@ -705,7 +1028,8 @@ class nbEpochSys : public EpochSys {
     };
     virtual void on_epoch_begin(uint64_t c) override;
     virtual void on_epoch_end(uint64_t c) override;
-    virtual std::unordered_map<uint64_t, PBlk*>* recover(const int rec_thd = 2) override;
+    virtual void persist_thread_epoch(uint64_t c, int curr_thread) override;
+    virtual RecoveredPBlks* recover(const int rec_thd = 2) override;
     /*{assert(0&&"not implemented yet"); return {};}*/
 
     virtual void register_alloc_pblk(PBlk* b, uint64_t c) override;
@@ -745,7 +1069,7 @@ T* EpochSys::reset_alloc_pblk(T* b, uint64_t c){
 template<typename T>
 PBlkArray<T>* EpochSys::alloc_pblk_array(size_t s, uint64_t c){
     PBlkArray<T>* ret = static_cast<PBlkArray<T>*>(
-        _ral->allocate(sizeof(PBlkArray<T>) + s*sizeof(T)));
+        allocate_raw(sizeof(PBlkArray<T>) + s*sizeof(T)));
     new (ret) PBlkArray<T>();
     // Wentao: content initialization has been moved into PBlkArray constructor
     ret->size = s;
@@ -764,7 +1088,7 @@ PBlkArray<T>* EpochSys::alloc_pblk_array(size_t s, uint64_t c){
 template<typename T>
 PBlkArray<T>* EpochSys::alloc_pblk_array(PBlk* owner, size_t s, uint64_t c){
     PBlkArray<T>* ret = static_cast<PBlkArray<T>*>(
-        _ral->allocate(sizeof(PBlkArray<T>) + s*sizeof(T)));
+        allocate_raw(sizeof(PBlkArray<T>) + s*sizeof(T)));
     new (ret) PBlkArray<T>(owner);
     ret->size = s;
     T* p = ret->content;
@@ -782,9 +1106,9 @@ PBlkArray<T>* EpochSys::alloc_pblk_array(PBlk* owner, size_t s, uint64_t c){
 template<typename T>
 PBlkArray<T>* EpochSys::copy_pblk_array(const PBlkArray<T>* oth, uint64_t c){
     PBlkArray<T>* ret = static_cast<PBlkArray<T>*>(
-        _ral->allocate(sizeof(PBlkArray<T>) + oth->size*sizeof(T)));
+        allocate_raw(sizeof(PBlkArray<T>) + oth->size*sizeof(T)));
     new (ret) PBlkArray<T>(*oth);
-    memcpy(ret->content, oth->content, oth->size*sizeof(T));
+    NtStore::copy(ret->content, oth->content, oth->size*sizeof(T));
     ret->epoch = c;
     to_be_persisted->register_persist(ret, c);
     return ret;
@@ -913,6 +1237,28 @@ T* EpochSys::openwrite_pblk(T* b, uint64_t c){
     return b;
 }
 
+template<typename T, typename... Types>
+T* EpochSys::reopen_pblk(T* b, uint64_t c, const Types&... args){
+    ASSERT_DERIVE(T, PBlk);
+    ASSERT_COPY(T);
+
+    validate_access(b, c);
+    T* ret = new_pblk<T>(args...);
+    PBlk* blk = b;
+    PBlk* new_blk = ret;
+    new_blk->id = blk->id;
+    new_blk->epoch = c;
+    new_blk->blktype = UPDATE;
+    if (blk->epoch < c){
+        to_be_freed->register_free(b, c);
+    } else {
+        // b is of this epoch too, and both can't persist with the same id.
+        delete_pblk(b, c);
+    }
+    // like openwrite_pblk, ret is registered for persistence by the API module.
+    return ret;
+}
+
 }
 
 #endif
\ No newline at end of file
@@ -66,18 +66,18 @@ class InPlaceString{
 public:
     InPlaceString(PBlk* owner, const std::string& str) : size_(str.size()){
         assert(size_<=cap);
-        memcpy(char_array, str.c_str(), str.size()+1);
+        NtStore::copy(char_array, str.c_str(), str.size()+1);
         assert(char_array[size_] == '\0');
     }
     InPlaceString(const InPlaceString<cap>& oth){
         size_ = oth.size();
         assert(size_<=cap);
-        memcpy(char_array, oth.char_array, size_+1);
+        NtStore::copy(char_array, oth.char_array, size_+1);
         assert(char_array[size_] == '\0');
     }
     InPlaceString(const std::string& str) : size_(str.size()){
         assert(size_<=cap);
-        memcpy(char_array, str.c_str(), str.size()+1);
+        NtStore::copy(char_array, str.c_str(), str.size()+1);
         assert(char_array[size_] == '\0');
     }
     InPlaceString() : size_(0){
@@ -86,7 +86,7 @@ public:
     InPlaceString<cap>& operator = (const InPlaceString<cap> &oth){ //assignment
         size_ = oth.size();
         assert(size_<=cap);
-        memcpy(char_array, oth.char_array, size_+1);
+        NtStore::copy(char_array, oth.char_array, size_+1);
         assert(char_array[size_] == '\0');
         return *this;
     }
@@ -94,7 +94,7 @@ public:
     InPlaceString<cap>& operator=(const std::string& str){
         size_ = str.size();
         assert(size_<=cap);
-        memcpy(char_array, str.c_str(), size_+1);
+        NtStore::copy(char_array, str.c_str(), size_+1);
         assert(char_array[size_] == '\0');
         return *this;
     }
@@ -175,7 +175,7 @@ public:
     TrivialInPlaceString(const std::string& str) {
         sz = str.size();
         assert(str.size()<=cap);
-        memcpy((char*)content, str.data(), str.size());
+        NtStore::copy((char*)content, str.data(), str.size());
     }
 
     ~TrivialInPlaceString(){
@@ -206,7 +206,7 @@ public:
     }
     TrivialInPlaceString<cap>& operator=(const std::string& str){
         if(str.size() <= cap){
-            memcpy((char*)content, str.data(), str.size());
+            NtStore::copy((char*)content, str.data(), str.size());
             sz = str.size();
         } else {
             printf("String length exceeds TrivialInPlaceString capacity!\n");
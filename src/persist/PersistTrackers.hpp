@@ -17,6 +17,8 @@ public:
     // virtual uint64_t min_persisted() = 0;
     virtual int next_thread_to_persist(uint64_t e, int tid) = 0;
     virtual int next_thread_to_persist(uint64_t e) = 0;
+    // find a thread lagging behind e among those whose owner is `persister'.
+    virtual int next_thread_to_persist(uint64_t e, const std::vector<int>& owner, int persister) = 0;
     virtual uint64_t next_epoch_to_persist(int tid) = 0;
     virtual ~PersistTracker(){}
 };
@@ -186,6 +188,24 @@ class Mindicator: public PersistTracker{
             }
         }
     }
+    int find_next_owned_thread_le(Node* n, uint64_t val, const std::vector<int>& owner, int persister){
+        if (n->marked_val.load().get_val() > val){
+            return -1;
+        }
+        if (n->leaf_idx >= 0){
+            if (n->leaf_idx < (int)owner.size() && owner[n->leaf_idx] == persister){
+                return n->leaf_idx;
+            }
+            return -1;
+        } else {
+            int ret = find_next_owned_thread_le(n->children[0], val, owner, persister);
+            if (ret >= 0){
+                return ret;
+            } else {
+                return find_next_owned_thread_le(n->children[1], val, owner, persister);
+            }
+        }
+    }
 
     Node* root = nullptr;
     Node* leaves = nullptr;
@@ -248,9 +268,9 @@ public:
         init_subtree(root, path, -1);
     }
     ~Mindicator(){
-        delete paths;
+        delete[] paths;
         reclaim_tree(root);
-        delete leaves;
+        delete[] leaves;
     }
     void change(uint64_t val, int tid){
         // if val gets larger, depart is local;
@@ -314,6 +334,9 @@ public:
         }
         return -1;
     }
+    int next_thread_to_persist(uint64_t val, const std::vector<int>& owner, int persister){
+        return find_next_owned_thread_le(root, val, owner, persister);
+    }
     uint64_t next_epoch_to_persist(int tid){
         uint64_t ret = leaves[tid].marked_val.load().get_val();
         if (ret == UINT64_MAX){
@@ -399,6 +422,24 @@ class IncreasingMindicator : public PersistTracker{
             }
         }
     }
+    int find_next_owned_thread_le(Node* n, uint64_t val, const std::vector<int>& owner, int persister){
+        if (n->val.load() > val){
+            return -1;
+        }
+        if (n->leaf_idx >= 0){
+            if (n->leaf_idx < (int)owner.size() && owner[n->leaf_idx] == persister){
+                return n->leaf_idx;
+            }
+            return -1;
+        } else {
+            int ret = find_next_owned_thread_le(n->children[0], val, owner, persister);
+            if (ret >= 0){
+                return ret;
+            } else {
+                return find_next_owned_thread_le(n->children[1], val, owner, persister);
+            }
+        }
+    }
 
     Node* leaves = nullptr;
     Node* root = nullptr;
@@ -452,9 +493,9 @@ public:
         init_subtree(root, path, -1);
     }
     ~IncreasingMindicator(){
-        delete paths;
+        delete[] paths;
         reclaim_tree(root);
-        delete leaves;
+        delete[] leaves;
     }
     void first_write_on_new_epoch(uint64_t e, int tid){
         // do nothing.
@@ -484,6 +525,9 @@ public:
         }
         return -1;
     }
+    int next_thread_to_persist(uint64_t val, const std::vector<int>& owner, int persister){
+        return find_next_owned_thread_le(root, val, owner, persister);
+    }
     int next_thread_to_persist(uint64_t val, int curr){
         if (leaves[curr].val.load() <= val){
             return curr;
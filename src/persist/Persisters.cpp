@@ -0,0 +1,130 @@
+#include "Persisters.hpp"
+
+using namespace pds;
+
+PersisterPool::PersisterPool(GlobalTestConfig* _gtc, int _persister_num, PersistTracker* _tracker,
+    std::function<void(uint64_t, int)> _persist_thread_epoch):
+    gtc(_gtc), tracker(_tracker), persist_thread_epoch(_persist_thread_epoch),
+    persister_num(_persister_num), task_num(_gtc->task_num){
+    assert(persister_num > 0);
+    if (!gtc->checkEnv("NoAdvancerPinning")){
+        find_sockets();
+    }
+    assign_owners();
+    pending.ui.store(0);
+    for (int i = 0; i < persister_num; i++){
+        persisters.push_back(std::move(
+            std::thread(&PersisterPool::persister_main, this, i)));
+    }
+}
+
+PersisterPool::~PersisterPool(){
+    {
+        std::unique_lock<std::mutex> lck(bell);
+        exit = true;
+    }
+    ring.notify_all();
+    for (auto& p : persisters){
+        if (p.joinable()){
+            p.join();
+        }
+    }
+}
+
+void PersisterPool::find_sockets(){
+    int socket_num = hwloc_get_nbobjs_by_type(gtc->topology, HWLOC_OBJ_SOCKET);
+    if (socket_num <= 0){
+        return;
+    }
+    for (int i = 0; i < persister_num; i++){
+        persister_affinities.push_back(
+            hwloc_get_obj_by_type(gtc->topology, HWLOC_OBJ_SOCKET, i % socket_num));
+    }
+}
+
+void PersisterPool::assign_owners(){
+    owner.resize(task_num);
+    first_owned.assign(persister_num, -1);
+    if (persister_affinities.empty() || gtc->affinities.empty()){
+        // no socket information; split workers into contiguous ranges.
+        for (int tid = 0; tid < task_num; tid++){
+            owner[tid] = (int)((int64_t)tid * persister_num / task_num);
+        }
+    } else {
+        // give each worker to a persister on the same socket, round-robin
+        // among them. fall back to a contiguous split if there's none.
+        std::vector<int> assigned(persister_num, 0);
+        for (int tid = 0; tid < task_num; tid++){
+            hwloc_obj_t pu = gtc->affinities[tid % gtc->affinities.size()];
+            hwloc_obj_t socket = hwloc_get_ancestor_obj_by_type(
+                gtc->topology, HWLOC_OBJ_SOCKET, pu);
+            int chosen = (int)((int64_t)tid * persister_num / task_num);
+            for (int pid = 0; pid < persister_num; pid++){
+                if (persister_affinities[pid] == socket &&
+                    (persister_affinities[chosen] != socket || assigned[pid] < assigned[chosen])){
+                    chosen = pid;
+                }
+            }
+            owner[tid] = chosen;
+            assigned[chosen]++;
+        }
+    }
+    for (int tid = task_num - 1; tid >= 0; tid--){
+        first_owned[owner[tid]] = tid;
+    }
+}
+
+void PersisterPool::persister_main(int pid){
+    if (!persister_affinities.empty()){
+        hwloc_set_cpubind(gtc->topology,
+            persister_affinities[pid]->cpuset, HWLOC_CPUBIND_THREAD);
+    }
+    uint64_t last_round = 0;
+    while(true){
+        uint64_t c;
+        {
+            std::unique_lock<std::mutex> lck(bell);
+            ring.wait(lck, [&]{return exit || round != last_round;});
+            if (exit){
+                return;
+            }
+            last_round = round;
+            c = round_epoch;
+        }
+        drain(c, pid);
+        pending.ui.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void PersisterPool::drain(uint64_t c, int pid){
+    // persist lagging threads owned by this persister first.
+    int curr_thread = tracker->next_thread_to_persist(c, owner, pid);
+    while(curr_thread >= 0){
+        persist_thread_epoch(c, curr_thread);
+        curr_thread = tracker->next_thread_to_persist(c, owner, pid);
+    }
+    // then help others, starting from leaves close to ours.
+    // persisting a thread more than once is harmless.
+    curr_thread = first_owned[pid] >= 0 ? first_owned[pid] : 0;
+    curr_thread = tracker->next_thread_to_persist(c, curr_thread);
+    while(curr_thread >= 0){
+        persist_thread_epoch(c, curr_thread);
+        curr_thread = tracker->next_thread_to_persist(c, curr_thread);
+    }
+}
+
+bool PersisterPool::persist_epoch(uint64_t c){
+    std::unique_lock<std::mutex> round_lck(dispatch, std::try_to_lock);
+    if (!round_lck.owns_lock()){
+        return false;
+    }
+    pending.ui.store(persister_num, std::memory_order_relaxed);
+    {
+        std::unique_lock<std::mutex> lck(bell);
+        round_epoch = c;
+        round++;
+    }
+    ring.notify_all();
+    while(pending.ui.load(std::memory_order_acquire) != 0){}
+    return true;
+}
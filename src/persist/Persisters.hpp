@@ -0,0 +1,65 @@
+#ifndef PERSISTERS_HPP
+#define PERSISTERS_HPP
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <hwloc.h>
+
+#include "TestConfig.hpp"
+#include "ConcurrentPrimitives.hpp"
+#include "PersistTrackers.hpp"
+#include "common_macros.hpp"
+
+namespace pds{
+
+////////////////////
+// Persister Pool //
+////////////////////
+
+// A pool of dedicated threads that drain the per-thread to-be-persisted
+// buffers of an ended epoch concurrently.
+// Persisters are pinned round-robin to sockets, and every worker thread is
+// owned by a persister on the worker's socket. On each round, a persister
+// asks the persist tracker for lagging threads it owns, and then helps with
+// whatever other threads are still behind.
+class PersisterPool{
+    GlobalTestConfig* gtc;
+    PersistTracker* tracker;
+    // write back epoch c of thread tid, and report it to the tracker.
+    std::function<void(uint64_t, int)> persist_thread_epoch;
+    int persister_num;
+    int task_num;
+    std::vector<std::thread> persisters;
+    std::vector<hwloc_obj_t> persister_affinities;
+    std::vector<int> owner; // worker tid -> persister id
+    std::vector<int> first_owned; // persister id -> first worker tid it owns
+
+    // only one round at a time; concurrent callers walk the tracker themselves.
+    std::mutex dispatch;
+    std::mutex bell;
+    std::condition_variable ring;
+    uint64_t round = 0; // protected by bell
+    uint64_t round_epoch = NULL_EPOCH; // protected by bell
+    bool exit = false; // protected by bell
+    paddedAtomic<int> pending;
+
+    void find_sockets();
+    void assign_owners();
+    void persister_main(int pid);
+    void drain(uint64_t c, int pid);
+public:
+    PersisterPool(GlobalTestConfig* _gtc, int _persister_num, PersistTracker* _tracker,
+        std::function<void(uint64_t, int)> _persist_thread_epoch);
+    ~PersisterPool();
+    // write back epoch c of all threads, and return when all persisters are done.
+    // return false without doing anything if another round is ongoing.
+    bool persist_epoch(uint64_t c);
+};
+
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include "RecoveryIndex.hpp"
+#include "EpochSys.hpp"
+
+#include <unordered_map>
+
+using namespace pds;
+
+char* RecoveryIndex::get_sb_base(Ralloc* ral){
+    void* start = nullptr;
+    void* end = nullptr;
+    if (ral->region_range(SB_IDX, &start, &end)){
+        errexit("unable to locate the superblock region for recovery index.");
+    }
+    return (char*)start;
+}
+
+RecoveryIndex::RecoveryIndex(Ralloc* ral, int thd_num, const std::vector<PBlk*>& live_blks):
+    _ral(ral), log_num(thd_num){
+    sb_base = get_sb_base(_ral);
+    logs = new Log[log_num];
+    root = new (_ral->allocate(sizeof(IndexRoot))) IndexRoot();
+    tail = new_chunk();
+    root->head = (uint64_t)tail - (uint64_t)sb_base;
+    persist_func::clwb_range_nofence(root, sizeof(IndexRoot));
+    for (PBlk* blk : live_blks){
+        append(to_entry(blk, false));
+    }
+    flush_tail();
+    persist_func::sfence();
+    _ral->set_root(root, RECOVERY_INDEX_ROOT);
+}
+
+RecoveryIndex::~RecoveryIndex(){
+    delete[] logs;
+}
+
+IndexChunk* RecoveryIndex::new_chunk(){
+    IndexChunk* ret = new (_ral->allocate(sizeof(IndexChunk))) IndexChunk();
+    persist_func::clwb_range_nofence(ret, sizeof(PBlk) + 2*sizeof(uint64_t));
+    return ret;
+}
+
+void RecoveryIndex::append(uint64_t entry){
+    if (tail->count == IndexChunk::CAP){
+        flush_tail();
+        IndexChunk* next = new_chunk();
+        tail->next = (uint64_t)next - (uint64_t)sb_base;
+        persist_func::clwb(&tail->next);
+        tail = next;
+    }
+    tail->entries[tail->count++] = entry;
+    live += (entry & 1) ? -1 : 1;
+}
+
+void RecoveryIndex::flush_tail(){
+    persist_func::clwb(&tail->count);
+    persist_func::clwb_range_nofence(tail->entries, tail->count*sizeof(uint64_t));
+}
+
+void RecoveryIndex::free_chunks(uint64_t head){
+    while (head != 0){
+        IndexChunk* curr = (IndexChunk*)(sb_base + head);
+        head = curr->next;
+        _ral->deallocate(curr);
+    }
+}
+
+void RecoveryIndex::compact(){
+    std::unordered_map<uint64_t, int64_t> counts;
+    for (uint64_t off = root->head; off != 0;){
+        IndexChunk* curr = (IndexChunk*)(sb_base + off);
+        for (uint64_t i = 0; i < curr->count; i++){
+            counts[curr->entries[i] >> 1] += (curr->entries[i] & 1) ? -1 : 1;
+        }
+        off = curr->next;
+    }
+    uint64_t old_head = root->head;
+    live = 0;
+    tail = new_chunk();
+    uint64_t new_head = (uint64_t)tail - (uint64_t)sb_base;
+    for (auto& c : counts){
+        if (c.second > 0){
+            append(c.first << 1);
+        }
+    }
+    flush_tail();
+    persist_func::sfence();
+    root->head = new_head;
+    persist_func::clwb(&root->head);
+    persist_func::sfence();
+    free_chunks(old_head);
+}
+
+std::vector<uint64_t>& RecoveryIndex::Log::detach(){
+    // called under checkpoint_lock, which serializes the flips
+    int old = active.load();
+    active.store(1 - old);
+    uint64_t s = seq.load();
+    if (s & 1){
+        // the owner may have picked the old buffer before the flip
+        while (seq.load(std::memory_order_acquire) == s){}
+    }
+    return entries[old];
+}
+
+void RecoveryIndex::checkpoint(){
+    std::unique_lock<std::mutex> lck(checkpoint_lock, std::try_to_lock);
+    if (!lck.owns_lock()){
+        return;
+    }
+    size_t appended = 0;
+    for (int i = 0; i < log_num; i++){
+        std::vector<uint64_t>& draining = logs[i].detach();
+        for (uint64_t entry : draining){
+            append(entry);
+        }
+        appended += draining.size();
+        draining.clear();
+    }
+    if (appended == 0){
+        return;
+    }
+    flush_tail();
+    persist_func::sfence();
+    // keep replay cost on restart proportional to live blocks.
+    uint64_t chunks_live = live / IndexChunk::CAP + 1;
+    uint64_t chunks = 0;
+    for (uint64_t off = root->head; off != 0 && chunks <= 2*chunks_live + 4; chunks++){
+        off = ((IndexChunk*)(sb_base + off))->next;
+    }
+    if (chunks > 2*chunks_live + 4){
+        compact();
+    }
+}
+
+void RecoveryIndex::close(){
+    checkpoint();
+    std::lock_guard<std::mutex> lck(checkpoint_lock);
+    compact();
+    root->valid = 1;
+    persist_func::clwb(&root->valid);
+    persist_func::sfence();
+}
+
+bool RecoveryIndex::load(Ralloc* ral, std::vector<std::vector<PBlk*>>& shards){
+    IndexRoot* root = ral->get_root<IndexRoot>(RECOVERY_INDEX_ROOT);
+    if (root == nullptr){
+        return false;
+    }
+    char* base = get_sb_base(ral);
+    bool valid = root->get_blktype() == INDEX && root->valid == 1;
+    std::unordered_map<uint64_t, int64_t> counts;
+    uint64_t off = valid ? root->head : 0;
+    while (off != 0){
+        IndexChunk* curr = (IndexChunk*)(base + off);
+        for (uint64_t i = 0; i < curr->count; i++){
+            counts[curr->entries[i] >> 1] += (curr->entries[i] & 1) ? -1 : 1;
+        }
+        off = curr->next;
+        ral->deallocate(curr);
+    }
+    if (valid){
+        size_t i = 0;
+        for (auto& c : counts){
+            if (c.second > 0){
+                shards[i % shards.size()].push_back((PBlk*)(base + c.first));
+                i++;
+            }
+        }
+        ral->deallocate(root);
+    }
+    ral->set_root(nullptr, RECOVERY_INDEX_ROOT);
+    return valid;
+}
@@ -0,0 +1,114 @@
+#ifndef RECOVERY_INDEX_HPP
+#define RECOVERY_INDEX_HPP
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "ConcurrentPrimitives.hpp"
+#include "ralloc.hpp"
+
+namespace pds{
+
+class PBlk;
+struct IndexRoot;
+struct IndexChunk;
+
+// Ralloc root slot that holds the recovery index.
+const uint64_t RECOVERY_INDEX_ROOT = 0;
+
+////////////////////
+// Recovery Index //
+////////////////////
+
+// A persistent log of PBlk allocations and deallocations, so that a
+// restart after a clean exit finds all blocks without scanning the heap.
+//
+// Worker threads append to transient per-thread logs; on every epoch
+// begin, the logs are drained into persistent IndexChunks hanging off the
+// Ralloc root RECOVERY_INDEX_ROOT. Entries are counted rather than
+// ordered (+1 per allocation, -1 per deallocation), so logs of different
+// threads can be drained in any order. When the chunks grow much longer
+// than the set of live blocks, they are compacted into a snapshot.
+//
+// The index is only marked valid by close() on a clean exit. After a
+// crash, the full scan throws all INDEX blocks away, since they carry
+// NULL_EPOCH.
+class RecoveryIndex{
+    // written only by the thread owning tid, so appends take no lock.
+    // checkpoint() flips `active' and waits until the owner is out of the
+    // buffer it takes.
+    struct Log{
+        std::vector<uint64_t> entries[2];
+        std::atomic<int> active{0};
+        // odd while the owner is appending. seq_cst, so that either the
+        // owner sees the flipped buffer or checkpoint() sees it appending.
+        std::atomic<uint64_t> seq{0};
+
+        inline std::vector<uint64_t>& begin_append(){
+            seq.store(seq.load(std::memory_order_relaxed) + 1);
+            return entries[active.load()];
+        }
+        inline void end_append(){
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        std::vector<uint64_t>& detach();
+    }__attribute__((aligned(CACHE_LINE_SIZE)));
+
+    Ralloc* _ral;
+    char* sb_base = nullptr;
+    int log_num;
+    Log* logs = nullptr;
+    IndexRoot* root = nullptr;
+    IndexChunk* tail = nullptr;
+    // live blocks as of the appended entries, for compaction.
+    int64_t live = 0;
+    std::mutex checkpoint_lock;
+
+    inline uint64_t to_entry(void* blk, bool dealloc){
+        return (((uint64_t)blk - (uint64_t)sb_base) << 1) | (dealloc ? 1 : 0);
+    }
+    static char* get_sb_base(Ralloc* ral);
+    IndexChunk* new_chunk();
+    void append(uint64_t entry);
+    void flush_tail();
+    void compact();
+    void free_chunks(uint64_t head);
+
+public:
+    // start a fresh index holding exactly `live_blks'.
+    RecoveryIndex(Ralloc* ral, int thd_num, const std::vector<PBlk*>& live_blks);
+    ~RecoveryIndex();
+
+    // if a valid index from a clean exit exists, distribute its blocks
+    // over `shards' and return true. The old index is freed either way.
+    static bool load(Ralloc* ral, std::vector<std::vector<PBlk*>>& shards);
+
+    // only the thread with EpochSys::tid == tid may log to tid.
+    inline void log_alloc(void* blk, int tid){
+        logs[tid].begin_append().push_back(to_entry(blk, false));
+        logs[tid].end_append();
+    }
+    inline void log_alloc_bulk(void* const* blks, size_t num, int tid){
+        std::vector<uint64_t>& entries = logs[tid].begin_append();
+        for (size_t i = 0; i < num; i++){
+            entries.push_back(to_entry(blks[i], false));
+        }
+        logs[tid].end_append();
+    }
+    inline void log_dealloc(void* blk, int tid){
+        logs[tid].begin_append().push_back(to_entry(blk, true));
+        logs[tid].end_append();
+    }
+
+    // drain per-thread logs into persistent chunks. skipped if another
+    // thread is checkpointing.
+    void checkpoint();
+
+    // final checkpoint on a clean exit; marks the index valid.
+    void close();
+};
+
+}
+
+#endif
@@ -4,19 +4,19 @@
 
 using namespace pds;
 
-void ThreadLocalFreedContainer::do_free(PBlk*& x, uint64_t c){
-    _esys->delete_pblk(x, c);
-}
 ThreadLocalFreedContainer::ThreadLocalFreedContainer(EpochSys* e, GlobalTestConfig* gtc): task_num(gtc->task_num){
     container = new VectorContainer<PBlk*>(gtc->task_num);
+    batches = new padded<std::vector<PBlk*>>[gtc->task_num];
     threadEpoch = new padded<uint64_t>[gtc->task_num];
     _esys = e;
+    init_counts(gtc->task_num);
     for(int i = 0; i < gtc->task_num; i++){
         threadEpoch[i] = INIT_EPOCH;
     }
 }
 ThreadLocalFreedContainer::~ThreadLocalFreedContainer(){
     delete container;
+    delete[] batches;
 }
 void ThreadLocalFreedContainer::free_on_new_epoch(uint64_t c){
     auto last_epoch = threadEpoch[EpochSys::tid].ui;
@@ -34,39 +34,52 @@ void ThreadLocalFreedContainer::register_free(PBlk* blk, uint64_t c){
     assert(blk!=nullptr);
     // container[c%4].ui->push(blk, EpochSys::tid);
     container->push(blk, EpochSys::tid, c);
+    count_registered(EpochSys::tid);
 }
 void ThreadLocalFreedContainer::help_free(uint64_t c){
     // do nothing. all frees should be done by worker threads.
 }
 void ThreadLocalFreedContainer::help_free_local(uint64_t c){
-    container->pop_all_local([&,this](PBlk*& x){this->do_free(x, c);}, EpochSys::tid, c);
+    auto& batch = batches[EpochSys::tid].ui;
+    container->pop_all_local([&](PBlk*& x){batch.push_back(x);}, EpochSys::tid, c);
+    count_freed(EpochSys::tid, batch.size());
+    _esys->delete_pblks(batch, c);
 }
 void ThreadLocalFreedContainer::clear(){
     container->clear();
 }
 
 
-void PerEpochFreedContainer::do_free(PBlk*& x, uint64_t c){
-    _esys->delete_pblk(x, c);
-}
 PerEpochFreedContainer::PerEpochFreedContainer(EpochSys* e, GlobalTestConfig* gtc){
     container = new VectorContainer<PBlk*>(gtc->task_num);
+    batches = new padded<std::vector<PBlk*>>[gtc->task_num];
     _esys = e;
+    init_counts(gtc->task_num);
     // container = new HashSetContainer<PBlk*>(gtc->task_num);
 }
 PerEpochFreedContainer::~PerEpochFreedContainer(){
     delete container;
+    delete[] batches;
 }
 void PerEpochFreedContainer::register_free(PBlk* blk, uint64_t c){
     assert(blk!=nullptr);
     // container[c%4].ui->push(blk, EpochSys::tid);
     container->push(blk, EpochSys::tid, c);
+    count_registered(EpochSys::tid);
 }
 void PerEpochFreedContainer::help_free(uint64_t c){
-    container->pop_all([&,this](PBlk*& x){this->do_free(x, c);}, c);
+    // may run on several advancing threads at once.
+    std::vector<PBlk*> batch;
+    container->pop_all([&](PBlk*& x){batch.push_back(x);}, c);
+    // freed_cnts are only summed up, so the slot doesn't matter.
+    count_freed(0, batch.size());
+    _esys->delete_pblks(batch, c);
 }
 void PerEpochFreedContainer::help_free_local(uint64_t c){
-    container->pop_all_local([&,this](PBlk*& x){this->do_free(x, c);}, EpochSys::tid, c);
+    auto& batch = batches[EpochSys::tid].ui;
+    container->pop_all_local([&](PBlk*& x){batch.push_back(x);}, EpochSys::tid, c);
+    count_freed(EpochSys::tid, batch.size());
+    _esys->delete_pblks(batch, c);
 }
 void PerEpochFreedContainer::clear(){
     container->clear();
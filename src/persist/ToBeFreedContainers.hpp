@@ -2,8 +2,10 @@
 #define TO_BE_FREED_CONTAINERS_HPP
 
 #include <cstdint>
+#include <vector>
 
 #include "TestConfig.hpp"
+#include "ConcurrentPrimitives.hpp"
 #include "PerThreadContainers.hpp"
 
 ///////////////////////////
@@ -16,22 +18,59 @@ class PBlk;
 class EpochSys;
 
 class ToBeFreedContainer{
+protected:
+    // per-thread counts of registered and freed blocks, for backlog().
+    int counted_task_num = 0;
+    paddedAtomic<uint64_t>* registered_cnts = nullptr;
+    paddedAtomic<uint64_t>* freed_cnts = nullptr;
+    void init_counts(int task_num){
+        counted_task_num = task_num;
+        registered_cnts = new paddedAtomic<uint64_t>[task_num];
+        freed_cnts = new paddedAtomic<uint64_t>[task_num];
+        for (int i = 0; i < task_num; i++){
+            registered_cnts[i].ui.store(0);
+            freed_cnts[i].ui.store(0);
+        }
+    }
+    inline void count_registered(int tid){
+        // only tid registers into its own buffer.
+        auto& cnt = registered_cnts[tid].ui;
+        cnt.store(cnt.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+    }
+    inline void count_freed(int tid, uint64_t n){
+        if (n > 0){
+            freed_cnts[tid].ui.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
 public:
     virtual void register_free(PBlk* blk, uint64_t c) {};
     virtual void help_free(uint64_t c) {};
     virtual void help_free_local(uint64_t c) {};
     virtual void clear() = 0;
     virtual void free_on_new_epoch(uint64_t c){};
-    virtual ~ToBeFreedContainer(){}
+    // approximate number of retired blocks not yet freed.
+    virtual uint64_t backlog(){
+        uint64_t registered = 0, freed = 0;
+        for (int i = 0; i < counted_task_num; i++){
+            registered += registered_cnts[i].ui.load(std::memory_order_relaxed);
+            freed += freed_cnts[i].ui.load(std::memory_order_relaxed);
+        }
+        return registered > freed ? registered - freed : 0;
+    }
+    virtual ~ToBeFreedContainer(){
+        delete[] registered_cnts;
+        delete[] freed_cnts;
+    }
 };
 
 class ThreadLocalFreedContainer : public ToBeFreedContainer{
     PerThreadContainer<PBlk*>* container = nullptr;
+    // blocks popped for freeing, handed to EpochSys::delete_pblks at once.
+    padded<std::vector<PBlk*>>* batches = nullptr;
     padded<uint64_t>* threadEpoch;
     padded<std::mutex>* locks = nullptr;
     int task_num;
     EpochSys* _esys = nullptr;
-    void do_free(PBlk*& x, uint64_t c);
 public:
     ThreadLocalFreedContainer(EpochSys* e):_esys(e){}
     ThreadLocalFreedContainer(EpochSys* e, GlobalTestConfig* gtc);
@@ -47,8 +86,8 @@ public:
 
 class PerEpochFreedContainer : public ToBeFreedContainer{
     PerThreadContainer<PBlk*>* container = nullptr;
+    padded<std::vector<PBlk*>>* batches = nullptr;
     EpochSys* _esys = nullptr;
-    void do_free(PBlk*& x, uint64_t c);
    public:
     PerEpochFreedContainer(EpochSys* e):_esys(e){
         // errexit("DO NOT USE DEFAULT CONSTRUCTOR OF ToBeFreedContainer");
@@ -1,8 +1,15 @@
 #include "ToBePersistedContainers.hpp"
 #include "EpochSys.hpp"
 
+#include <algorithm>
+
 using namespace pds;
 
+bool NtStore::enabled = false;
+size_t NtStore::threshold = 256;
+char* NtStore::heap_begin = nullptr;
+char* NtStore::heap_end = nullptr;
+
 void rebuild_affinity(GlobalTestConfig* gtc, std::vector<hwloc_obj_t>& persister_affinities){
     // re-build worker thread affinity that pin current threads to individual cores
     // build affinities that pin persisters to hyperthreads of worker threads
@@ -161,7 +168,7 @@ void ToBePersistContainer::do_persist_desc_local(uint64_t c, int tid) {
     void* blk = descs_p[tid].ui;
     if (blk){
         bool t = true;
-        persist_func::clwb_range_nofence(blk, ral->malloc_size(blk));
+        persist_func::clwb_range_nofence(blk, malloc_size(blk));
         desc_persist_indicators[c%EPOCH_WINDOW][tid].ui.compare_exchange_strong(t, false);
     }
 }
@@ -171,16 +178,21 @@ void BufferedWB::do_persist(void*& addr) {
         persist_func::clwb(unmark_raw(addr));
     } else {
         persist_func::clwb_range_nofence(
-            addr, ral->malloc_size(addr));
+            addr, malloc_size(addr));
     }
 }
+void BufferedWB::count_push(){
+    // single writer; no need for a lock-prefixed increment.
+    auto& cnt = push_counts[EpochSys::tid].ui;
+    cnt.store(cnt.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+}
 void BufferedWB::register_persist(PBlk* blk, uint64_t c){
     assert(blk!=nullptr);
     if (c == NULL_EPOCH){
         errexit("registering persist of epoch NULL.");
     }
     container->push(blk, [&](void*& addr){do_persist(addr);}, EpochSys::tid, c);
-    
+    count_push();
 }
 void BufferedWB::register_persist_raw(PBlk* blk, uint64_t c){
     assert(blk!=nullptr);
@@ -188,6 +200,7 @@ void BufferedWB::register_persist_raw(PBlk* blk, uint64_t c){
         errexit("registering persist of epoch NULL.");
     }
     container->push(mark_raw(blk), [&](void*& addr){do_persist(addr);}, EpochSys::tid, c);
+    count_push();
 }
 void BufferedWB::persist_epoch(uint64_t c){ // NOTE: this is not thread-safe.
     // for (int i = 0; i < task_num; i++){
@@ -202,6 +215,184 @@ void BufferedWB::persist_epoch_local(uint64_t c, int tid){
     container->pop_all_local([&](void*& addr){do_persist(addr);}, tid, c);
     do_persist_desc_local(c, tid);
 }
+double BufferedWB::buffer_load(){
+    // only called by the epoch advancer.
+    uint64_t total = 0;
+    for (int i = 0; i < task_num; i++){
+        total += push_counts[i].ui.load(std::memory_order_relaxed);
+    }
+    double ret = (double)(total - last_push_total) / ((double)task_num * buffer_size);
+    last_push_total = total;
+    return ret;
+}
 void BufferedWB::clear(){
     container->clear();
-}
\ No newline at end of file
+}
+NtWB::NtWB(GlobalTestConfig* _gtc, Ralloc* r) : BufferedWB(_gtc, r){
+    void* start = nullptr;
+    void* end = nullptr;
+    // the whole reservation, as the region grows after this
+    if (r->region_reserve(SB_IDX, &start, &end)){
+        errexit("unable to locate the superblock region for NtWB.");
+    }
+    if (_gtc->checkEnv("NtStoreThreshold")){
+        NtStore::threshold = stoull(_gtc->getEnv("NtStoreThreshold"));
+    }
+    NtStore::heap_begin = (char*)start;
+    NtStore::heap_end = (char*)end;
+    NtStore::enabled = true;
+}
+NtWB::~NtWB(){
+    NtStore::enabled = false;
+}
+
+LineWB::LineWB(GlobalTestConfig* _gtc, Ralloc* r) :
+    ToBePersistContainer(r, _gtc->task_num), gtc(_gtc){
+    if (gtc->checkEnv("LineBufferSize")){
+        line_cap = stoull(gtc->getEnv("LineBufferSize"));
+    }
+    for (int i = 0; i < EPOCH_WINDOW; i++){
+        sets[i] = new FixedLineSet*[task_num];
+        for (int j = 0; j < task_num; j++){
+            sets[i][j] = new FixedLineSet(line_cap);
+        }
+    }
+    line_cap = sets[0][0]->capacity();
+    registered = new paddedAtomic<uint64_t>[task_num];
+    inserted = new paddedAtomic<uint64_t>[task_num];
+    evicted = new paddedAtomic<uint64_t>[task_num];
+    for (int i = 0; i < task_num; i++){
+        registered[i].ui.store(0);
+        inserted[i].ui.store(0);
+        evicted[i].ui.store(0);
+    }
+    drained.store(0);
+}
+LineWB::~LineWB(){
+    if (gtc->verbose){
+        uint64_t reg = 0, evi = 0;
+        for (int i = 0; i < task_num; i++){
+            reg += registered[i].ui.load();
+            evi += evicted[i].ui.load();
+        }
+        std::cout<<"LineWB: "<<reg<<" lines registered, "<<
+            drained.load()+evi<<" written back ("<<evi<<" evicted), "<<
+            "flush amplification "<<flush_amplification()<<std::endl;
+    }
+    for (int i = 0; i < EPOCH_WINDOW; i++){
+        for (int j = 0; j < task_num; j++){
+            delete sets[i][j];
+        }
+        delete[] sets[i];
+    }
+    delete[] registered;
+    delete[] inserted;
+    delete[] evicted;
+}
+void LineWB::register_range(void* addr, size_t sz, uint64_t c){
+    if (c == NULL_EPOCH){
+        errexit("registering persist of epoch NULL.");
+    }
+    int tid = EpochSys::tid;
+    FixedLineSet* set = sets[c%EPOCH_WINDOW][tid];
+    uint64_t line = (uint64_t)addr & ~(uint64_t)CACHE_LINE_MASK;
+    uint64_t last = ((uint64_t)addr + sz - 1) & ~(uint64_t)CACHE_LINE_MASK;
+    uint64_t ins = 0, evi = 0;
+    for (; line <= last; line += CACHE_LINE_SIZE){
+        ins += set->push(line, [&](uint64_t old){
+            persist_func::clwb((void*)old);
+            evi++;
+        });
+    }
+    // single writer; no need for lock-prefixed increments.
+    auto inc = [](std::atomic<uint64_t>& cnt, uint64_t n){
+        cnt.store(cnt.load(std::memory_order_relaxed)+n, std::memory_order_relaxed);
+    };
+    inc(registered[tid].ui, (last - ((uint64_t)addr & ~(uint64_t)CACHE_LINE_MASK))/CACHE_LINE_SIZE + 1);
+    if (ins){
+        inc(inserted[tid].ui, ins);
+    }
+    if (evi){
+        inc(evicted[tid].ui, evi);
+    }
+}
+void LineWB::register_persist(PBlk* blk, uint64_t c){
+    assert(blk!=nullptr);
+    register_range(blk, malloc_size(blk), c);
+}
+void LineWB::register_persist_raw(PBlk* blk, uint64_t c){
+    assert(blk!=nullptr);
+    register_range(blk, 1, c);
+}
+void LineWB::write_back(std::vector<uint64_t>& lines){
+    std::sort(lines.begin(), lines.end());
+    lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    for (uint64_t line : lines){
+        persist_func::clwb((void*)line);
+    }
+    drained.fetch_add(lines.size(), std::memory_order_relaxed);
+}
+void LineWB::persist_epoch(uint64_t c){
+    static thread_local std::vector<uint64_t> lines;
+    static thread_local std::vector<uint64_t> sorted;
+    static thread_local std::vector<size_t> ends;
+    FixedLineSet** epoch_sets = sets[c%EPOCH_WINDOW];
+    // gather lines of all threads first, so that lines shared by threads
+    // are written back once and the whole epoch goes in address order.
+    for (int i = 0; i < task_num; i++){
+        epoch_sets[i]->collect(lines);
+        ends.push_back(lines.size());
+    }
+    sorted = lines;
+    write_back(sorted);
+    size_t begin = 0;
+    for (int i = 0; i < task_num; i++){
+        for (; begin < ends[i]; begin++){
+            epoch_sets[i]->remove(lines[begin]);
+        }
+    }
+    lines.clear();
+    sorted.clear();
+    ends.clear();
+    for (int i = 0; i < task_num; i++){
+        do_persist_desc_local(c, i);
+    }
+}
+void LineWB::persist_epoch_local(uint64_t c, int tid){
+    static thread_local std::vector<uint64_t> lines;
+    FixedLineSet* set = sets[c%EPOCH_WINDOW][tid];
+    set->collect(lines);
+    if (!lines.empty()){
+        write_back(lines);
+        for (uint64_t line : lines){
+            set->remove(line);
+        }
+        lines.clear();
+    }
+    do_persist_desc_local(c, tid);
+}
+double LineWB::buffer_load(){
+    // only called by the epoch advancer.
+    uint64_t total = 0;
+    for (int i = 0; i < task_num; i++){
+        total += inserted[i].ui.load(std::memory_order_relaxed);
+    }
+    double ret = (double)(total - last_insert_total) / ((double)task_num * line_cap);
+    last_insert_total = total;
+    return ret;
+}
+double LineWB::flush_amplification(){
+    uint64_t reg = 0, written = drained.load();
+    for (int i = 0; i < task_num; i++){
+        reg += registered[i].ui.load(std::memory_order_relaxed);
+        written += evicted[i].ui.load(std::memory_order_relaxed);
+    }
+    return reg == 0 ? 0 : (double)written / reg;
+}
+void LineWB::clear(){
+    for (int i = 0; i < EPOCH_WINDOW; i++){
+        for (int j = 0; j < task_num; j++){
+            sets[i][j]->clear();
+        }
+    }
+}
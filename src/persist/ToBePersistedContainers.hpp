@@ -26,6 +26,34 @@ class EpochSys;
 //     }
 // };
 
+// Non-temporal payload copies, turned on by the NtWB strategy. Copies of
+// at least `threshold' bytes into the persistent heap bypass the cache,
+// which saves reading the lines in before writing them back.
+struct NtStore{
+    static bool enabled;
+    static size_t threshold;
+    static char* heap_begin;
+    static char* heap_end;
+    static inline void copy(void* dst, const void* src, size_t sz){
+        if (enabled && sz >= threshold &&
+            (char*)dst >= heap_begin && (char*)dst < heap_end){
+            persist_func::nt_memcpy_nofence(dst, src, sz);
+        } else {
+            memcpy(dst, src, sz);
+        }
+    }
+};
+
+// the heap holding blk: `ral', or one of per-socket heaps with NumaHeaps.
+inline Ralloc* heap_of(Ralloc* ral, const std::vector<Ralloc*>& socket_rals, void* blk){
+    for (Ralloc* r : socket_rals){
+        if (r->in_range(blk)){
+            return r;
+        }
+    }
+    return ral;
+}
+
 //////////////////////////////
 // To-be-persist Containers //
 //////////////////////////////
@@ -33,6 +61,8 @@ class EpochSys;
 class ToBePersistContainer{
 public:
     Ralloc* ral = nullptr;
+    // heaps of all sockets with NumaHeaps; empty otherwise.
+    std::vector<Ralloc*> socket_rals;
     int task_num = -1;
     padded<void*>* descs_p = nullptr;
     paddedAtomic<bool>* desc_persist_indicators[EPOCH_WINDOW];
@@ -44,7 +74,13 @@ public:
     virtual void persist_epoch(uint64_t c) = 0;
     virtual void persist_epoch_local(uint64_t c, int tid) = 0;
     virtual void help_persist_external(uint64_t c) {}
+    // blocks registered since the last call, relative to the total buffer
+    // capacity. >1 means buffers overflowed. for adaptive epoch length.
+    virtual double buffer_load() {return 0;}
     virtual void clear() = 0;
+    inline size_t malloc_size(void* blk){
+        return heap_of(ral, socket_rals, blk)->malloc_size(blk);
+    }
     ToBePersistContainer(Ralloc* r, int tn): ral(r), task_num(tn){
         descs_p = new padded<void*>[task_num];
         for (int i = 0; i < EPOCH_WINDOW; i++){
@@ -74,11 +110,11 @@ public:
     void register_persist_desc_local(uint64_t c, int tid) {
         void* blk = descs_p[tid].ui;
         persist_func::clwb_range_nofence(
-            blk, ral->malloc_size(blk));
+            blk, malloc_size(blk));
     }
     void register_persist(PBlk* blk, uint64_t c){
         assert(blk!=nullptr);
-        persist_func::clwb_range_nofence(blk, ral->malloc_size(blk));
+        persist_func::clwb_range_nofence(blk, malloc_size(blk));
     }
     void register_persist_raw(PBlk* blk, uint64_t c){
         persist_func::clwb(blk);
@@ -149,7 +185,11 @@ class BufferedWB : public ToBePersistContainer{
     GlobalTestConfig* gtc;
     // Persister* persister = nullptr;
     int buffer_size = 64;
+    // per-thread count of registered blocks, read by the epoch advancer.
+    paddedAtomic<uint64_t>* push_counts = nullptr;
+    uint64_t last_push_total = 0;
     void do_persist(void*& addr);
+    void count_push();
     // void dump(uint64_t c);
 public:
     BufferedWB (GlobalTestConfig* _gtc, Ralloc* r): 
@@ -172,6 +212,10 @@ public:
         } else {
             container = new FixedCircBufferContainer<void*>(task_num, buffer_size);
         }
+        push_counts = new paddedAtomic<uint64_t>[task_num];
+        for (int i = 0; i < task_num; i++){
+            push_counts[i].ui.store(0);
+        }
         
         // if (gtc->checkEnv("Persister")){
         //     std::string env_persister = gtc->getEnv("Persister");
@@ -192,6 +236,7 @@ public:
     }
     ~BufferedWB(){
         delete container;
+        delete[] push_counts;
         // delete persister;
     }
     inline void* mark_raw(void* ptr) {return (void*)((uint64_t)ptr | 0x1ULL);}
@@ -201,9 +246,54 @@ public:
     void register_persist_raw(PBlk* blk, uint64_t c);
     void persist_epoch(uint64_t c);
     void persist_epoch_local(uint64_t c, int tid);
+    double buffer_load();
     void clear();
 };
 
+// Keep to-be-persisted cache lines rather than blocks. Lines registered
+// repeatedly within an epoch (e.g., hot keys) are written back once, and
+// at the end of an epoch lines are sorted by address before write-back,
+// so adjacent small blocks in a superblock are written sequentially.
+// Lines evicted by collisions in the per-thread sets are written back
+// right away.
+class LineWB : public ToBePersistContainer{
+    GlobalTestConfig* gtc;
+    size_t line_cap = 4096;
+    FixedLineSet** sets[EPOCH_WINDOW];
+    // per-thread counts, written only by the owner.
+    paddedAtomic<uint64_t>* registered = nullptr;
+    paddedAtomic<uint64_t>* inserted = nullptr;
+    paddedAtomic<uint64_t>* evicted = nullptr;
+    // lines written back at epoch ends.
+    std::atomic<uint64_t> drained;
+    uint64_t last_insert_total = 0;
+    void register_range(void* addr, size_t sz, uint64_t c);
+    // sort, dedup, and write back lines.
+    void write_back(std::vector<uint64_t>& lines);
+public:
+    LineWB(GlobalTestConfig* _gtc, Ralloc* r);
+    ~LineWB();
+    void register_persist(PBlk* blk, uint64_t c);
+    void register_persist_raw(PBlk* blk, uint64_t c);
+    void persist_epoch(uint64_t c);
+    void persist_epoch_local(uint64_t c, int tid);
+    double buffer_load();
+    void clear();
+    // cache lines written back per line registered so far. below 1 when
+    // repeated registrations are absorbed.
+    double flush_amplification();
+};
+
+// BufferedWB, with large payload copies done by non-temporal stores.
+// Write-backs of those lines find them out of cache and cost little.
+// No extra fence: the stores are ordered by the seq_cst store (or
+// lock-prefixed RMW) in end_transaction, like the write-backs are.
+class NtWB : public BufferedWB{
+public:
+    NtWB(GlobalTestConfig* _gtc, Ralloc* r);
+    ~NtWB();
+};
+
 class NoToBePersistContainer : public ToBePersistContainer{
     // a to-be-persist container that does absolutely nothing.
     void init_desc_local(void* addr, int tid){}
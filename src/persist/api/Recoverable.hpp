@@ -67,7 +67,7 @@ class Recoverable{
     // pending retires; each pair is <original payload, anti-payload>
     padded<std::vector<pair<pds::PBlk*,pds::PBlk*>>>* pending_retires = nullptr;
     // pointer to recovered PBlks from EpochSys
-    std::unordered_map<uint64_t, pds::PBlk *>* recovered_pblks = nullptr;
+    pds::RecoveredPBlks* recovered_pblks = nullptr;
     // count of last recovered PBlks from EpochSys
     uint64_t last_recovered_cnt = 0;
 public:
@@ -106,8 +106,11 @@ public:
         }
         assert(epochs[pds::EpochSys::tid].ui != NULL_EPOCH);
     }
-    void end_op(){
+    // returns a durability ticket for the operation: its effects survive
+    // a crash once is_durable(ticket).
+    uint64_t end_op(){
         assert(epochs[pds::EpochSys::tid].ui != NULL_EPOCH);
+        uint64_t ticket = epochs[pds::EpochSys::tid].ui;
         if (!pending_retires[pds::EpochSys::tid].ui.empty()){
             for(const auto& r : pending_retires[pds::EpochSys::tid].ui){
                 // for nbEpochSys, link anti-node to payload
@@ -123,6 +126,7 @@ public:
         }
         if(!pending_allocs[pds::EpochSys::tid].ui.empty()) 
             pending_allocs[pds::EpochSys::tid].ui.clear();
+        return ticket;
     }
     void end_readonly_op(){
         assert(epochs[pds::EpochSys::tid].ui != NULL_EPOCH);
@@ -191,6 +195,37 @@ public:
         }
         return ret;
     }
+    // allocate n blocks of sz bytes into out in one go, e.g., for bulk
+    // loads. equivalent to n pmalloc's.
+    void pmalloc_bulk(size_t sz, size_t n, pds::PBlk** out)
+    {
+        _esys->malloc_pblk_bulk(sz, n, (void**)out);
+        register_alloc_pblks(out, n);
+    }
+    // allocate and construct n T's into out in one go. equivalent to n
+    // pnew's with the same args.
+    template <typename T, typename... Types>
+    void pnew_bulk(size_t n, T** out, Types... args)
+    {
+        ASSERT_DERIVE(T, pds::PBlk);
+        _esys->malloc_pblk_bulk(pds::pblk_size_of<T>(0, args...), n, (void**)out);
+        for (size_t i = 0; i < n; i++){
+            new (out[i]) T (args...);
+        }
+        register_alloc_pblks(out, n);
+    }
+    template <typename T>
+    void register_alloc_pblks(T** blks, size_t n){
+        uint64_t c = epochs[pds::EpochSys::tid].ui;
+        if (c == NULL_EPOCH){
+            pending_allocs[pds::EpochSys::tid].ui.insert(
+                pending_allocs[pds::EpochSys::tid].ui.end(), blks, blks + n);
+        } else {
+            for (size_t i = 0; i < n; i++){
+                _esys->register_alloc_pblk(blks[i], c);
+            }
+        }
+    }
 
     template<typename T>
     void register_update_pblk(T* b){
@@ -291,7 +326,12 @@ public:
         assert(epochs[pds::EpochSys::tid].ui != NULL_EPOCH);
         return _esys->openwrite_pblk(b, epochs[pds::EpochSys::tid].ui);
     }
-    std::unordered_map<uint64_t, pds::PBlk*>* get_recovered_pblks(){
+    template<typename T, typename... Types>
+    T* reopen_pblk(T* b, const Types&... args){
+        assert(epochs[pds::EpochSys::tid].ui != NULL_EPOCH);
+        return _esys->reopen_pblk(b, epochs[pds::EpochSys::tid].ui, args...);
+    }
+    pds::RecoveredPBlks* get_recovered_pblks(){
         return recovered_pblks;
     }
     uint64_t get_last_recovered_cnt() {
@@ -301,6 +341,25 @@ public:
         assert(epochs[pds::EpochSys::tid].ui == NULL_EPOCH);
         _esys->sync();
     }
+    // ticket of the last operation of this thread, e.g., one ended by
+    // BEGIN_OP_AUTOEND going out of scope.
+    uint64_t last_ticket(){
+        return _esys->get_last_epoch();
+    }
+    bool is_durable(uint64_t ticket){
+        return _esys->get_persisted_frontier() >= ticket;
+    }
+    void wait_durable(uint64_t ticket){
+        assert(epochs[pds::EpochSys::tid].ui == NULL_EPOCH);
+        if (!is_durable(ticket)){
+            _esys->sync(ticket);
+        }
+    }
+    // cb runs on whichever thread finds the ticket durable; see
+    // EpochSys::on_durable.
+    void on_durable(uint64_t ticket, std::function<void()> cb){
+        _esys->on_durable(ticket, std::move(cb));
+    }
     void recover_mode(){
         _esys->sys_mode = pds::RECOVER; // PDELETE -> nop
     }
@@ -429,6 +488,12 @@ namespace pds{
         }
     }
 
+    template<typename T>
+    lin_var atomic_lin_var<T>::load_versioned(Recoverable* ds){
+        // unlike load(), don't count this read as an update
+        return var.load();
+    }
+
     template<typename T>
     lin_var atomic_lin_var<T>::load_verify(Recoverable* ds){
         assert(ds->get_local_epoch() != NULL_EPOCH);
@@ -530,6 +595,19 @@ namespace pds{
         return (T)r.val;
     }
 
+    template<typename T>
+    lin_var atomic_lin_var<T>::load_versioned(Recoverable* ds){
+        lin_var r;
+        do { 
+            r = var.load();
+            if(r.is_desc()) {
+                sc_desc_t* D = r.get_desc();
+                D->try_complete(ds, reinterpret_cast<uint64_t>(this));
+            }
+        } while(r.is_desc());
+        return r;
+    }
+
     template<typename T>
     T atomic_lin_var<T>::load_verify(Recoverable* ds){
         // invisible read doesn't need to verify epoch even if it's a
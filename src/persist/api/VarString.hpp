@@ -0,0 +1,168 @@
+#ifndef VARSTRING_HPP
+#define VARSTRING_HPP
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "Recoverable.hpp"
+
+namespace pds{
+
+// read-only view of a string stored in a PBlk. Like InPlaceString, it
+// compares with and converts to std::string.
+class VarStringRef{
+    const char* data_;
+    size_t size_;
+public:
+    VarStringRef(const char* d, size_t s) : data_(d), size_(s){}
+    const char* data() const {
+        return data_;
+    }
+    size_t size() const {
+        return size_;
+    }
+    std::string_view view() const {
+        return std::string_view(data_, size_);
+    }
+    std::string std_str() const {
+        return std::string(data_, size_);
+    }
+    operator std::string() const {
+        return std_str();
+    }
+    int compare(const std::string& s) const {
+        return view().compare(s);
+    }
+    friend bool operator == (const VarStringRef& a, const std::string& b){
+        return a.view() == b;
+    }
+    friend bool operator == (const std::string& a, const VarStringRef& b){
+        return b == a;
+    }
+    friend bool operator != (const VarStringRef& a, const std::string& b){
+        return !(a == b);
+    }
+    friend bool operator != (const std::string& a, const VarStringRef& b){
+        return !(b == a);
+    }
+    friend bool operator < (const VarStringRef& a, const std::string& b){
+        return a.view() < b;
+    }
+    friend bool operator < (const std::string& a, const VarStringRef& b){
+        return a < b.view();
+    }
+    friend bool operator > (const VarStringRef& a, const std::string& b){
+        return b < a;
+    }
+    friend bool operator > (const std::string& a, const VarStringRef& b){
+        return b < a;
+    }
+    friend bool operator <= (const VarStringRef& a, const std::string& b){
+        return !(a > b);
+    }
+    friend bool operator <= (const std::string& a, const VarStringRef& b){
+        return !(a > b);
+    }
+    friend bool operator >= (const VarStringRef& a, const std::string& b){
+        return !(a < b);
+    }
+    friend bool operator >= (const std::string& a, const VarStringRef& b){
+        return !(a < b);
+    }
+};
+
+/*
+ * Payload with a string key and a string value stored inline after
+ * their lengths, in a block allocated to fit them (see pblk_size()), so
+ * that heap usage and flushes follow the real lengths rather than
+ * TESTS_KEY_SIZE and TESTS_VAL_SIZE. Large values simply get a large
+ * Ralloc block.
+ *
+ * T is the derived payload type. It gets the accessors GENERATE_FIELD
+ * would generate for fields key and val; set_val() returns a new block
+ * when the value grows.
+ */
+template<class T>
+class VarKVPayload : public PBlk{
+    uint32_t key_size;
+    uint32_t val_size;
+
+    char* bytes(){
+        return reinterpret_cast<char*>(this) + sizeof(T);
+    }
+    const char* bytes() const {
+        return reinterpret_cast<const char*>(this) + sizeof(T);
+    }
+    void init(const char* k, size_t ks, const char* v, size_t vs){
+        assert(ks <= UINT32_MAX && vs <= UINT32_MAX);
+        key_size = ks;
+        val_size = vs;
+        NtStore::copy(bytes(), k, ks);
+        NtStore::copy(bytes()+ks, v, vs);
+    }
+    VarStringRef key() const {
+        return VarStringRef(bytes(), key_size);
+    }
+    VarStringRef val() const {
+        return VarStringRef(bytes()+key_size, val_size);
+    }
+    // members of T aren't accessible here through a T*
+    static const VarKVPayload* base(const T* p){
+        return p;
+    }
+public:
+    VarKVPayload(const std::string& k, const std::string& v){
+        init(k.data(), k.size(), v.data(), v.size());
+    }
+    // for a new version with a different value; see set_val().
+    VarKVPayload(const VarStringRef& k, const std::string& v){
+        init(k.data(), k.size(), v.data(), v.size());
+    }
+    VarKVPayload(const VarKVPayload& oth) : PBlk(oth){
+        init(oth.bytes(), oth.key_size, oth.bytes()+oth.key_size, oth.val_size);
+    }
+    static size_t pblk_size(const std::string& k, const std::string& v){
+        return sizeof(T) + k.size() + v.size();
+    }
+    static size_t pblk_size(const VarStringRef& k, const std::string& v){
+        return sizeof(T) + k.size() + v.size();
+    }
+    static size_t pblk_size(const T& oth){
+        return sizeof(T) + base(&oth)->key_size + base(&oth)->val_size;
+    }
+    void persist(){}
+
+    VarStringRef get_key(Recoverable* ds) const {
+        return base(ds->openread_pblk(static_cast<const T*>(this)))->key();
+    }
+    VarStringRef get_unsafe_key(Recoverable* ds) const {
+        return base(ds->openread_pblk_unsafe(static_cast<const T*>(this)))->key();
+    }
+    VarStringRef get_val(Recoverable* ds) const {
+        return base(ds->openread_pblk(static_cast<const T*>(this)))->val();
+    }
+    VarStringRef get_unsafe_val(Recoverable* ds) const {
+        return base(ds->openread_pblk_unsafe(static_cast<const T*>(this)))->val();
+    }
+    // values that fit in the old one are written in place, or in a copy
+    // if the block is from an older epoch.
+    T* set_val(Recoverable* ds, const std::string& v){
+        assert(ds->get_local_epoch() != NULL_EPOCH);
+        T* ret;
+        if (v.size() <= val_size){
+            ret = ds->openwrite_pblk(static_cast<T*>(this));
+            VarKVPayload* r = ret;
+            r->val_size = v.size();
+            NtStore::copy(r->bytes()+r->key_size, v.data(), v.size());
+        } else {
+            ret = ds->reopen_pblk(static_cast<T*>(this), key(), v);
+        }
+        ds->register_update_pblk(ret);
+        return ret;
+    }
+};
+
+} // namespace pds
+
+#endif
@@ -50,6 +50,7 @@ namespace pds{
 
     // end current operation by reducing transaction count of our epoch.
     // if our operation is already aborted, do nothing.
+    // evaluates to a durability ticket of the operation.
     #define END_OP ({\
         global_recoverable->end_op();})
 
@@ -74,6 +75,9 @@ namespace pds{
     #define PNEW(t, ...) ({\
         global_recoverable->pnew<t>(__VA_ARGS__);})
 
+    #define PNEW_BULK(t, n, out, ...) ({\
+        global_recoverable->pnew_bulk<t>(n, out, ##__VA_ARGS__);})
+
     #define PDELETE(b) ({\
         global_recoverable->pdelete(b);})
 
@@ -103,7 +107,7 @@ namespace pds{
     //         delete(b);
     //     }})
 
-    inline std::unordered_map<uint64_t, PBlk*>* get_recovered_pblks(){
+    inline RecoveredPBlks* get_recovered_pblks(){
         return global_recoverable->get_recovered_pblks();
     }
 
@@ -111,6 +115,24 @@ namespace pds{
         global_recoverable->flush();
     }
 
+    // durability tickets, as returned by END_OP: poll, block on, or get
+    // called back when an operation persists.
+    inline uint64_t last_ticket(){
+        return global_recoverable->last_ticket();
+    }
+
+    inline bool is_durable(uint64_t ticket){
+        return global_recoverable->is_durable(ticket);
+    }
+
+    inline void wait_durable(uint64_t ticket){
+        global_recoverable->wait_durable(ticket);
+    }
+
+    inline void on_durable(uint64_t ticket, std::function<void()> cb){
+        global_recoverable->on_durable(ticket, std::move(cb));
+    }
+
     inline void recover_mode(){
         global_recoverable->recover_mode();
     }
@@ -416,6 +416,69 @@ public:
     }
 };
 
+// Single-producer multiple-consumer fixed-sized set of cache lines,
+// keyed by line address. Pushing a present line is a no-op; pushing a
+// line into an occupied slot hands the old line to `evict' first.
+// Consumers collect lines, write them back, and only then remove them,
+// so a concurrent consumer never returns before lines are written back.
+class FixedLineSet{
+    size_t cap;
+    int shift;
+    std::atomic<uint64_t>* lines = nullptr;
+    inline size_t slot(uint64_t line){
+        return (size_t)((line * 0x9E3779B97F4A7C15ULL) >> shift);
+    }
+public:
+    FixedLineSet(size_t cap_){
+        cap = 2;
+        shift = 63;
+        while (cap < cap_){
+            cap <<= 1;
+            shift--;
+        }
+        lines = new std::atomic<uint64_t>[cap];
+        clear();
+    }
+    ~FixedLineSet(){
+        delete[] lines;
+    }
+    size_t capacity(){
+        return cap;
+    }
+    // return true if the line is newly inserted.
+    template<typename F>
+    bool push(uint64_t line, F&& evict){
+        assert(line != 0);
+        size_t idx = slot(line);
+        uint64_t exp = lines[idx].load(std::memory_order_relaxed);
+        if (exp == line){
+            return false;
+        }
+        if (exp != 0){
+            evict(exp);
+        }
+        lines[idx].store(line, std::memory_order_release);
+        return true;
+    }
+    void collect(std::vector<uint64_t>& out){
+        for (size_t i = 0; i < cap; i++){
+            uint64_t line = lines[i].load(std::memory_order_acquire);
+            if (line != 0){
+                out.push_back(line);
+            }
+        }
+    }
+    void remove(uint64_t line){
+        size_t idx = slot(line);
+        lines[idx].compare_exchange_strong(line, 0, std::memory_order_acq_rel);
+    }
+    void clear(){
+        for (size_t i = 0; i < cap; i++){
+            lines[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
 // a group of per-thread circular buffer
 // NOTE: this is designed for single-consumer pattern only. The container is NOT thread safe.
 template<typename T>
@@ -148,24 +148,37 @@ class MontageGraph : public RGraph, public Recoverable{
             }
             if(gtc->verbose) std::cout << "Filled vertexLoad" << std::endl;
 
-            // Fill to mean edges per vertex
+            // Fill to mean edges per vertex, allocating the relations of
+            // each vertex in bulk
+            std::vector<int> dests;
+            std::vector<Relation*> rels;
             for (int i = 0; i < numVertices; i++) {
                 if (vMeta[i].idxToVertex == nullptr) continue;
+                dests.clear();
                 for (int j = 0; j < meanEdgesPerVertex * 100 / vertexLoad; j++) {
                     int k = verticesRNG(gen);
                     if (k == i) {
                         continue;
                     }
                     if (vMeta[k].idxToVertex != nullptr) {
-                        Relation *r = pnew<Relation>(i, k, -1);
-                        auto p = make_pair(i,k);
-                        auto ret1 = source(i).emplace(p,r);
-                        auto ret2 = destination(k).emplace(p,r);
-                        assert(ret1.second==ret2.second);
-                        if(ret1.second==false){
-                            // relation exists, reclaiming
-                            pdelete(r);
-                        }
+                        dests.push_back(k);
+                    }
+                }
+                rels.resize(dests.size());
+                pnew_bulk<Relation>(dests.size(), rels.data());
+                for (size_t j = 0; j < dests.size(); j++) {
+                    int k = dests[j];
+                    Relation *r = rels[j];
+                    r->set_unsafe_src(this, i);
+                    r->set_unsafe_dest(this, k);
+                    r->set_unsafe_weight(this, -1);
+                    auto p = make_pair(i,k);
+                    auto ret1 = source(i).emplace(p,r);
+                    auto ret2 = destination(k).emplace(p,r);
+                    assert(ret1.second==ret2.second);
+                    if(ret1.second==false){
+                        // relation exists, reclaiming
+                        pdelete(r);
                     }
                 }
             }
@@ -348,48 +361,11 @@ class MontageGraph : public RGraph, public Recoverable{
                 vertex(i) = nullptr;
             }
             int rec_thd = gtc->task_num; 
-            int block_cnt = 0;
-            std::unordered_map<uint64_t, pds::PBlk*>* recovered = get_recovered_pblks();
+            pds::RecoveredPBlks* recovered = get_recovered_pblks();
             assert(recovered);
+            int block_cnt = recovered->size();
             
             auto begin = chrono::high_resolution_clock::now();
-            std::vector<Relation*> relationVector;
-            std::vector<Vertex*> vertexVector;
-            {
-                MontageOpHolder _holder(this);
-                for (auto itr = recovered->begin(); itr != recovered->end(); ++itr) {
-                    // iterate through all recovered blocks.  Sort the blocks into vectors containing the different
-                    // payloads to be iterated over later.
-                    block_cnt ++;
-
-                    // Should these be parallel?  I'm not sure..
-                    BasePayload* b = reinterpret_cast<BasePayload*>(itr->second);
-
-                    switch (b->get_unsafe_tag(this)) {
-                        case 0: {
-                            Vertex* v = reinterpret_cast<Vertex*>(itr->second);
-                            vertexVector.push_back(v);
-                            break;
-                        }
-                        case 1: {
-                            Relation* r =
-                                reinterpret_cast<Relation*>(itr->second);
-                            relationVector.push_back(r);
-                            break;
-                        }
-                        default: {
-                            std::cerr << "Found bad tag "
-                                      << b->get_unsafe_tag(this) << std::endl;
-                        }
-                    }
-                }
-            }
-            auto end = chrono::high_resolution_clock::now();
-            auto dur = end - begin;
-            auto dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
-            std::cout << "Spent " << dur_ms << "ms gathering vertices(" << vertexVector.size() << ") and edges(" << relationVector.size() << ")..." << std::endl;
-            begin = chrono::high_resolution_clock::now();
-
             std::vector<std::thread> workers;
             pthread_barrier_t sync_point;
             pthread_barrier_init(&sync_point, NULL, rec_thd);
@@ -402,8 +378,30 @@ class MontageGraph : public RGraph, public Recoverable{
                     hwloc_set_cpubind(gtc->topology,
                                       gtc->affinities[rec_tid]->cpuset,
                                       HWLOC_CPUBIND_THREAD);
+                    // sort this thread's share of recovered blocks into
+                    // vertices and edges.
+                    std::vector<Vertex*> vertexVector;
+                    std::vector<Relation*> relationVector;
+                    recovered->for_each(rec_tid, rec_thd, [&](pds::PBlk* blk){
+                        BasePayload* b = reinterpret_cast<BasePayload*>(blk);
+                        switch (b->get_unsafe_tag(this)) {
+                            case 0: {
+                                vertexVector.push_back(reinterpret_cast<Vertex*>(blk));
+                                break;
+                            }
+                            case 1: {
+                                relationVector.push_back(reinterpret_cast<Relation*>(blk));
+                                break;
+                            }
+                            default: {
+                                std::cerr << "Found bad tag "
+                                          << b->get_unsafe_tag(this) << std::endl;
+                            }
+                        }
+                    });
+
                     // Recover vertexes:
-                    for (size_t i = rec_tid; i < vertexVector.size(); i += rec_thd){
+                    for (size_t i = 0; i < vertexVector.size(); i++){
                         int id = vertexVector[i]->get_unsafe_id(this);
                         if (vertex(id) != nullptr) {
                             std::cerr << "Somehow recovered vertex " << id
@@ -416,13 +414,12 @@ class MontageGraph : public RGraph, public Recoverable{
                 
                     pthread_barrier_wait(&sync_point);
                     if (rec_tid == 0){
-                        end = chrono::high_resolution_clock::now();
-                        dur = end - begin;
-                        dur_ms = std::chrono::duration_cast<
-                                     std::chrono::milliseconds>(dur)
-                                     .count();
+                        auto end = chrono::high_resolution_clock::now();
+                        auto dur_ms = std::chrono::duration_cast<
+                                          std::chrono::milliseconds>(end - begin)
+                                          .count();
                         std::cout << "Spent " << dur_ms
-                                  << "ms creating vertices..." << std::endl;
+                                  << "ms gathering and creating vertices..." << std::endl;
                         begin = chrono::high_resolution_clock::now();
                     }
 
@@ -433,8 +430,7 @@ class MontageGraph : public RGraph, public Recoverable{
                     // v belongs to thread t_i, t_i will add it to the source set of v; if v' belongs to
                     // thread t_i, t_i will add v' to the destination set of v'; if t_i does not own it, nothing happens
             
-                    for (size_t i = rec_tid; i < relationVector.size();
-                         i += rec_thd) {
+                    for (size_t i = 0; i < relationVector.size(); i++) {
                         Relation *e = relationVector[i];
                         int id1 = e->get_unsafe_src(this);
                         int id2 = e->get_unsafe_dest(this);
@@ -523,11 +519,9 @@ class MontageGraph : public RGraph, public Recoverable{
                 }
             }
 
-            end = chrono::high_resolution_clock::now();
-            dur = end - begin;
-            dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+            auto end = chrono::high_resolution_clock::now();
+            auto dur_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
             std::cout << "Spent " << dur_ms << "ms forming edges..." << std::endl;
-            begin = chrono::high_resolution_clock::now();
 
             return block_cnt;
 	}
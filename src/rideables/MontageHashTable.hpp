@@ -212,27 +212,15 @@ public:
 
 
     int recover(){
-        std::unordered_map<uint64_t, pds::PBlk*>* recovered = get_recovered_pblks();
+        pds::RecoveredPBlks* recovered = get_recovered_pblks();
         assert(recovered);
 
-        int rec_cnt = 0;
+        int rec_cnt = recovered->size();
         int rec_thd = gtc->task_num;
         if (gtc->checkEnv("RecoverThread")){
             rec_thd = stoi(gtc->getEnv("RecoverThread"));
         }
-        std::vector<Payload*> payloadVector;
-        payloadVector.reserve(recovered->size());
         auto begin = chrono::high_resolution_clock::now();
-        for (auto itr = recovered->begin(); itr != recovered->end(); itr++){
-            rec_cnt++;
-            Payload* payload = reinterpret_cast<Payload*>(itr->second);
-                        payloadVector.push_back(payload);
-        }
-        auto end = chrono::high_resolution_clock::now();
-        auto dur = end - begin;
-        auto dur_ms_vec = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
-        std::cout << "Spent " << dur_ms_vec << "ms building vector" << std::endl;
-        begin = chrono::high_resolution_clock::now();
         std::vector<std::thread> workers;
         for (int rec_tid = 0; rec_tid < rec_thd; rec_tid++) {
             workers.emplace_back(std::thread([&, rec_tid]() {
@@ -240,9 +228,9 @@ public:
                 hwloc_set_cpubind(gtc->topology,
                                   gtc->affinities[rec_tid]->cpuset,
                                   HWLOC_CPUBIND_THREAD);
-                for (size_t i = rec_tid; i < payloadVector.size(); i += rec_thd){
+                recovered->for_each(rec_tid, rec_thd, [&](pds::PBlk* blk){
                     //re-insert payload.
-                    ListNode* new_node = new ListNode(this, payloadVector[i]);
+                    ListNode* new_node = new ListNode(this, reinterpret_cast<Payload*>(blk));
                     K key = new_node->get_key();
                     size_t idx = hash_fn(key) % idxSize;
                     std::lock_guard<std::mutex> lk(buckets[idx].lock);
@@ -262,7 +250,7 @@ public:
                         }
                     }
                     prev->next = new_node;
-                }
+                });
             }));  // workers.emplace_back()
         }// for (rec_thd)
         for (auto& worker : workers) {
@@ -270,8 +258,8 @@ public:
                 worker.join();
             }
         }
-        end = chrono::high_resolution_clock::now();
-        dur = end - begin;
+        auto end = chrono::high_resolution_clock::now();
+        auto dur = end - begin;
         auto dur_ms_ins = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
         std::cout << "Spent " << dur_ms_ins << "ms inserting(" << recovered->size() << ")" << std::endl;
         return rec_cnt;
@@ -287,16 +275,11 @@ class MontageHashTableFactory : public RideableFactory{
 
 /* Specialization for strings */
 #include <string>
-#include "InPlaceString.hpp"
+#include "VarString.hpp"
 template <>
-class MontageHashTable<std::string, std::string, 1000000>::Payload : public pds::PBlk{
-    GENERATE_FIELD(pds::InPlaceString<TESTS_KEY_SIZE>, key, Payload);
-    GENERATE_FIELD(pds::InPlaceString<TESTS_VAL_SIZE>, val, Payload);
-
+class MontageHashTable<std::string, std::string, 1000000>::Payload : public pds::VarKVPayload<MontageHashTable<std::string, std::string, 1000000>::Payload>{
 public:
-    Payload(const std::string& k, const std::string& v) : m_key(this, k), m_val(this, v){}
-    Payload(const Payload& oth) : pds::PBlk(oth), m_key(this, oth.m_key), m_val(this, oth.m_val){}
-    void persist(){}
+    using VarKVPayload::VarKVPayload;
 };
 
 #endif
@@ -19,7 +19,17 @@
 #include "CustomTypes.hpp"
 #include "Recoverable.hpp"
 
-template <class K, class V, int idxSize=1000000>
+/*
+ * Lock-free hash table with a split-ordered list (Shalev and Shavit): all
+ * nodes are in a single list sorted by bit-reversed hash, and bucket i
+ * points to a dummy node that starts its part of the list. Doubling the
+ * bucket count is a single CAS; new buckets are split off their parents
+ * lazily, by the first operation to use them. Only the transient index
+ * grows; payloads never move.
+ *
+ * initSize: initial bucket count, rounded up to a power of 2.
+ */
+template <class K, class V, int initSize=1024>
 class MontageLfHashTable : public RMap<K,V>, public Recoverable{
 public:
     class Payload : public pds::PBlk{
@@ -45,12 +55,17 @@ private:
         MarkPtr next;
         Payload* payload;// TODO: does it have to be atomic?
         K key;
+        // position in the list; odd for real nodes, even for dummies
+        uint64_t so_key;
+        // dummies only: UNLINKED, LINKING by one thread, then LINKED
+        std::atomic<int> state;
         Node(MontageLfHashTable* ds_, K k, V v, Node* n):
-            ds(ds_),next(n),key(k){
+            ds(ds_),next(n),key(k),so_key(so_regular(ds->hash_fn(k))),state(0){
             payload = ds->pnew<Payload>(k,v);
             // assert(ds->epochs[pds::EpochSys::tid].ui == NULL_EPOCH);
             };
-        Node(MontageLfHashTable* ds_, Payload* _payload) : ds(ds_), payload(_payload),key(_payload->get_unsafe_key(ds)) {} // for recovery
+        Node(MontageLfHashTable* ds_, Payload* _payload) : ds(ds_), payload(_payload),key(_payload->get_unsafe_key(ds)),
+            so_key(so_regular(ds->hash_fn(key))),state(0) {} // for recovery
         K get_key(){
             return key;
         }
@@ -74,8 +89,47 @@ private:
         }
     }__attribute__((aligned(CACHELINE_SIZE)));
     std::hash<K> hash_fn;
-    padded<MarkPtr>* buckets=new padded<MarkPtr>[idxSize]{};
+    // average nodes per bucket before the bucket count doubles
+    static const int LOAD_FACTOR = 2;
+    // inserts of a thread between checks of the load
+    static const int64_t LOAD_CHECK_INTERVAL = 256;
+    static const uint64_t MAX_BUCKETS = 1ULL<<32;
+    // bucket b is in segment 64-clz(b), of 2^(seg-1) buckets (1 for
+    // segment 0), allocated when a bucket in it is first used. Segments
+    // hold the dummy nodes themselves, zeroed until linked.
+    enum DummyState {UNLINKED=0, LINKING, LINKED};
+    std::atomic<Node*> segments[64];
+    void* segments_raw[64];
+    std::atomic<uint64_t> bucket_num;
+    // nodes inserted minus removed, by thread
+    padded<std::atomic<int64_t>>* counts;
+
+    static inline uint64_t reverse_bits(uint64_t x){
+        x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+        x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+        x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+        return __builtin_bswap64(x);
+    }
+    static inline uint64_t so_regular(uint64_t h){
+        return reverse_bits(h | (1ULL<<63));
+    }
+    static inline uint64_t so_dummy(uint64_t b){
+        return reverse_bits(b);
+    }
+    Node* bucket_dummy(uint64_t b);
+    // dummy node to search bucket b from, splitting the bucket off its
+    // parent if needed. While another thread links the dummy, that of
+    // the parent bucket, which precedes it in the list, is used.
+    Node* get_bucket(uint64_t b, int tid);
+    void note_insert(int tid);
+    inline void note_remove(int tid){
+        counts[tid].ui.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void init_index();
+    void free_index();
     bool findNode(MarkPtr* &prev, Node* &curr, Node* &next, K key, int tid);
+    // find from head by so_key, and by key for real nodes (key != nullptr)
+    bool findNode(MarkPtr* head, MarkPtr* &prev, Node* &curr, Node* &next, uint64_t so_key, const K* key, int tid);
 
     RCUTracker tracker;
     GlobalTestConfig* gtc;
@@ -95,6 +149,8 @@ private:
     }
 public:
     MontageLfHashTable(GlobalTestConfig* gtc) : Recoverable(gtc), tracker(gtc->task_num, 100, 1000, true), gtc(gtc) {
+        counts = new padded<std::atomic<int64_t>>[gtc->task_num];
+        init_index();
         if (get_recovered_pblks()) {
             recover();
         }
@@ -102,8 +158,9 @@ public:
     ~MontageLfHashTable(){
         recover_mode(); // PDELETE --> noop
         // clear transient structures.
-        clear();
+        free_index();
         online_mode(); // re-enable PDELETE.
+        delete[] counts;
     };
 
     void init_thread(GlobalTestConfig* gtc, LocalTestConfig* ltc){
@@ -111,16 +168,8 @@ public:
     }
     void clear(){
         //single-threaded; for recovery test only
-        for (uint64_t i = 0; i < idxSize; i++){
-            Node* curr = buckets[i].ui.ptr.load(this);
-            Node* next = nullptr;
-            while(curr){
-                next = curr->next.ptr.load(this);
-                delete curr;
-                curr = next;
-            }
-            buckets[i].ui.ptr.store(this,nullptr);
-        }
+        free_index();
+        init_index();
     }
     int recover(){
         int rec_cnt = 0;
@@ -128,22 +177,18 @@ public:
         if (gtc->checkEnv("RecoverThread")){
             rec_thd = stoi(gtc->getEnv("RecoverThread"));
         }
-        std::unordered_map<uint64_t, pds::PBlk*>* recovered = get_recovered_pblks(); 
+        pds::RecoveredPBlks* recovered = get_recovered_pblks(); 
         assert(recovered);
+        rec_cnt = recovered->size();
+        // size the index once rather than doubling it along the way
+        uint64_t b = bucket_num.load();
+        while (b < MAX_BUCKETS && b*LOAD_FACTOR < (uint64_t)rec_cnt){
+            b *= 2;
+        }
+        bucket_num.store(b);
+        counts[0].ui.fetch_add(rec_cnt);
 
-        std::vector<Payload*> payloadVector;
-        payloadVector.reserve(recovered->size());
         auto begin = chrono::high_resolution_clock::now();
-        for (auto itr = recovered->begin(); itr != recovered->end(); itr++){
-            rec_cnt++;
-            Payload* payload = reinterpret_cast<Payload*>(itr->second);
-            payloadVector.push_back(payload);
-        }
-        auto end = chrono::high_resolution_clock::now();
-        auto dur = end - begin;
-        auto dur_ms_vec = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
-        std::cout << "Spent " << dur_ms_vec << "ms building vector" << std::endl;
-        begin = chrono::high_resolution_clock::now();
         std::vector<std::thread> workers;
         for (int rec_tid = 0; rec_tid < rec_thd; rec_tid++) {
             workers.emplace_back(std::thread([&, rec_tid]() {
@@ -151,11 +196,10 @@ public:
                 hwloc_set_cpubind(gtc->topology,
                                   gtc->affinities[rec_tid]->cpuset,
                                   HWLOC_CPUBIND_THREAD);
-                for (size_t i = rec_tid; i < payloadVector.size(); i += rec_thd) {
+                recovered->for_each(rec_tid, rec_thd, [&](pds::PBlk* blk){
                     // re-insert payload.
-                    Node* tmpNode = new Node(this, payloadVector[i]);
+                    Node* tmpNode = new Node(this, reinterpret_cast<Payload*>(blk));
                     K key = tmpNode->get_key();
-                    size_t idx = hash_fn(key) % idxSize;
                     MarkPtr* prev = nullptr;
                     Node* curr;
                     Node* next;
@@ -173,7 +217,7 @@ public:
                             // abort_op();
                         }
                     }
-                }
+                });
             }));  // workers.emplace_back()
         }// for (rec_thd)
         for (auto& worker : workers) {
@@ -181,8 +225,8 @@ public:
                     worker.join();
                 }
         }
-        end = chrono::high_resolution_clock::now();
-        dur = end - begin;
+        auto end = chrono::high_resolution_clock::now();
+        auto dur = end - begin;
         auto dur_ms_ins = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
         std::cout << "Spent " << dur_ms_ins << "ms inserting(" << recovered->size() << ")" << std::endl;
         return rec_cnt;
@@ -204,8 +248,8 @@ class MontageLfHashTableFactory : public RideableFactory{
 
 
 //-------Definition----------
-template <class K, class V, int idxSize> 
-optional<V> MontageLfHashTable<K,V,idxSize>::get(K key, int tid) {
+template <class K, class V, int initSize> 
+optional<V> MontageLfHashTable<K,V,initSize>::get(K key, int tid) {
     optional<V> res={};
     MarkPtr* prev=nullptr;
     Node* curr;
@@ -222,8 +266,8 @@ optional<V> MontageLfHashTable<K,V,idxSize>::get(K key, int tid) {
     return res;
 }
 
-template <class K, class V, int idxSize> 
-optional<V> MontageLfHashTable<K,V,idxSize>::put(K key, V val, int tid) {
+template <class K, class V, int initSize> 
+optional<V> MontageLfHashTable<K,V,initSize>::put(K key, V val, int tid) {
     optional<V> res={};
     Node* tmpNode = nullptr;
     MarkPtr* prev=nullptr;
@@ -258,6 +302,7 @@ optional<V> MontageLfHashTable<K,V,idxSize>::put(K key, V val, int tid) {
             // begin_op();
             if(prev->ptr.CAS_verify(this,curr,tmpNode)) {
                 // end_op();
+                note_insert(tid);
                 break;
             }
             // abort_op();
@@ -268,8 +313,8 @@ optional<V> MontageLfHashTable<K,V,idxSize>::put(K key, V val, int tid) {
     return res;
 }
 
-template <class K, class V, int idxSize> 
-bool MontageLfHashTable<K,V,idxSize>::insert(K key, V val, int tid){
+template <class K, class V, int initSize> 
+bool MontageLfHashTable<K,V,initSize>::insert(K key, V val, int tid){
     bool res=false;
     Node* tmpNode = nullptr;
     MarkPtr* prev=nullptr;
@@ -290,6 +335,7 @@ bool MontageLfHashTable<K,V,idxSize>::insert(K key, V val, int tid){
             // begin_op();
             if(prev->ptr.CAS_verify(this,curr,tmpNode)) {
                 // end_op();
+                note_insert(tid);
                 res=true;
                 break;
             }
@@ -301,8 +347,8 @@ bool MontageLfHashTable<K,V,idxSize>::insert(K key, V val, int tid){
     return res;
 }
 
-template <class K, class V, int idxSize> 
-optional<V> MontageLfHashTable<K,V,idxSize>::remove(K key, int tid) {
+template <class K, class V, int initSize> 
+optional<V> MontageLfHashTable<K,V,initSize>::remove(K key, int tid) {
     optional<V> res={};
     MarkPtr* prev=nullptr;
     Node* curr;
@@ -322,6 +368,7 @@ optional<V> MontageLfHashTable<K,V,idxSize>::remove(K key, int tid) {
             continue;
         }
         // end_op();
+        note_remove(tid);
         if(prev->ptr.CAS(this,curr,next)) {
             tracker.retire(curr,tid);
         } else {
@@ -334,8 +381,8 @@ optional<V> MontageLfHashTable<K,V,idxSize>::remove(K key, int tid) {
     return res;
 }
 
-template <class K, class V, int idxSize> 
-optional<V> MontageLfHashTable<K,V,idxSize>::replace(K key, V val, int tid) {
+template <class K, class V, int initSize> 
+optional<V> MontageLfHashTable<K,V,initSize>::replace(K key, V val, int tid) {
     optional<V> res={};
     Node* tmpNode = nullptr;
     MarkPtr* prev=nullptr;
@@ -372,23 +419,134 @@ optional<V> MontageLfHashTable<K,V,idxSize>::replace(K key, V val, int tid) {
     return res;
 }
 
-template <class K, class V, int idxSize> 
-bool MontageLfHashTable<K,V,idxSize>::findNode(MarkPtr* &prev, Node* &curr, Node* &next, K key, int tid){
-    size_t idx=hash_fn(key)%idxSize;
+template <class K, class V, int initSize> 
+typename MontageLfHashTable<K,V,initSize>::Node* MontageLfHashTable<K,V,initSize>::bucket_dummy(uint64_t b){
+    int seg = b==0 ? 0 : 64-__builtin_clzll(b);
+    Node* s = segments[seg].load();
+    if(s==nullptr){
+        uint64_t n = seg==0 ? 1 : 1ULL<<(seg-1);
+        // zeroed, and aligned as nodes are by hand; large ones are
+        // mapped lazily by calloc
+        void* raw = calloc(n+1, sizeof(Node));
+        Node* tmp = reinterpret_cast<Node*>(((uintptr_t)raw + CACHELINE_SIZE-1) & ~(uintptr_t)(CACHELINE_SIZE-1));
+        if(segments[seg].compare_exchange_strong(s,tmp)){
+            segments_raw[seg] = raw;
+            s=tmp;
+        } else {
+            free(raw);
+        }
+    }
+    return &s[seg==0 ? 0 : b-(1ULL<<(seg-1))];
+}
+
+template <class K, class V, int initSize> 
+typename MontageLfHashTable<K,V,initSize>::Node* MontageLfHashTable<K,V,initSize>::get_bucket(uint64_t b, int tid){
+    Node* dummy = bucket_dummy(b);
+    int state = dummy->state.load();
+    if(state==LINKED) return dummy;
+    // bucket 0 is linked at start, so b>0 and its parent has one bit less
+    Node* parent = get_bucket(b & ~(1ULL<<(63-__builtin_clzll(b))), tid);
+    if(state!=UNLINKED || !dummy->state.compare_exchange_strong(state,LINKING)){
+        return state==LINKED ? dummy : parent;
+    }
+    dummy->so_key = so_dummy(b);
+    MarkPtr* prev=nullptr;
+    Node* curr;
+    Node* next;
+    while(true){
+        // only this thread links dummy, so it can't be found
+        findNode(&parent->next,prev,curr,next,dummy->so_key,nullptr,tid);
+        dummy->next.ptr.store(this,curr);
+        if(prev->ptr.CAS(this,curr,dummy)){
+            break;
+        }
+    }
+    dummy->state.store(LINKED);
+    return dummy;
+}
+
+template <class K, class V, int initSize> 
+void MontageLfHashTable<K,V,initSize>::note_insert(int tid){
+    int64_t c = counts[tid].ui.fetch_add(1, std::memory_order_relaxed)+1;
+    if(c%LOAD_CHECK_INTERVAL!=0) return;
+    uint64_t b = bucket_num.load();
+    if(b>=MAX_BUCKETS) return;
+    int64_t total = 0;
+    for(int i = 0; i < gtc->task_num; i++){
+        total += counts[i].ui.load(std::memory_order_relaxed);
+    }
+    if(total > (int64_t)(b*LOAD_FACTOR)){
+        // new buckets are split off lazily; losing the CAS is fine
+        bucket_num.compare_exchange_strong(b,b*2);
+    }
+}
+
+template <class K, class V, int initSize> 
+void MontageLfHashTable<K,V,initSize>::init_index(){
+    uint64_t b = 1;
+    while(b<(uint64_t)initSize && b<MAX_BUCKETS){
+        b*=2;
+    }
+    bucket_num.store(b);
+    for(int i = 0; i < 64; i++){
+        segments[i].store(nullptr);
+        segments_raw[i] = nullptr;
+    }
+    Node* head = bucket_dummy(0);
+    head->so_key = so_dummy(0);
+    head->state.store(LINKED);
+    for(int i = 0; i < gtc->task_num; i++){
+        counts[i].ui.store(0);
+    }
+}
+
+template <class K, class V, int initSize> 
+void MontageLfHashTable<K,V,initSize>::free_index(){
+    //single-threaded
+    Node* curr = getPtr(bucket_dummy(0)->next.ptr.load(this));
+    while(curr){
+        Node* next = getPtr(curr->next.ptr.load(this));
+        if(curr->so_key&1){
+            delete curr;
+        }
+        curr = next;
+    }
+    for(int i = 0; i < 64; i++){
+        free(segments_raw[i]);
+        segments[i].store(nullptr);
+    }
+}
+
+template <class K, class V, int initSize> 
+bool MontageLfHashTable<K,V,initSize>::findNode(MarkPtr* &prev, Node* &curr, Node* &next, K key, int tid){
+    uint64_t h=hash_fn(key);
+    Node* head=get_bucket(h&(bucket_num.load()-1),tid);
+    return findNode(&head->next,prev,curr,next,so_regular(h),&key,tid);
+}
+
+template <class K, class V, int initSize> 
+bool MontageLfHashTable<K,V,initSize>::findNode(MarkPtr* head, MarkPtr* &prev, Node* &curr, Node* &next, uint64_t so_key, const K* key, int tid){
     while(true){
         bool cmark=false;
-        prev=&buckets[idx].ui;
+        prev=head;
         curr=getPtr(prev->ptr.load(this));
 
         while(true){
-            if(curr==nullptr) return false;
+            // usually the dummy of the next bucket; stop before loading
+            // its next pointer, which costs a 16-byte CAS
+            if(curr==nullptr || curr->so_key>so_key) return false;
             next=curr->next.ptr.load(this);
             cmark=getMark(next);
             next=getPtr(next);
-            auto ckey=curr->get_key();
+            auto cso=curr->so_key;
             if(prev->ptr.load(this)!=curr) break;//retry
             if(!cmark) {
-                if(ckey>=key) return ckey==key;
+                if(cso==so_key){
+                    // dummies are unique; real nodes of a hash are by key
+                    if(key==nullptr) return true;
+                    auto ckey=curr->get_key();
+                    if(ckey>=*key) return ckey==*key;
+                }
                 prev=&(curr->next);
             } else {
                 if(prev->ptr.CAS(this,curr,next)) {
@@ -404,16 +562,11 @@ bool MontageLfHashTable<K,V,idxSize>::findNode(MarkPtr* &prev, Node* &curr, Node
 
 /* Specialization for strings */
 #include <string>
-#include "InPlaceString.hpp"
+#include "VarString.hpp"
 template <>
-class MontageLfHashTable<std::string, std::string>::Payload : public pds::PBlk{
-    GENERATE_FIELD(pds::InPlaceString<TESTS_KEY_SIZE>, key, Payload);
-    GENERATE_FIELD(pds::InPlaceString<TESTS_VAL_SIZE>, val, Payload);
-
+class MontageLfHashTable<std::string, std::string>::Payload : public pds::VarKVPayload<MontageLfHashTable<std::string, std::string>::Payload>{
 public:
-    Payload(std::string k, std::string v) : m_key(this, k), m_val(this, v){}
-    Payload(const Payload& oth) : pds::PBlk(oth), m_key(this, oth.m_key), m_val(this, oth.m_val){}
-    void persist(){}
+    using VarKVPayload::VarKVPayload;
 };
 
 #endif
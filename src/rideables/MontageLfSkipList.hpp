@@ -12,11 +12,11 @@
 
 #include "HarnessUtils.hpp"
 #include "ConcurrentPrimitives.hpp"
-#include "RMap.hpp"
+#include "ROrderedMap.hpp"
 #include "RCUTracker.hpp"
 
 template<class K, class V>
-class MontageLfSkipList : public RMap<K, V>, public Recoverable {
+class MontageLfSkipList : public ROrderedMap<K, V>, public Recoverable {
 public:
     class Payload : public pds::PBlk{
         GENERATE_FIELD(K, key, Payload);
@@ -144,6 +144,12 @@ private:
     int internal_finish_delete(const K& key, Node *node, Payload* node_payload, optional<V>& ret_value, int tid);
     int internal_finish_insert(const K& key, V &val, Node *node, Payload* node_payload, Node* next, Payload*& lazy_payload);
     bool internal_do_operation(operation_type optype, const K& key, optional<V>& val, optional<V>& ret_value, int tid, Payload *suggest_payload = nullptr);
+    typedef typename ROrderedMap<K, V>::Visitor Visitor;
+    Node *find_entry(const K& key);
+    bool collect(Node *entry, const K& lo, const K* hi, int count,
+                 std::vector<pds::lin_var>& reads,
+                 std::vector<std::pair<Node*, Payload*>>& items);
+    int internal_range(const K& lo, const K* hi, int count, const Visitor& visitor, int tid);
 public:
     MontageLfSkipList(GlobalTestConfig* gtc) : Recoverable(gtc), tracker(gtc->task_num + 1, 100, 1000, true), gtc(gtc) {
         int bg_tid = gtc->task_num;
@@ -195,22 +201,10 @@ public:
         if (gtc->checkEnv("RecoverThread")){
             rec_thd_count = stoi(gtc->getEnv("RecoverThread"));
         }
-        std::unordered_map<uint64_t, pds::PBlk*>* recovered = get_recovered_pblks();
+        pds::RecoveredPBlks* recovered = get_recovered_pblks();
+        rec_cnt = recovered->size();
 
-        std::vector<Payload*> payloadVector;
-        payloadVector.reserve(recovered->size());
         auto begin = chrono::high_resolution_clock::now();
-        for (auto itr = recovered->begin(); itr != recovered->end(); itr++){
-            rec_cnt++;
-            Payload* payload = reinterpret_cast<Payload*>(itr->second);
-            payloadVector.push_back(payload);
-        }
-        auto end = chrono::high_resolution_clock::now();
-        auto dur = end - begin;
-        auto dur_ms_vec = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
-        std::cout << "Spent " << dur_ms_vec << "ms building vector" << std::endl;
-
-        begin = chrono::high_resolution_clock::now();
         std::vector<std::thread> workers;
         for (int rec_tid = 0; rec_tid < rec_thd_count; rec_tid++) {
             workers.emplace_back(std::thread([&, rec_tid]() {
@@ -218,10 +212,11 @@ public:
                 hwloc_set_cpubind(gtc->topology,
                                   gtc->affinities[rec_tid]->cpuset,
                                   HWLOC_CPUBIND_THREAD);
-                for (size_t i = rec_tid; i < payloadVector.size(); i += rec_thd_count) {
+                recovered->for_each(rec_tid, rec_thd_count, [&](pds::PBlk* blk){
                     // re-insert payload.
-                    K key = payloadVector[i]->get_unsafe_key(this);
-                    V val = payloadVector[i]->get_unsafe_val(this);
+                    Payload* payload = reinterpret_cast<Payload*>(blk);
+                    K key = payload->get_unsafe_key(this);
+                    V val = payload->get_unsafe_val(this);
                     while (true) {
                         optional<V> res = {};
                         optional<V> unused = {};
@@ -229,14 +224,14 @@ public:
                             errexit("conflicting keys recovered.");
                         } else {
                             optional<V> val_opt = val;
-                            if(internal_do_operation(operation_type::INSERT, key, val_opt, unused, rec_tid, payloadVector[i])){
+                            if(internal_do_operation(operation_type::INSERT, key, val_opt, unused, rec_tid, payload)){
                                 break;
                             } else {
                                 cout << "Hmm!" << endl;
                             }
                         }
                     }
-                }
+                });
             }));
         }
         for (auto& worker : workers) {
@@ -244,8 +239,8 @@ public:
                 worker.join();
             }
         }
-        end = chrono::high_resolution_clock::now();
-        dur = end - begin;
+        auto end = chrono::high_resolution_clock::now();
+        auto dur = end - begin;
         auto dur_ms_ins = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
         std::cout << "Spent " << dur_ms_ins << "ms inserting(" << recovered->size() << ")" << std::endl;
 
@@ -258,6 +253,8 @@ public:
     optional<V> put(K key, V val, int tid);
     bool insert(K key, V val, int tid);
     optional<V> replace(K key, V val, int tid);
+    int range(K lo, K hi, const Visitor& visitor, int tid);
+    int scan(K start, int count, const Visitor& visitor, int tid);
 };
 
 template<class T>
@@ -772,18 +769,121 @@ optional<V> MontageLfSkipList<K,V>::replace(K key, V val, int tid)
     return res;
 }
 
+template<class K, class V>
+typename MontageLfSkipList<K,V>::Node *MontageLfSkipList<K,V>::find_entry(const K& key){
+    // the last node at the node-level with a key <= key, found as in
+    // internal_do_operation
+    unsigned long zero = sl_zero.load();
+    unsigned long i = head.ptr.load()->level - 1;
+    Node *item = head.ptr.load(), *next_item, *node;
+
+    while (1) {
+        next_item = item->succs[idx(i,zero)].ptr.load();
+
+        if (nullptr == next_item || next_item->key > key) {
+
+            next_item = item;
+            if (zero == i) {
+                node = item;
+                break;
+            } else {
+                --i;
+            }
+        }
+        item = next_item;
+    }
+    while ((void *) node == (void *) node->payload.load(this)) {
+        node = node->prev.ptr.load();
+    }
+    return node;
+}
+
+template<class K, class V>
+bool MontageLfSkipList<K,V>::collect(Node *entry, const K& lo, const K* hi, int count,
+                                     std::vector<pds::lin_var>& reads,
+                                     std::vector<std::pair<Node*, Payload*>>& items){
+    // walk the node-level from entry, recording the payload and next
+    // of every node on the way. returns false if entry is being removed.
+    reads.clear();
+    items.clear();
+    Node *node = entry;
+    while (nullptr != node) {
+        if (node != entry && !node->marker && nullptr != hi && *hi < node->key)
+            break;
+        pds::lin_var p = node->payload.load_versioned(this);
+        reads.push_back(p);
+        Payload *payload = p.get_val<Payload *>();
+        if ((void *) payload == (void *) node) {
+            // a marker, or a node being removed
+            if (node == entry)
+                return false;
+        } else if (nullptr != payload && !(node->key < lo)) {
+            items.emplace_back(node, payload);
+            if ((int) items.size() == count)
+                break;
+        }
+        pds::lin_var n = node->next.ptr.load_versioned(this);
+        reads.push_back(n);
+        node = n.get_val<Node *>();
+    }
+    return true;
+}
+
+template<class K, class V>
+int MontageLfSkipList<K,V>::internal_range(const K& lo, const K* hi, int count, const Visitor& visitor, int tid){
+    std::vector<pds::lin_var> reads, last_reads;
+    std::vector<std::pair<Node*, Payload*>> items;
+
+    tracker.start_op(tid);
+    // double collect: next and payload pointers change their counters
+    // on every update, so if two walks in a row read the same values,
+    // the items were all in the list between the two walks.
+    Node *entry = find_entry(lo);
+    bool valid = collect(entry, lo, hi, count, last_reads, items);
+    while (1) {
+        if (!valid) {
+            entry = find_entry(lo);
+            valid = collect(entry, lo, hi, count, last_reads, items);
+            continue;
+        }
+        valid = collect(entry, lo, hi, count, reads, items);
+        if (valid && reads == last_reads)
+            break;
+        std::swap(reads, last_reads);
+    }
+
+    {
+        // payloads were found before BEGIN_OP, so no old-see-new
+        MontageOpHolderReadOnly _holder(this);
+        for (auto& item : items) {
+            visitor(item.first->key, V(item.second->get_unsafe_val(this)));
+        }
+    }
+    tracker.end_op(tid);
+    return items.size();
+}
+
+template<class K, class V>
+int MontageLfSkipList<K,V>::range(K lo, K hi, const Visitor& visitor, int tid)
+{
+    return internal_range(lo, &hi, -1, visitor, tid);
+}
+
+template<class K, class V>
+int MontageLfSkipList<K,V>::scan(K start, int count, const Visitor& visitor, int tid)
+{
+    if (count <= 0)
+        return 0;
+    return internal_range(start, nullptr, count, visitor, tid);
+}
+
 /* Specialization for strings */
 #include <string>
-#include "InPlaceString.hpp"
+#include "VarString.hpp"
 template <>
-class MontageLfSkipList<std::string, std::string>::Payload : public pds::PBlk{
-    GENERATE_FIELD(pds::InPlaceString<TESTS_KEY_SIZE>, key, Payload);
-    GENERATE_FIELD(pds::InPlaceString<TESTS_VAL_SIZE>, val, Payload);
-
+class MontageLfSkipList<std::string, std::string>::Payload : public pds::VarKVPayload<MontageLfSkipList<std::string, std::string>::Payload>{
 public:
-    Payload(std::string k, std::string v) : m_key(this, k), m_val(this, v){}
-    Payload(const Payload& oth) : pds::PBlk(oth), m_key(this, oth.m_key), m_val(this, oth.m_val){}
-    void persist(){}
+    using VarKVPayload::VarKVPayload;
 };
 
 #endif
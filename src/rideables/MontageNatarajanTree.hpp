@@ -4,15 +4,17 @@
 #include <iostream>
 #include <atomic>
 #include <algorithm>
+#include <vector>
+#include <thread>
 #include "HarnessUtils.hpp"
 #include "ConcurrentPrimitives.hpp"
-#include "RMap.hpp"
+#include "ROrderedMap.hpp"
 #include "RCUTracker.hpp"
 #include "CustomTypes.hpp"
 #include "Recoverable.hpp"
 
 template <class K, class V>
-class MontageNatarajanTree : public RMap<K,V>, public Recoverable{
+class MontageNatarajanTree : public ROrderedMap<K,V>, public Recoverable{
 public:
     class Payload : public pds::PBlk{
         GENERATE_FIELD(K, key, Payload);
@@ -36,6 +38,9 @@ private:
 
         Node(MontageNatarajanTree* ds_, K k, V val, Node* l=nullptr, Node* r=nullptr):
             ds(ds_), level(finite),left(l),right(r),key(k),payload(ds_->pnew<Payload>(key, val)){ };
+        // a leaf for a recovered payload
+        Node(MontageNatarajanTree* ds_, Payload* p):
+            ds(ds_), level(finite),left(nullptr),right(nullptr),key((K)p->get_unsafe_key(ds_)),payload(p){ };
         Node(MontageNatarajanTree* ds_, Level lev, Node* l=nullptr, Node* r=nullptr):
             ds(ds_), level(lev),left(l),right(r),key(),payload(nullptr){
             assert(lev != finite && "use constructor with another signature for concrete nodes!");
@@ -88,6 +93,7 @@ private:
     Node r{this,inf2};
     Node s{this,inf1};
     padded<SeekRecord>* records;
+    GlobalTestConfig* gtc;
     const size_t GET_POINTER_BITS = 0xfffffffffffffffc;//for machine 64-bit or less.
 
     /* helper functions */
@@ -147,15 +153,22 @@ private:
     void seek(K key, int tid);
     bool cleanup(K key, int tid);
     void retire_path(Node* start, Node* end, int tid);
-    // void doRangeQuery(Node& k1, Node& k2, int tid, Node* root, std::map<K,V>& res);
+    typedef typename ROrderedMap<K,V>::Visitor Visitor;
+    void collect(const K& lo, const K* hi, int count,
+        std::vector<pds::lin_var>& reads, std::vector<Node*>& leaves);
+    int internal_range(const K& lo, const K* hi, int count, const Visitor& visitor, int tid);
+    Node* build(const std::vector<Node*>& subtrees, const std::vector<Node*>& mins, size_t first, size_t last);
 public:
-    MontageNatarajanTree(GlobalTestConfig* gtc):
-        Recoverable(gtc), tracker(gtc->task_num, 100, 1000, true){
+    MontageNatarajanTree(GlobalTestConfig* gtc_):
+        Recoverable(gtc_), tracker(gtc_->task_num, 100, 1000, true), gtc(gtc_){
         r.right.store(this,new Node(this,inf2));
         r.left.store(this,&s);
         s.right.store(this,new Node(this,inf1));
         s.left.store(this,new Node(this,inf0));
         records = new padded<SeekRecord>[gtc->task_num]{};
+        if (get_recovered_pblks()) {
+            recover();
+        }
     };
     ~MontageNatarajanTree(){};
 
@@ -163,17 +176,15 @@ public:
         Recoverable::init_thread(gtc, ltc);
     }
 
-    int recover(){
-        errexit("recover of MontageNatarajanTree not implemented.");
-        return 0;
-    }
+    int recover();
 
     optional<V> get(K key, int tid);
     optional<V> put(K key, V val, int tid);
     bool insert(K key, V val, int tid);
     optional<V> remove(K key, int tid);
     optional<V> replace(K key, V val, int tid);
-    // std::map<K, V> rangeQuery(K key1, K key2, int& len, int tid);
+    int range(K lo, K hi, const Visitor& visitor, int tid);
+    int scan(K start, int count, const Visitor& visitor, int tid);
 };
 
 template<class T>
@@ -562,18 +573,192 @@ optional<V> MontageNatarajanTree<K,V>::replace(K key, V val, int tid){
     return res;
 }
 
+// collect leaves with keys >= lo, up to hi or count of them, in order,
+// recording every child pointer read on the way
+template <class K, class V>
+void MontageNatarajanTree<K,V>::collect(const K& lo, const K* hi, int count,
+    std::vector<pds::lin_var>& reads, std::vector<Node*>& leaves){
+    reads.clear();
+    leaves.clear();
+    // child pointers still carrying their flag and tag
+    std::vector<Node*> stack;
+    pds::lin_var edge=s.left.load_versioned(this);
+    reads.push_back(edge);
+    stack.push_back(edge.get_val<Node*>());
+    while(!stack.empty()){
+        Node* field=stack.back();
+        stack.pop_back();
+        Node* n=getPtr(field);
+        if(n->payload!=nullptr){
+            // a leaf; a flagged one is removed
+            if(!getFlg(field) && !(n->key<lo) && (hi==nullptr || !(*hi<n->key))){
+                leaves.push_back(n);
+                if((int)leaves.size()==count) return;
+            }
+            continue;
+        }
+        pds::lin_var left=n->left.load_versioned(this);
+        reads.push_back(left);
+        if(getPtr(left.get_val<Node*>())==nullptr){
+            continue;// an infinite leaf
+        }
+        // right keys are >= n->key, left keys are less
+        if(!isInf(n) && (hi==nullptr || !nodeLess(*hi,n))){
+            pds::lin_var right=n->right.load_versioned(this);
+            reads.push_back(right);
+            stack.push_back(right.get_val<Node*>());
+        }
+        if(nodeLess(lo,n)){
+            stack.push_back(left.get_val<Node*>());
+        }
+    }
+}
+
+template <class K, class V>
+int MontageNatarajanTree<K,V>::internal_range(const K& lo, const K* hi, int count, const Visitor& visitor, int tid){
+    std::vector<pds::lin_var> reads, last_reads;
+    std::vector<Node*> leaves;
+    tracker.start_op(tid);
+    // double collect: child pointers change their counters on every
+    // update, so if two traversals in a row read the same values, the
+    // leaves were all in the tree between the two.
+    collect(lo,hi,count,last_reads,leaves);
+    while(true){
+        collect(lo,hi,count,reads,leaves);
+        if(reads==last_reads) break;
+        std::swap(reads,last_reads);
+    }
+    {
+        // leaves were found before BEGIN_OP, so no old-see-new
+        MontageOpHolderReadOnly _holder(this);
+        for(Node* leaf:leaves){
+            visitor(leaf->key,leaf->get_unsafe_val());
+        }
+    }
+    tracker.end_op(tid);
+    return leaves.size();
+}
+
+template <class K, class V>
+int MontageNatarajanTree<K,V>::range(K lo, K hi, const Visitor& visitor, int tid){
+    return internal_range(lo,&hi,-1,visitor,tid);
+}
+
+template <class K, class V>
+int MontageNatarajanTree<K,V>::scan(K start, int count, const Visitor& visitor, int tid){
+    if(count<=0) return 0;
+    return internal_range(start,nullptr,count,visitor,tid);
+}
+
+// a balanced subtree over subtrees[first, last), which are in key order
+// and non-empty; mins[i] is the leftmost leaf of subtrees[i]
+template <class K, class V>
+typename MontageNatarajanTree<K,V>::Node* MontageNatarajanTree<K,V>::build(
+    const std::vector<Node*>& subtrees, const std::vector<Node*>& mins, size_t first, size_t last){
+    if(last-first==1){
+        return subtrees[first];
+    }
+    size_t mid=first+(last-first)/2;
+    Node* n=new Node(this,inf2);
+    // keys in the right subtree are >= the internal key
+    n->set(this,mins[mid]->key,build(subtrees,mins,first,mid),build(subtrees,mins,mid,last));
+    return n;
+}
+
+/*
+ * Rather than inserting recovered payloads one by one, threads sort their
+ * leaves, merge the sorted parts pairwise, and each builds a balanced
+ * subtree over an equal share of them. The subtrees are then joined and
+ * hung left of the inf0 leaf.
+ */
+template <class K, class V>
+int MontageNatarajanTree<K,V>::recover(){
+    pds::RecoveredPBlks* recovered = get_recovered_pblks();
+    assert(recovered);
+
+    size_t rec_cnt = recovered->size();
+    int rec_thd = gtc->task_num;
+    if (gtc->checkEnv("RecoverThread")){
+        rec_thd = stoi(gtc->getEnv("RecoverThread"));
+    }
+    auto begin = chrono::high_resolution_clock::now();
+    std::vector<std::vector<Node*>> found(rec_thd);
+    std::vector<Node*> leaves(rec_cnt);
+    std::vector<Node*> roots(rec_thd, nullptr);
+    std::vector<Node*> mins(rec_thd, nullptr);
+    auto less = [](Node* a, Node* b){ return a->key < b->key; };
+    pthread_barrier_t sync_point;
+    pthread_barrier_init(&sync_point, NULL, rec_thd);
+    std::vector<std::thread> workers;
+    for (int rec_tid = 0; rec_tid < rec_thd; rec_tid++) {
+        workers.emplace_back(std::thread([&, rec_tid]() {
+            Recoverable::init_thread(rec_tid);
+            hwloc_set_cpubind(gtc->topology,
+                              gtc->affinities[rec_tid]->cpuset,
+                              HWLOC_CPUBIND_THREAD);
+            recovered->for_each(rec_tid, rec_thd, [&](pds::PBlk* blk){
+                found[rec_tid].push_back(new Node(this, reinterpret_cast<Payload*>(blk)));
+            });
+            pthread_barrier_wait(&sync_point);
+            // sort this thread's leaves in their place in leaves
+            std::vector<size_t> off(rec_thd + 1, 0);
+            for (int i = 0; i < rec_thd; i++) {
+                off[i + 1] = off[i] + found[i].size();
+            }
+            std::copy(found[rec_tid].begin(), found[rec_tid].end(), leaves.begin() + off[rec_tid]);
+            std::sort(leaves.begin() + off[rec_tid], leaves.begin() + off[rec_tid + 1], less);
+            pthread_barrier_wait(&sync_point);
+            // merge sorted parts pairwise, halving their number each round
+            for (int w = 1; w < rec_thd; w *= 2) {
+                if (rec_tid % (2 * w) == 0 && rec_tid + w < rec_thd) {
+                    std::inplace_merge(leaves.begin() + off[rec_tid],
+                                       leaves.begin() + off[rec_tid + w],
+                                       leaves.begin() + off[std::min(rec_tid + 2 * w, rec_thd)],
+                                       less);
+                }
+                pthread_barrier_wait(&sync_point);
+            }
+            size_t first = rec_cnt * rec_tid / rec_thd;
+            size_t last = rec_cnt * (rec_tid + 1) / rec_thd;
+            for (size_t i = first; i < last; i++) {
+                if (i + 1 < rec_cnt && !(leaves[i]->key < leaves[i + 1]->key)) {
+                    errexit("conflicting keys recovered.");
+                }
+            }
+            if (first < last) {
+                roots[rec_tid] = build(leaves, leaves, first, last);
+                mins[rec_tid] = leaves[first];
+            }
+        }));  // workers.emplace_back()
+    }// for (rec_thd)
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    pthread_barrier_destroy(&sync_point);
+    roots.erase(std::remove(roots.begin(), roots.end(), nullptr), roots.end());
+    mins.erase(std::remove(mins.begin(), mins.end(), nullptr), mins.end());
+    if (!roots.empty()) {
+        // as inserts into an empty tree would, put an inf0 node over the
+        // recovered keys and the inf0 leaf
+        Node* inf0_leaf = getPtr(s.left.load(this));
+        s.left.store(this, new Node(this, inf0, build(roots, mins, 0, roots.size()), inf0_leaf));
+    }
+    auto end = chrono::high_resolution_clock::now();
+    auto dur = end - begin;
+    auto dur_ms_ins = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+    std::cout << "Spent " << dur_ms_ins << "ms inserting(" << recovered->size() << ")" << std::endl;
+    return rec_cnt;
+}
+
 /* Specialization for strings */
 #include <string>
-#include "InPlaceString.hpp"
+#include "VarString.hpp"
 template <>
-class MontageNatarajanTree<std::string, std::string>::Payload : public pds::PBlk{
-    GENERATE_FIELD(pds::InPlaceString<TESTS_KEY_SIZE>, key, Payload);
-    GENERATE_FIELD(pds::InPlaceString<TESTS_VAL_SIZE>, val, Payload);
-
+class MontageNatarajanTree<std::string, std::string>::Payload : public pds::VarKVPayload<MontageNatarajanTree<std::string, std::string>::Payload>{
 public:
-    Payload(std::string k, std::string v) : m_key(this, k), m_val(this, v){}
-    Payload(const Payload& oth) : pds::PBlk(oth), m_key(this, oth.m_key), m_val(this, oth.m_val){}
-    void persist(){}
+    using VarKVPayload::VarKVPayload;
 };
 
 #endif
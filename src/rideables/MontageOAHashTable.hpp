@@ -0,0 +1,338 @@
+#ifndef MONTAGE_OA_HASHTABLE_HPP
+#define MONTAGE_OA_HASHTABLE_HPP
+
+#include "TestConfig.hpp"
+#include "RMap.hpp"
+#include "CustomTypes.hpp"
+#include "ConcurrentPrimitives.hpp"
+#include "Recoverable.hpp"
+#include <immintrin.h>
+
+/*
+ * Open-addressing hash table on Montage. The transient index is an array
+ * of cache-line buckets, each holding SLOTS one-byte tags (high bits of
+ * the hash, 0 for empty) and pointers straight to the payloads, so a
+ * lookup compares all tags of a bucket with one SSE compare and touches
+ * a payload only on a tag match.
+ *
+ * A key goes to the first free slot at or after its home bucket. Each
+ * bucket counts the keys that probed past it, so lookups stop at the
+ * first bucket with no overflow and removals need no tombstones.
+ * Operations lock the buckets they probe, in increasing order; the table
+ * doesn't wrap around, so that order is deadlock-free.
+ *
+ * idxSize: bucket count, a power of 2. The table doesn't grow.
+ */
+template<typename K, typename V, size_t idxSize=(1<<18)>
+class MontageOAHashTable : public RMap<K,V>, public Recoverable{
+public:
+
+    class Payload : public pds::PBlk{
+        GENERATE_FIELD(K, key, Payload);
+        GENERATE_FIELD(V, val, Payload);
+    public:
+        Payload(){}
+        Payload(K x, V y): m_key(x), m_val(y){}
+        Payload(const Payload& oth): pds::PBlk(oth), m_key(oth.m_key), m_val(oth.m_val){}
+        void persist(){}
+    }__attribute__((aligned(CACHELINE_SIZE)));
+
+private:
+    static const int SLOTS = 6;
+    // buckets past the last home bucket, and so the longest probe
+    static const size_t MAX_PROBE = 64;
+    static_assert((idxSize & (idxSize-1)) == 0, "idxSize must be a power of 2");
+
+    struct Bucket{
+        uint8_t tags[SLOTS];
+        std::atomic<uint8_t> locked;
+        // keys with a home at or before this bucket stored after it
+        uint16_t overflow;
+        Payload* slots[SLOTS];
+        Bucket(): tags{}, locked(0), overflow(0), slots{} {}
+        void lock(){
+            while(locked.exchange(1, std::memory_order_acquire)){
+                while(locked.load(std::memory_order_relaxed)){
+                    _mm_pause();
+                }
+            }
+        }
+        void unlock(){
+            locked.store(0, std::memory_order_release);
+        }
+        // bit i set if tags[i]==tag
+        inline unsigned match(uint8_t tag){
+            // the 8 bytes include the lock and a padding byte; mask them off
+            __m128i t = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tags));
+            unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_set1_epi8(tag)));
+            return m & ((1u<<SLOTS)-1);
+        }
+    }__attribute__((aligned(CACHELINE_SIZE)));
+    static_assert(sizeof(Bucket) == CACHELINE_SIZE, "bucket should fill a cache line");
+
+    // result of a probe; buckets [home, last] are locked
+    struct Probe{
+        size_t home;
+        size_t last;
+        // bucket and slot of the key, or of the first free slot
+        size_t bkt = 0;
+        int slot = -1;
+        bool found = false;
+    };
+
+    std::hash<K> hash_fn;
+    Bucket buckets[idxSize+MAX_PROBE];
+    GlobalTestConfig* gtc;
+
+    static inline uint64_t mix(uint64_t h){
+        // std::hash of integers is the identity; spread it over all bits
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb3fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    static inline uint8_t tag_of(uint64_t h){
+        return 0x80 | (h >> 57);
+    }
+
+    // lock the buckets key may be in and look for it
+    void probe(Probe& p, K key, uint64_t h){
+        uint8_t tag = tag_of(h);
+        p.home = p.last = h & (idxSize-1);
+        bool has_free = false;
+        while(true){
+            Bucket& b = buckets[p.last];
+            b.lock();
+            for(unsigned m = b.match(tag); m; m &= m-1){
+                int i = __builtin_ctz(m);
+                if((K)b.slots[i]->get_unsafe_key(this) == key){
+                    p.bkt = p.last;
+                    p.slot = i;
+                    p.found = true;
+                    return;
+                }
+            }
+            if(!has_free){
+                unsigned m = b.match(0);
+                if(m){
+                    p.bkt = p.last;
+                    p.slot = __builtin_ctz(m);
+                    has_free = true;
+                }
+            }
+            if(b.overflow == 0 || p.last == idxSize+MAX_PROBE-1){
+                return;
+            }
+            p.last++;
+        }
+    }
+
+    // after a failed probe, take a free slot for key, locking more
+    // buckets if none was seen
+    void claim(Probe& p, uint64_t h, Payload* payload){
+        while(p.slot < 0){
+            if(p.last == idxSize+MAX_PROBE-1){
+                errexit("MontageOAHashTable full; increase idxSize.");
+            }
+            p.last++;
+            Bucket& b = buckets[p.last];
+            b.lock();
+            unsigned m = b.match(0);
+            if(m){
+                p.bkt = p.last;
+                p.slot = __builtin_ctz(m);
+            }
+        }
+        for(size_t i = p.home; i < p.bkt; i++){
+            buckets[i].overflow++;
+        }
+        buckets[p.bkt].tags[p.slot] = tag_of(h);
+        buckets[p.bkt].slots[p.slot] = payload;
+    }
+
+    // free the slot of a found key
+    void release(Probe& p){
+        for(size_t i = p.home; i < p.bkt; i++){
+            buckets[i].overflow--;
+        }
+        buckets[p.bkt].tags[p.slot] = 0;
+        buckets[p.bkt].slots[p.slot] = nullptr;
+    }
+
+    void unlock(Probe& p){
+        for(size_t i = p.home; i <= p.last; i++){
+            buckets[i].unlock();
+        }
+    }
+
+public:
+    MontageOAHashTable(GlobalTestConfig* gtc_): Recoverable(gtc_), gtc(gtc_){
+        if (get_recovered_pblks()) {
+            recover();
+        }
+    };
+
+    ~MontageOAHashTable() {
+        recover_mode(); // PDELETE --> noop
+        // clear transient structures.
+        clear();
+        online_mode(); // re-enable PDELETE.
+    }
+
+    void init_thread(GlobalTestConfig* gtc, LocalTestConfig* ltc){
+        Recoverable::init_thread(gtc, ltc);
+    }
+
+    optional<V> get(K key, int tid){
+        uint64_t h = mix(hash_fn(key));
+        Probe p;
+        probe(p, key, h);
+        optional<V> ret = {};
+        {
+            MontageOpHolderReadOnly _holder(this);
+            if (p.found){
+                ret = (V)buckets[p.bkt].slots[p.slot]->get_unsafe_val(this);
+            }
+        }
+        unlock(p);
+        return ret;
+    }
+
+    optional<V> put(K key, V val, int tid){
+        uint64_t h = mix(hash_fn(key));
+        Payload* new_payload = pnew<Payload>(key, val);
+        Probe p;
+        probe(p, key, h);
+        optional<V> ret = {};
+        {
+            MontageOpHolder _holder(this);
+            if (p.found){
+                Payload*& slot = buckets[p.bkt].slots[p.slot];
+                ret = (V)slot->get_unsafe_val(this);
+                slot = slot->set_val(this, val);
+                pdelete(new_payload);
+            } else {
+                claim(p, h, new_payload);
+            }
+        }
+        unlock(p);
+        return ret;
+    }
+
+    bool insert(K key, V val, int tid){
+        uint64_t h = mix(hash_fn(key));
+        Payload* new_payload = pnew<Payload>(key, val);
+        Probe p;
+        probe(p, key, h);
+        {
+            MontageOpHolder _holder(this);
+            if (p.found){
+                pdelete(new_payload);
+            } else {
+                claim(p, h, new_payload);
+            }
+        }
+        unlock(p);
+        return !p.found;
+    }
+
+    optional<V> replace(K key, V val, int tid){
+        assert(false && "replace not implemented yet.");
+        return {};
+    }
+
+    optional<V> remove(K key, int tid){
+        uint64_t h = mix(hash_fn(key));
+        Probe p;
+        probe(p, key, h);
+        optional<V> ret = {};
+        {
+            MontageOpHolder _holder(this);
+            if (p.found){
+                Payload* payload = buckets[p.bkt].slots[p.slot];
+                ret = (V)payload->get_unsafe_val(this);
+                release(p);
+                pdelete(payload);
+            }
+        }
+        unlock(p);
+        return ret;
+    }
+
+    void clear(){
+        for (size_t i = 0; i < idxSize+MAX_PROBE; i++){
+            for (int j = 0; j < SLOTS; j++){
+                if (buckets[i].slots[j]){
+                    pdelete(buckets[i].slots[j]);
+                }
+                buckets[i].tags[j] = 0;
+                buckets[i].slots[j] = nullptr;
+            }
+            buckets[i].overflow = 0;
+        }
+    }
+
+    int recover(){
+        pds::RecoveredPBlks* recovered = get_recovered_pblks();
+        assert(recovered);
+
+        int rec_cnt = recovered->size();
+        int rec_thd = gtc->task_num;
+        if (gtc->checkEnv("RecoverThread")){
+            rec_thd = stoi(gtc->getEnv("RecoverThread"));
+        }
+        auto begin = chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (int rec_tid = 0; rec_tid < rec_thd; rec_tid++) {
+            workers.emplace_back(std::thread([&, rec_tid]() {
+                Recoverable::init_thread(rec_tid);
+                hwloc_set_cpubind(gtc->topology,
+                                  gtc->affinities[rec_tid]->cpuset,
+                                  HWLOC_CPUBIND_THREAD);
+                recovered->for_each(rec_tid, rec_thd, [&](pds::PBlk* blk){
+                    //re-insert payload.
+                    Payload* payload = reinterpret_cast<Payload*>(blk);
+                    K key = (K)payload->get_unsafe_key(this);
+                    uint64_t h = mix(hash_fn(key));
+                    Probe p;
+                    probe(p, key, h);
+                    if (p.found){
+                        errexit("conflicting keys recovered.");
+                    }
+                    claim(p, h, payload);
+                    unlock(p);
+                });
+            }));  // workers.emplace_back()
+        }// for (rec_thd)
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+        auto end = chrono::high_resolution_clock::now();
+        auto dur = end - begin;
+        auto dur_ms_ins = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+        std::cout << "Spent " << dur_ms_ins << "ms inserting(" << recovered->size() << ")" << std::endl;
+        return rec_cnt;
+    }
+};
+
+template <class T>
+class MontageOAHashTableFactory : public RideableFactory{
+    Rideable* build(GlobalTestConfig* gtc){
+        return new MontageOAHashTable<T,T>(gtc);
+    }
+};
+
+/* Specialization for strings */
+#include <string>
+#include "VarString.hpp"
+template <>
+class MontageOAHashTable<std::string, std::string, (1<<18)>::Payload : public pds::VarKVPayload<MontageOAHashTable<std::string, std::string, (1<<18)>::Payload>{
+public:
+    using VarKVPayload::VarKVPayload;
+};
+
+#endif
@@ -12,6 +12,8 @@
 #include "Recoverable.hpp"
 #include "Recoverable.hpp"
 #include <mutex>
+#include <thread>
+#include <vector>
 
 
 template<typename T>
@@ -23,7 +25,7 @@ public:
     public:
         Payload(){}
         Payload(T v, uint64_t n): m_val(v), m_sn(n){}
-        Payload(const Payload& oth): PBlk(oth), m_sn(0), m_val(oth.m_val){}
+        Payload(const Payload& oth): PBlk(oth), m_val(oth.m_val), m_sn(oth.m_sn){}
         void persist(){}
     };
 
@@ -38,6 +40,9 @@ private:
         // Node(): next(nullptr){}; 
         Node(MontageQueue* ds_, T v, uint64_t n=0): 
             ds(ds_), next(nullptr), payload(ds_->pnew<Payload>(v, n)), val(v){};
+        // for a recovered payload
+        Node(MontageQueue* ds_, Payload* p):
+            ds(ds_), next(nullptr), payload(p), val(){};
         // Node(T v, uint64_t n): next(nullptr), val(v){};
 
         void set_sn(uint64_t s){
@@ -64,10 +69,14 @@ private:
     // enqueue pushes node to tail
     Node* tail;
     std::mutex lock;
+    GlobalTestConfig* gtc;
 
 public:
-    MontageQueue(GlobalTestConfig* gtc): 
-        Recoverable(gtc), global_sn(0), head(nullptr), tail(nullptr){
+    MontageQueue(GlobalTestConfig* gtc_): 
+        Recoverable(gtc_), global_sn(0), head(nullptr), tail(nullptr), gtc(gtc_){
+        if (get_recovered_pblks()) {
+            recover();
+        }
     }
 
     ~MontageQueue(){};
@@ -76,10 +85,7 @@ public:
         Recoverable::init_thread(gtc, ltc);
     }
 
-    int recover(){
-        errexit("recover of MontageQueue not implemented.");
-        return 0;
-    }
+    int recover();
 
     void enqueue(T val, int tid);
     optional<T> dequeue(int tid);
@@ -127,6 +133,84 @@ optional<T> MontageQueue<T>::dequeue(int tid){
     // }
 }
 
+/*
+ * Payloads left in the queue were enqueued and not yet dequeued as of
+ * the recovered epoch, so their sns are consecutive. Sorting them on sn
+ * is then placing each at sn-min_sn, which threads do in parallel.
+ */
+template<typename T>
+int MontageQueue<T>::recover(){
+    pds::RecoveredPBlks* recovered = get_recovered_pblks();
+    assert(recovered);
+
+    size_t rec_cnt = recovered->size();
+    int rec_thd = gtc->task_num;
+    if (gtc->checkEnv("RecoverThread")){
+        rec_thd = stoi(gtc->getEnv("RecoverThread"));
+    }
+    auto begin = chrono::high_resolution_clock::now();
+    std::vector<std::vector<Payload*>> payloads(rec_thd);
+    std::vector<uint64_t> min_sns(rec_thd, UINT64_MAX);
+    std::vector<uint64_t> max_sns(rec_thd, 0);
+    std::vector<Node*> nodes(rec_cnt, nullptr);
+    pthread_barrier_t sync_point;
+    pthread_barrier_init(&sync_point, NULL, rec_thd);
+    std::vector<std::thread> workers;
+    for (int rec_tid = 0; rec_tid < rec_thd; rec_tid++) {
+        workers.emplace_back(std::thread([&, rec_tid]() {
+            Recoverable::init_thread(rec_tid);
+            hwloc_set_cpubind(gtc->topology,
+                              gtc->affinities[rec_tid]->cpuset,
+                              HWLOC_CPUBIND_THREAD);
+            recovered->for_each(rec_tid, rec_thd, [&](pds::PBlk* blk){
+                Payload* payload = reinterpret_cast<Payload*>(blk);
+                uint64_t sn = payload->get_unsafe_sn(this);
+                min_sns[rec_tid] = std::min(min_sns[rec_tid], sn);
+                max_sns[rec_tid] = std::max(max_sns[rec_tid], sn);
+                payloads[rec_tid].push_back(payload);
+            });
+            pthread_barrier_wait(&sync_point);
+            uint64_t min_sn = *std::min_element(min_sns.begin(), min_sns.end());
+            uint64_t max_sn = *std::max_element(max_sns.begin(), max_sns.end());
+            if (rec_cnt > 0 && max_sn - min_sn + 1 != rec_cnt) {
+                errexit("sns recovered by MontageQueue aren't consecutive.");
+            }
+            for (Payload* payload : payloads[rec_tid]) {
+                nodes[payload->get_unsafe_sn(this) - min_sn] = new Node(this, payload);
+            }
+            pthread_barrier_wait(&sync_point);
+            // link the nodes in this thread's part of the queue
+            size_t first = rec_cnt * rec_tid / rec_thd;
+            size_t last = rec_cnt * (rec_tid + 1) / rec_thd;
+            for (size_t i = first; i < last; i++) {
+                // with consecutive sns, a duplicate leaves a hole
+                if (nodes[i] == nullptr) {
+                    errexit("conflicting sns recovered.");
+                }
+                if (i + 1 < rec_cnt) {
+                    nodes[i]->next = nodes[i + 1];
+                }
+            }
+        }));  // workers.emplace_back()
+    }// for (rec_thd)
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    pthread_barrier_destroy(&sync_point);
+    if (rec_cnt > 0) {
+        head = nodes.front();
+        tail = nodes.back();
+        global_sn = *std::max_element(max_sns.begin(), max_sns.end()) + 1;
+    }
+    auto end = chrono::high_resolution_clock::now();
+    auto dur = end - begin;
+    auto dur_ms_ins = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+    std::cout << "Spent " << dur_ms_ins << "ms inserting(" << recovered->size() << ")" << std::endl;
+    return rec_cnt;
+}
+
 template <class T> 
 class MontageQueueFactory : public RideableFactory{
     Rideable* build(GlobalTestConfig* gtc){
@@ -20,11 +20,11 @@
 template <class K, class V>
 class MontageSSHashTable : public RMap<K, V>, public Recoverable {
     class Payload : public pds::PBlk{
+        GENERATE_FIELD(K, key, Payload);
+        GENERATE_FIELD(V, val, Payload);
     public:
-        K key;
-        V val;
-        Payload(K x, V y): key(x), val(y){}
-        Payload(const Payload& oth): pds::PBlk(oth), key(oth.key), val(oth.val){}
+        Payload(K x, V y): m_key(x), m_val(y){}
+        Payload(const Payload& oth): pds::PBlk(oth), m_key(oth.m_key), m_val(oth.m_val){}
         void persist(){}
     };
     struct Node;
@@ -51,11 +51,11 @@ class MontageSSHashTable : public RMap<K, V>, public Recoverable {
             ds->pretire(payload);
         }
         inline V get_val(){
-            return (V)payload->val;
+            return (V)payload->get_unsafe_val(ds);
         }
         inline K get_key(){
             if(payload)
-                return (K)payload->key;
+                return (K)payload->get_unsafe_key(ds);
             else
                 return K();
         }
@@ -324,14 +324,10 @@ optional<V> MontageSSHashTable<K, V>::replace(K key, V val, int tid)
 
 /* Specialization for strings */
 #include <string>
-#include "InPlaceString.hpp"
+#include "VarString.hpp"
 template <>
-class MontageSSHashTable<std::string, std::string>::Payload : public pds::PBlk{
+class MontageSSHashTable<std::string, std::string>::Payload : public pds::VarKVPayload<MontageSSHashTable<std::string, std::string>::Payload>{
 public:
-    pds::InPlaceString<TESTS_KEY_SIZE> key;
-    pds::InPlaceString<TESTS_VAL_SIZE> val;
-    Payload(std::string k, std::string v) : key(this, k), val(this, v){}
-    Payload(const Payload& oth) : pds::PBlk(oth), key(this, oth.key), val(this, oth.val){}
-    void persist(){}
+    using VarKVPayload::VarKVPayload;
 };
 #endif
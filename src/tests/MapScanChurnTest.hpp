@@ -0,0 +1,50 @@
+#ifndef MAPSCANCHURNTEST_HPP
+#define MAPSCANCHURNTEST_HPP
+
+/*
+ * This is a test with a time length for ordered mappings, in which gets
+ * are replaced by scans, as in YCSB workload E. A scan starts at a
+ * random key and visits up to a random number of pairs in [1,scan_len].
+ */
+
+#include "MapChurnTest.hpp"
+#include "ROrderedMap.hpp"
+#include <random>
+
+template <class K, class V>
+class MapScanChurnTest : public MapChurnTest<K,V>{
+public:
+	ROrderedMap<K,V>* om;
+	int scan_len;
+	MapScanChurnTest(int p_scans, int p_inserts, int p_removes, int range, int prefill, int scan_len):
+		MapChurnTest<K,V>(p_scans, 0, p_inserts, p_removes, range, prefill), scan_len(scan_len){}
+
+	virtual void init(GlobalTestConfig* gtc){
+		if(gtc->checkEnv("ScanLength")){
+			scan_len = atoi((gtc->getEnv("ScanLength")).c_str());
+		}
+		assert(scan_len>0&&"ScanLength must be positive!");
+		MapChurnTest<K,V>::init(gtc);
+	}
+
+	void allocRideable(GlobalTestConfig* gtc){
+		MapChurnTest<K,V>::allocRideable(gtc);
+		om = dynamic_cast<ROrderedMap<K,V>*>(this->m);
+		if (!om) {
+			 errexit("MapScanChurnTest must be run on ROrderedMap<K,V> type object.");
+		}
+	}
+
+	void operation(uint64_t key, int op, int tid){
+		if(op<this->prop_gets){
+			static thread_local std::mt19937_64 gen_l(tid);
+			int len = 1 + gen_l()%scan_len;
+			om->scan(this->fromInt(key), len, [](const K&, const V&){}, tid);
+		}
+		else{
+			MapChurnTest<K,V>::operation(key, op, tid);
+		}
+	}
+};
+
+#endif
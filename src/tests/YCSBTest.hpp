@@ -10,6 +10,7 @@
 
 #include "TestConfig.hpp"
 #include "RMap.hpp"
+#include "ROrderedMap.hpp"
 #include <string>
 #include <vector>
 #include <fstream>
@@ -25,6 +26,8 @@ class YCSBTest : public Test{
 public:
     // const std::string YCSB_PREFIX = "/localdisk2/ycsb_traces/ycsb/";
     RMap<std::string,std::string>* m;
+    // m if it supports scans, or null
+    ROrderedMap<std::string,std::string>* om;
     vector<std::string>** traces;
     std::string trace_prefix;
     std::string thd_num;
@@ -41,6 +44,7 @@ public:
         if (!m) {
              errexit("YCSBTest must be run on RMap<std::string,std::string> type object.");
         }
+        om = dynamic_cast<ROrderedMap<std::string, std::string>*>(ptr);
     }
     void parInit(GlobalTestConfig* gtc, LocalTestConfig* ltc){
         m->init_thread(gtc, ltc);
@@ -108,6 +112,16 @@ public:
         else if (tag == "Rea") {
             auto ret = m->get(t.substr(5), tid);
             static std::string val __attribute__((used)) = ret.value_or("");
+        } else if (tag == "Sca") {
+            // "Scan <key> <count>", as in workload E
+            if (!om) {
+                errexit("YCSBTest scans must be run on ROrderedMap<std::string,std::string> type object.");
+            }
+            std::istringstream ss(t.substr(5));
+            std::string key;
+            int count = 0;
+            ss >> key >> count;
+            om->scan(key, count, [](const std::string&, const std::string&){}, tid);
         } else {
             assert(0&&"invalid operation!");
         }
@@ -25,6 +25,11 @@ limitations under the License.
 
 #include "ConcurrentPrimitives.hpp"
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 namespace persist_func{
 	inline void clflush(void *p){
 		asm volatile ("clflush (%0)" :: "r"(p));
@@ -84,6 +89,42 @@ namespace persist_func{
 		sfence();
 	}
 
+	// copy sz bytes to dst with non-temporal stores, bypassing the cache.
+	// unaligned head and tail of dst go through the cache, so the range
+	// still needs a write-back. stores are weakly ordered: an sfence or a
+	// lock-prefixed instruction is needed before relying on them.
+	inline void nt_memcpy_nofence(void *dst, const void *src, size_t sz){
+#ifdef __SSE2__
+		char* d = (char*)dst;
+		const char* s = (const char*)src;
+		size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+		if (head >= sz){
+			memcpy(d, s, sz);
+			return;
+		}
+		memcpy(d, s, head);
+		d += head; s += head; sz -= head;
+		for (; sz >= 64; d += 64, s += 64, sz -= 64){
+			__m128i r0 = _mm_loadu_si128((const __m128i*)s);
+			__m128i r1 = _mm_loadu_si128((const __m128i*)(s+16));
+			__m128i r2 = _mm_loadu_si128((const __m128i*)(s+32));
+			__m128i r3 = _mm_loadu_si128((const __m128i*)(s+48));
+			_mm_stream_si128((__m128i*)d, r0);
+			_mm_stream_si128((__m128i*)(d+16), r1);
+			_mm_stream_si128((__m128i*)(d+32), r2);
+			_mm_stream_si128((__m128i*)(d+48), r3);
+		}
+		for (; sz >= 16; d += 16, s += 16, sz -= 16){
+			_mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+		}
+		memcpy(d, s, sz);
+#else
+		// no streaming stores; write through the cache and write back.
+		memcpy(dst, src, sz);
+		clwb_range_nofence(dst, sz);
+#endif
+	}
+
 	inline void wholewb(){
 		//sysextend(__NR_whole_cache_flush, NULL);
 		return;